@@ -112,7 +112,7 @@ void loop(void) {
     }
 }
 
-void publish_callback(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags)
+void publish_callback(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags)
 {
     if (strcmp(topic, "led") == 0 && len != 0) {
         printf("\r\nTopic: %s\r\n", topic);
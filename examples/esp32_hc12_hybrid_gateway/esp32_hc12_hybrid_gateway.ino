@@ -194,7 +194,7 @@ void loop() {
 }
 
 /* set LED to the payload */
-void publish_callback(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags)
+void publish_callback(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags)
 {
     printf("\r\nTopic: %s\r\n", topic);
     printf("Payload: ");
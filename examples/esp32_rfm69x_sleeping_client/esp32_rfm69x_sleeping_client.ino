@@ -159,7 +159,7 @@ void slumber(void) {
             wakeup_reason, t_after_us / 1000, (t_after_us - t_before_us) / 1000);
 }
 
-void publish_callback(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags)
+void publish_callback(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags)
 {
     if (strcmp(topic, "led") == 0 && len != 0) {
         printf("\r\nTopic: %s\r\n", topic);
@@ -0,0 +1,210 @@
+/* Host benchmark of the gateway's per-client work, with 10000 clients connected.
+ * Times the gateway's loop with nothing to do, a PINGREQ from every client,
+ * a publish fanned out to every client, and dropping every client once they're all lost,
+ * each given as the cost per 10000 clients.
+ *
+ * Runs on Linux or any other POSIX host, with the POSIX device and the dummy transport.
+ * To build it from this folder:
+ *   1. comment out MQTTSN_EXCLUDE_TRANSPORT_DUMMY in mqttsn_excludes.h,
+ *      and set MQTTSN_DEBUG_LEVEL to 0 in mqttsn_debug.h
+ *   2. g++ -std=gnu++11 -O2 -I../../src -I<LiteFifo dir> posix_client_benchmark.cpp ../../src/mqttsn_*.cpp \
+ *          ../../src/device/mqttsn_device_posix.cpp <LiteFifo dir>/lite_fifo.cpp -o posix_client_benchmark
+ */
+
+#include "device/mqttsn_device_posix.h"
+#include "mqttsn_transport_dummy.h"
+#include "mqttsn_messages.h"
+#include "mqttsn_gateway.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BENCH_CLIENTS           10000
+
+/* rounds of each test, the fastest is given as it's the least disturbed by anything else running */
+#define BENCH_ROUNDS            20
+
+/* clients are lost after 1.5 times this many secs of silence */
+#define BENCH_KEEPALIVE         1
+
+MQTTSNDevicePosix device(1);
+
+/* gateway address = 1, and a dummy standing in for all the clients from address 0x100 */
+MQTTSNTransportDummy gw_transport(1);
+MQTTSNTransportDummy nodes(0x100, BENCH_CLIENTS);
+MQTTSNAddress gw_addr = {{1}, 1};
+
+/* the gateway's tables are carved from here */
+alignas(MQTTSN_ARENA_ALIGN) static uint8_t arena[mqttsn_gateway_arena_len(BENCH_CLIENTS, 16, 16, 16)];
+MQTTSNGatewaySizes sizes = {BENCH_CLIENTS, 16, 16, 16};
+MQTTSNGateway gateway(&device, &sizes, arena, sizeof(arena));
+
+static uint8_t buf[MQTTSN_MAX_MSG_LEN];
+
+/* drop whatever the gateway sent back, returns how many msgs of the given type were among it */
+static uint32_t drain(uint8_t msg_type)
+{
+    MQTTSNAddress src;
+    MQTTSNHeader header;
+    uint32_t found = 0;
+
+    int32_t len;
+    while ((len = nodes.read_packet(buf, sizeof(buf), &src)) >= 0) {
+        if (len > 0 && header.unpack(buf, len) != 0 && header.msg_type == msg_type)
+            found++;
+    }
+
+    return found;
+}
+
+/* hand a packed msg from a client to the gateway, and let it reply */
+static uint32_t send(uint16_t client, uint16_t len, uint8_t reply_type)
+{
+    nodes.write_packet_from(0x100 + client, buf, len, &gw_addr);
+    gateway.loop();
+    return drain(reply_type);
+}
+
+/* microsecs taken by all clients sending the msg packed by pack(), and the number of replies */
+static uint32_t time_all(uint16_t (*pack)(uint16_t client), uint8_t reply_type, uint32_t * replies)
+{
+    *replies = 0;
+    uint32_t start = device.get_micros();
+    for (uint16_t i = 0; i < BENCH_CLIENTS; i++)
+        *replies += send(i, pack(i), reply_type);
+
+    return device.get_micros() - start;
+}
+
+static uint16_t pack_connect(uint16_t client)
+{
+    char client_id[8];
+    snprintf(client_id, sizeof(client_id), "n%u", client);
+
+    MQTTSNMessageConnect msg(BENCH_KEEPALIVE);
+    msg.flags.clean_session = 1;
+    msg.client_id = (uint8_t *)client_id;
+    msg.client_id_len = strlen(client_id);
+    return msg.pack(buf, sizeof(buf));
+}
+
+static uint16_t pack_subscribe(uint16_t client)
+{
+    (void)client;
+    
+    MQTTSNMessageSubscribe msg;
+    msg.msg_id = 1;
+    msg.topic_name = (uint8_t *)"all";
+    msg.topic_name_len = 3;
+    return msg.pack(buf, sizeof(buf));
+}
+
+static uint16_t pack_pingreq(uint16_t client)
+{
+    (void)client;
+    
+    MQTTSNMessagePingreq msg;
+    return msg.pack(buf, sizeof(buf));
+}
+
+static uint32_t min_us(uint32_t a, uint32_t b)
+{
+    return (a < b) ? a : b;
+}
+
+static void report(const char * what, uint32_t us)
+{
+    printf("%-28s %10.1f us per 10000 clients\n", what, us * 10000.0 / BENCH_CLIENTS);
+}
+
+int main(void)
+{
+    if (!gateway.begin(1)) {
+        printf("Gateway doesn't fit.\n");
+        return 1;
+    }
+
+    gateway.register_transport(&gw_transport);
+
+    uint32_t replies;
+    time_all(pack_connect, MQTTSN_CONNACK, &replies);
+    if (replies != BENCH_CLIENTS) {
+        printf("Only %u clients connected.\n", replies);
+        return 1;
+    }
+
+    time_all(pack_subscribe, MQTTSN_SUBACK, &replies);
+    if (replies != BENCH_CLIENTS) {
+        printf("Only %u clients subscribed.\n", replies);
+        return 1;
+    }
+
+    /* nothing's due, so this should cost the same whatever the number of clients */
+    uint32_t best = UINT32_MAX;
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        uint32_t start = device.get_micros();
+        for (uint32_t j = 0; j < 1000; j++)
+            gateway.loop();
+
+        best = min_us(best, device.get_micros() - start);
+    }
+
+    report("idle loop (x1000)", best);
+
+    /* every client checks in, the gateway finds each by its address */
+    best = UINT32_MAX;
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++)
+        best = min_us(best, time_all(pack_pingreq, MQTTSN_PINGRESP, &replies));
+
+    report("PINGREQ from every client", best);
+
+    /* a QoS 0 publish walks the whole subscriber list, the dummy's queue takes only the first few of the copies */
+    MQTTSNMessagePublish pub;
+    uint8_t payload[4] = {0};
+    pub.flags.topicid_type = MQTTSN_TOPIC_NORMAL;
+    pub.data = payload;
+    pub.data_len = sizeof(payload);
+
+    MQTTSNMessageRegister reg;
+    reg.msg_id = 2;
+    reg.topic_name = (uint8_t *)"all";
+    reg.topic_name_len = 3;
+    nodes.write_packet_from(0x100, buf, reg.pack(buf, sizeof(buf)), &gw_addr);
+    gateway.loop();
+
+    MQTTSNAddress src;
+    MQTTSNHeader header;
+    MQTTSNMessageRegack regack;
+    int32_t len;
+    while ((len = nodes.read_packet(buf, sizeof(buf), &src)) >= 0) {
+        uint16_t offset = (len > 0) ? header.unpack(buf, len) : 0;
+        if (offset != 0 && header.msg_type == MQTTSN_REGACK)
+            regack.unpack(&buf[offset], len - offset);
+    }
+
+    pub.topic_id = regack.topic_id;
+    best = UINT32_MAX;
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        uint16_t pub_len = pub.pack(buf, sizeof(buf));
+        uint32_t start = device.get_micros();
+        nodes.write_packet_from(0x100, buf, pub_len, &gw_addr);
+        gateway.loop();
+        best = min_us(best, device.get_micros() - start);
+        drain(MQTTSN_PUBLISH);
+    }
+
+    report("publish to every client", best);
+
+    /* then they all go quiet, and are found lost together */
+    device.delay_millis(BENCH_KEEPALIVE * 1500 + 2 * MQTTSN_TIMER_WHEEL_TICK_MS);
+    uint32_t start = device.get_micros();
+    gateway.loop();
+    report("dropping every client", device.get_micros() - start);
+
+    /* none should be left to answer */
+    if (send(0, pack_pingreq(0), MQTTSN_PINGRESP) != 0)
+        printf("Clients weren't all dropped.\n");
+
+    return 0;
+}
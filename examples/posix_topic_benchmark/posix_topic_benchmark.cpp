@@ -0,0 +1,125 @@
+/* Host benchmark of the gateway's topic lookups.
+ * A client REGISTERs topics the gateway already knows, with the gateway holding more and more topics,
+ * and the time taken per REGISTER should stay about the same however many there are.
+ *
+ * Runs on Linux or any other POSIX host, with the POSIX device and the dummy transport.
+ * To build it from this folder:
+ *   1. comment out MQTTSN_EXCLUDE_TRANSPORT_DUMMY in mqttsn_excludes.h,
+ *      and set MQTTSN_DEBUG_LEVEL to 0 in mqttsn_debug.h
+ *   2. g++ -std=gnu++11 -O2 -I../../src -I<LiteFifo dir> posix_topic_benchmark.cpp ../../src/mqttsn_*.cpp \
+ *          ../../src/device/mqttsn_device_posix.cpp <LiteFifo dir>/lite_fifo.cpp -o posix_topic_benchmark
+ */
+
+#include "device/mqttsn_device_posix.h"
+#include "mqttsn_transport_dummy.h"
+#include "mqttsn_messages.h"
+#include "mqttsn_predefined_topics.h"
+#include "mqttsn_gateway.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/* the gateway's table grows by 4 times each round, up to this many topics */
+#define BENCH_MIN_TOPICS        64
+#define BENCH_MAX_TOPICS        16384
+
+/* REGISTERs timed each round */
+#define BENCH_LOOKUPS           100000
+
+MQTTSNDevicePosix device(1);
+
+/* gateway address = 10, and a lone client at 1 */
+MQTTSNTransportDummy gw_transport(10);
+MQTTSNTransportDummy node(1);
+MQTTSNAddress gw_addr = {{10}, 1};
+
+/* the gateway's tables are carved from here, sized for the biggest round */
+alignas(MQTTSN_ARENA_ALIGN) static uint8_t arena[mqttsn_gateway_arena_len(2, BENCH_MAX_TOPICS, 4, 4)];
+
+static uint8_t buf[MQTTSN_MAX_MSG_LEN];
+
+/* drop whatever the gateway sent back, returns true if a msg of the given type was among it */
+static bool drain(uint8_t msg_type)
+{
+    MQTTSNAddress src;
+    MQTTSNHeader header;
+    bool found = false;
+
+    int32_t len;
+    while ((len = node.read_packet(buf, sizeof(buf), &src)) >= 0) {
+        if (len > 0 && header.unpack(buf, len) != 0 && header.msg_type == msg_type)
+            found = true;
+    }
+
+    return found;
+}
+
+/* hand a packed msg to the gateway, and let it reply */
+static bool send(MQTTSNGateway * gateway, uint16_t len, uint8_t reply_type)
+{
+    node.write_packet(buf, len, &gw_addr);
+    gateway->loop();
+    return drain(reply_type);
+}
+
+static bool send_register(MQTTSNGateway * gateway, uint16_t n, uint16_t msg_id)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "bench/%u", n);
+
+    MQTTSNMessageRegister msg;
+    msg.msg_id = msg_id;
+    msg.topic_name = (uint8_t *)name;
+    msg.topic_name_len = strlen(name);
+    return send(gateway, msg.pack(buf, sizeof(buf)), MQTTSN_REGACK);
+}
+
+static void run_round(uint16_t topics)
+{
+    MQTTSNGatewaySizes sizes = {2, topics, 4, 4};
+    MQTTSNGateway gateway(&device, &sizes, arena, sizeof(arena));
+    if (!gateway.begin(1)) {
+        printf("Gateway with %u topics doesn't fit.\n", topics);
+        return;
+    }
+
+    gateway.register_transport(&gw_transport);
+
+    MQTTSNMessageConnect conn;
+    conn.flags.clean_session = 1;
+    conn.client_id = (uint8_t *)"bench";
+    conn.client_id_len = 5;
+    if (!send(&gateway, conn.pack(buf, sizeof(buf)), MQTTSN_CONNACK)) {
+        printf("Couldn't connect.\n");
+        return;
+    }
+
+    /* fill the table, less the predefined topics which come first.
+       The client can only publish to a few of its own, so most REGACKs turn it down,
+       but the gateway maps every name it's sent all the same */
+    uint16_t filled = topics - MQTTSNPredefinedTopics::count();
+    uint32_t start = device.get_micros();
+    for (uint16_t i = 0; i < filled; i++)
+        send_register(&gateway, i, i + 1);
+
+    uint32_t fill_us = device.get_micros() - start;
+
+    /* then register names it knows, in no particular order */
+    start = device.get_micros();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++)
+        send_register(&gateway, device.get_random(0, filled), i % 0xFFFF + 1);
+
+    uint32_t lookup_us = device.get_micros() - start;
+
+    printf("%6u topics: %8.1f ns per new topic, %8.1f ns per known topic\n", topics,
+           1000.0 * fill_us / filled, 1000.0 * lookup_us / BENCH_LOOKUPS);
+}
+
+int main(void)
+{
+    for (uint32_t topics = BENCH_MIN_TOPICS; topics <= BENCH_MAX_TOPICS; topics *= 4)
+        run_round(topics);
+
+    return 0;
+}
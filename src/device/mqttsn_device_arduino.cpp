@@ -20,6 +20,11 @@ uint32_t MQTTSNDeviceArduino::get_millis(void)
     return millis();
 }
 
+uint32_t MQTTSNDeviceArduino::get_micros(void) 
+{
+    return micros();
+}
+
 void MQTTSNDeviceArduino::delay_millis(uint32_t ms) 
 {
     delay(ms);
@@ -0,0 +1,85 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+#include "mqttsn_device_posix.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+static uint64_t monotonic_micros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+MQTTSNDevicePosix::MQTTSNDevicePosix(void)
+{
+    /* the pid too, so processes started together don't pick the same numbers */
+    seed_random(monotonic_micros() ^ ((uint64_t)getpid() << 32));
+}
+
+MQTTSNDevicePosix::MQTTSNDevicePosix(uint64_t seed)
+{
+    seed_random(seed);
+}
+
+uint32_t MQTTSNDevicePosix::get_millis(void)
+{
+    return (uint32_t)(monotonic_micros() / 1000);
+}
+
+uint32_t MQTTSNDevicePosix::get_micros(void)
+{
+    return (uint32_t)monotonic_micros();
+}
+
+void MQTTSNDevicePosix::delay_millis(uint32_t ms)
+{
+    struct timespec req;
+    req.tv_sec = ms / 1000;
+    req.tv_nsec = (long)(ms % 1000) * 1000000L;
+
+    /* sleep out whatever's left if a signal cuts it short */
+    while (nanosleep(&req, &req) == -1 && errno == EINTR)
+        ;
+}
+
+void MQTTSNDevicePosix::cede(void)
+{
+    sched_yield();
+}
+
+uint32_t MQTTSNDevicePosix::get_random(uint32_t min, uint32_t max)
+{
+    if (max <= min)
+        return min;
+
+    /* xorshift64* */
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    uint32_t r = (random_state * 0x2545F4914F6CDD1DULL) >> 32;
+
+    /* scaled into the range rather than taken modulo it, so the low end isn't favoured */
+    return min + (uint32_t)(((uint64_t)r * (max - min)) >> 32);
+}
+
+void MQTTSNDevicePosix::seed_random(uint64_t seed)
+{
+    /* splitmix64, so even small seeds start from a well-mixed state; xorshift must never be 0 */
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    random_state = (z != 0) ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+#endif
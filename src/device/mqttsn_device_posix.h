@@ -0,0 +1,30 @@
+#ifndef MQTTSN_DEVICE_POSIX_H_
+#define MQTTSN_DEVICE_POSIX_H_
+
+#include <stdint.h>
+#include "../mqttsn_device.h"
+
+/* For Linux and other POSIX hosts: ticks from the monotonic clock, so they never jump with the wall clock,
+ * and random numbers from a xorshift generator seeded from it */
+class MQTTSNDevicePosix final : public MQTTSNDevice {
+    public:
+        MQTTSNDevicePosix(void);
+
+        /* for a repeatable run */
+        MQTTSNDevicePosix(uint64_t seed);
+
+        virtual uint32_t get_millis(void);
+        virtual uint32_t get_micros(void);
+        virtual void cede(void);
+        virtual void delay_millis(uint32_t ms);
+
+        /* between min and max - 1, like Arduino's random() */
+        virtual uint32_t get_random(uint32_t min, uint32_t max);
+
+    private:
+        void seed_random(uint64_t seed);
+
+        uint64_t random_state;
+};
+
+#endif
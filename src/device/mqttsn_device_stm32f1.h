@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include "../mqttsn_device.h"
 
-class MQTTSNDeviceSTM32F1 : public MQTTSNDevice {
+class MQTTSNDeviceSTM32F1 final : public MQTTSNDevice {
     public:
         MQTTSNDeviceSTM32F1(void);
         
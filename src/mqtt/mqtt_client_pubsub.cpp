@@ -18,7 +18,7 @@ void MQTTClientPubsub::register_callbacks(void * self, MQTTClientConnectCallback
     client->setMethodCallback(this, MQTTClientPubsub::publish_cb);
 }
 
-void MQTTClientPubsub::publish(const char * topic, uint8_t * payload, uint8_t length, MQTTSNFlags * flags) 
+void MQTTClientPubsub::publish(const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags) 
 {
     client->publish(topic, payload, length, flags->retain);
 }
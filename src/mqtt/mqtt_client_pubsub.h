@@ -12,11 +12,11 @@ class MQTTClientPubsub : public MQTTClient {
     public:
         MQTTClientPubsub(PubSubClient * client);
         virtual void register_callbacks(void * self, MQTTClientConnectCallback conn_cb, MQTTClientMessageCallback msg_cb);
-        virtual void publish(const char * topic, uint8_t * payload, uint8_t length, MQTTSNFlags * flags);
+        virtual void publish(const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags);
         virtual void subscribe(const char * topic, uint8_t qos);
         virtual void unsubscribe(const char * topic);
         
-        void loop(void);
+        virtual void loop(void);
     
     private:
         static void publish_cb(void * which, char * topic, uint8_t * payload, unsigned int length);
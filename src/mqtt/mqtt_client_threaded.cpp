@@ -0,0 +1,175 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+
+#include "mqtt_client_threaded.h"
+#include "mqttsn_messages.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <chrono>
+
+MQTTClientThreaded::MQTTClientThreaded(MQTTClient * client) :
+    client(client), self(NULL), conn_cb(NULL), msg_cb(NULL),
+    call_ring(call_buf, MQTTSN_THREADED_RING_LEN, sizeof(MQTTClientThreadedCall)),
+    event_ring(event_buf, MQTTSN_THREADED_RING_LEN, sizeof(MQTTClientThreadedCall)),
+    conn(0), conn_seen(0), dropped(0), running(false)
+{
+
+}
+
+MQTTClientThreaded::~MQTTClientThreaded(void)
+{
+    stop();
+}
+
+bool MQTTClientThreaded::start(void)
+{
+    if (running)
+        return false;
+
+    running = true;
+    thread = std::thread(&MQTTClientThreaded::run, this);
+    return true;
+}
+
+void MQTTClientThreaded::stop(void)
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+void MQTTClientThreaded::register_callbacks(void * self, MQTTClientConnectCallback conn_cb, MQTTClientMessageCallback msg_cb)
+{
+    this->self = self;
+    this->conn_cb = conn_cb;
+    this->msg_cb = msg_cb;
+
+    /* events come to us first, then get passed on from loop() */
+    client->register_callbacks(this, MQTTClientThreaded::connect_cb, MQTTClientThreaded::message_cb);
+}
+
+void MQTTClientThreaded::publish(const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags)
+{
+    if (!queue_call(&call_ring, MQTTClientThreaded_PUBLISH, topic, payload, length, flags))
+        MQTTSN_ERROR_PRINTLN("MQTT call queue is full!");
+}
+
+void MQTTClientThreaded::subscribe(const char * topic, uint8_t qos)
+{
+    MQTTSNFlags flags;
+    flags.all = 0;
+    flags.qos = qos;
+
+    if (!queue_call(&call_ring, MQTTClientThreaded_SUBSCRIBE, topic, NULL, 0, &flags))
+        MQTTSN_ERROR_PRINTLN("MQTT call queue is full!");
+}
+
+void MQTTClientThreaded::unsubscribe(const char * topic)
+{
+    if (!queue_call(&call_ring, MQTTClientThreaded_UNSUBSCRIBE, topic, NULL, 0, NULL))
+        MQTTSN_ERROR_PRINTLN("MQTT call queue is full!");
+}
+
+void MQTTClientThreaded::loop(void)
+{
+    /* raise the wrapped client's events on the caller's thread */
+    uint32_t latest = conn.load();
+    if (latest != conn_seen && conn_cb != NULL) {
+        bool conn_state = latest & 1;
+        uint32_t changes = ((latest >> 1) - (conn_seen >> 1)) & 0x7FFFFFFFUL;
+
+        /* it dropped and came back (or the other way) since we last looked, the gateway still needs both */
+        if (changes > 1 && conn_state == (bool)(conn_seen & 1))
+            conn_cb(self, !conn_state);
+
+        conn_cb(self, conn_state);
+    }
+    conn_seen = latest;
+
+    uint32_t lost = dropped.exchange(0);
+    if (lost != 0)
+        MQTTSN_ERROR_PRINTLN("MQTT event queue was full, %u msgs dropped!", (unsigned)lost);
+
+    MQTTClientThreadedCall * event;
+    while ((event = (MQTTClientThreadedCall *)event_ring.front()) != NULL) {
+        if (msg_cb != NULL)
+            msg_cb(self, event->topic, event->payload, event->length, &event->flags);
+
+        event_ring.pop();
+    }
+}
+
+bool MQTTClientThreaded::queue_call(MQTTSNSpscRing * ring, MQTTClientThreadedOp op, const char * topic,
+                                    const uint8_t * payload, uint16_t length, MQTTSNFlags * flags)
+{
+    if ((topic != NULL && strlen(topic) > MQTTSN_MAX_MQTT_TOPICNAME_LEN) || length > MQTTSN_MAX_PAYLOAD_LEN)
+        return false;
+
+    MQTTClientThreadedCall * call = (MQTTClientThreadedCall *)ring->reserve();
+    if (call == NULL)
+        return false;
+
+    call->op = op;
+    call->topic[0] = 0;
+    if (topic != NULL)
+        strcpy(call->topic, topic);
+
+    if (length != 0)
+        memcpy(call->payload, payload, length);
+
+    call->length = length;
+    call->flags.all = (flags != NULL) ? flags->all : 0;
+
+    ring->commit();
+    return true;
+}
+
+void MQTTClientThreaded::connect_cb(void * which, bool conn_state)
+{
+    MQTTClientThreaded * self = static_cast<MQTTClientThreaded*>(which);
+
+    /* we're the only writer, so bumping the count this way is safe */
+    uint32_t changes = (self->conn.load() >> 1) + 1;
+    self->conn.store((changes << 1) | (conn_state ? 1 : 0));
+}
+
+void MQTTClientThreaded::message_cb(void * which, const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags)
+{
+    MQTTClientThreaded * self = static_cast<MQTTClientThreaded*>(which);
+
+    /* the gateway couldn't pass on anything longer anyway */
+    if (!queue_call(&self->event_ring, MQTTClientThreaded_PUBLISH, topic, payload, length, flags))
+        self->dropped++;
+}
+
+void MQTTClientThreaded::run(void)
+{
+    while (running) {
+        bool busy = false;
+
+        MQTTClientThreadedCall * call;
+        while ((call = (MQTTClientThreadedCall *)call_ring.front()) != NULL) {
+            if (call->op == MQTTClientThreaded_PUBLISH)
+                client->publish(call->topic, call->payload, call->length, &call->flags);
+            else if (call->op == MQTTClientThreaded_SUBSCRIBE)
+                client->subscribe(call->topic, call->flags.qos);
+            else if (call->op == MQTTClientThreaded_UNSUBSCRIBE)
+                client->unsubscribe(call->topic);
+
+            call_ring.pop();
+            busy = true;
+        }
+
+        client->loop();
+
+        if (!busy)
+            std::this_thread::sleep_for(std::chrono::microseconds(MQTTSN_THREADED_IDLE_US));
+    }
+}
+
+#endif
@@ -0,0 +1,84 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTT_CLIENT_THREADED_H_
+#define MQTT_CLIENT_THREADED_H_
+
+#include "mqttx_client.h"
+#include "mqttsn_defines.h"
+#include "mqttsn_spsc_ring.h"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+typedef enum {
+    MQTTClientThreaded_PUBLISH,
+    MQTTClientThreaded_SUBSCRIBE,
+    MQTTClientThreaded_UNSUBSCRIBE
+} MQTTClientThreadedOp;
+
+/* a call on its way to the wrapped client, or a msg on its way back from it */
+typedef struct {
+    MQTTClientThreadedOp op;
+    char topic[MQTTSN_MAX_MQTT_TOPICNAME_LEN + 1];
+    uint8_t payload[MQTTSN_MAX_PAYLOAD_LEN];
+    uint16_t length;
+
+    /* QoS of a SUBSCRIBE is in flags.qos */
+    MQTTSNFlags flags;
+} MQTTClientThreadedCall;
+
+/* Wraps another MQTT client, running it and all its network I/O on a thread of its own,
+ * so a stalled broker connection doesn't hold up the gateway. Calls are queued for the thread,
+ * and its msgs are queued for loop(), which raises them and any change of connection state on the gateway's thread.
+ * Start it after the gateway's begin(), and call its loop() where the wrapped client's would have been */
+class MQTTClientThreaded : public MQTTClient {
+    public:
+        MQTTClientThreaded(MQTTClient * client);
+        ~MQTTClientThreaded(void);
+
+        bool start(void);
+        void stop(void);
+
+        virtual void register_callbacks(void * self, MQTTClientConnectCallback conn_cb, MQTTClientMessageCallback msg_cb);
+        virtual void publish(const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags);
+        virtual void subscribe(const char * topic, uint8_t qos);
+        virtual void unsubscribe(const char * topic);
+        virtual void loop(void);
+
+    private:
+        /* fill in a call, false if it doesn't fit or the ring's full */
+        static bool queue_call(MQTTSNSpscRing * ring, MQTTClientThreadedOp op, const char * topic,
+                                const uint8_t * payload, uint16_t length, MQTTSNFlags * flags);
+
+        /* raised by the wrapped client, on our thread */
+        static void connect_cb(void * which, bool conn_state);
+        static void message_cb(void * which, const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags);
+
+        void run(void);
+
+        MQTTClient * client;
+
+        void * self;
+        MQTTClientConnectCallback conn_cb;
+        MQTTClientMessageCallback msg_cb;
+
+        /* calls for the wrapped client, and its msgs for the gateway */
+        MQTTSNSpscRing call_ring;
+        MQTTSNSpscRing event_ring;
+        uint8_t call_buf[MQTTSN_THREADED_RING_LEN * sizeof(MQTTClientThreadedCall)];
+        uint8_t event_buf[MQTTSN_THREADED_RING_LEN * sizeof(MQTTClientThreadedCall)];
+
+        /* latest connection state in bit 0, and the number of changes above it, so none is ever lost.
+           conn_seen is what loop() last raised */
+        std::atomic<uint32_t> conn;
+        uint32_t conn_seen;
+
+        /* msgs that didn't fit in event_ring since loop() last reported them */
+        std::atomic<uint32_t> dropped;
+
+        std::thread thread;
+        std::atomic<bool> running;
+};
+
+#endif
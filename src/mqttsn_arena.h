@@ -0,0 +1,62 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_ARENA_H_
+#define MQTTSN_ARENA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* every chunk handed out starts on this boundary, enough for any of our tables */
+#define MQTTSN_ARENA_ALIGN              8
+
+/* Hands out consecutive chunks of a block of memory given by the user, for tables sized at runtime.
+ * Nothing is ever given back, the whole block belongs to its owner for good */
+class MQTTSNArena {
+    public:
+    MQTTSNArena(void * buf, uint32_t len) : buf((uint8_t *)buf), len(len), used(0)
+    {
+        /* the block itself may not start on the boundary */
+        uint32_t skip = (MQTTSN_ARENA_ALIGN - (uint32_t)((uintptr_t)buf & (MQTTSN_ARENA_ALIGN - 1))) & (MQTTSN_ARENA_ALIGN - 1);
+        used = (buf == NULL || skip > len) ? len : skip;
+    }
+
+    /* the next chunk of 'size' bytes, NULL once the block's used up */
+    void * take(uint32_t size)
+    {
+        if (len - used < size)
+            return NULL;
+
+        void * chunk = buf + used;
+        used += align(size);
+        if (used > len)
+            used = len;
+
+        return chunk;
+    }
+
+    /* a chunk's size rounded up to the boundary */
+    static constexpr uint32_t align(uint32_t size)
+    {
+        return (size + MQTTSN_ARENA_ALIGN - 1) & ~(uint32_t)(MQTTSN_ARENA_ALIGN - 1);
+    }
+
+    /* room for 'size' bytes of chunks in a block that may not start on the boundary */
+    static constexpr uint32_t block_len(uint32_t size)
+    {
+        return size + MQTTSN_ARENA_ALIGN - 1;
+    }
+
+    /* the smallest power of 2 at least twice n, the length of an open-addressed index of n entries */
+    static constexpr uint32_t index_len(uint32_t n, uint32_t len = 1)
+    {
+        return (len >= 2 * n) ? len : index_len(n, len * 2);
+    }
+
+    private:
+    uint8_t * buf;
+    uint32_t len;
+    uint32_t used;
+};
+
+#endif
@@ -13,15 +13,15 @@
 MQTTSNClient::MQTTSNClient(MQTTSNDevice * device, MQTTSNTransport * transport) :
     gateways(NULL), gateways_capacity(0), pub_topics(NULL),
 	sub_topics(NULL), sub_topics_cnt(0), pub_topics_cnt(0),
-	publish_cb(NULL), device(device), transport(transport),
+	publish_cb(NULL), device(device), transport(transport), rx_time(0),
 	client_id(NULL), state(MQTTSNState_DISCONNECTED),
 	curr_gateway(NULL), connected(false), msg_inflight_len(0),
     keepalive_interval(MQTTSN_DEFAULT_KEEPALIVE_MS), keepalive_timeout(MQTTSN_DEFAULT_KEEPALIVE_MS),
     last_in(0), last_out(0), pingresp_pending(false), 
     pingreq_timer(0), gwinfo_timer(0), searchgw_interval(MQTTSN_T_SEARCHGW), 
-    gwinfo_pending(false), curr_msg_id(0), out_msg_len(0)
+    gwinfo_pending(false), curr_msg_id(0), gw_topics_next(0), out_msg_len(0)
 {
-    
+    clear_gw_topics();
 }
 
 bool MQTTSNClient::begin(const char * client_id)
@@ -55,10 +55,15 @@ void MQTTSNClient::assign_handlers(void)
     msg_handlers[MQTTSN_SEARCHGW] = &MQTTSNClient::handle_searchgw;
     msg_handlers[MQTTSN_GWINFO] = &MQTTSNClient::handle_gwinfo;
     msg_handlers[MQTTSN_CONNACK] = &MQTTSNClient::handle_connack;
+    msg_handlers[MQTTSN_REGISTER] = &MQTTSNClient::handle_register;
     msg_handlers[MQTTSN_REGACK] = &MQTTSNClient::handle_regack;
     msg_handlers[MQTTSN_SUBACK] = &MQTTSNClient::handle_suback;
     msg_handlers[MQTTSN_UNSUBACK] = &MQTTSNClient::handle_unsuback;
     msg_handlers[MQTTSN_PUBLISH] = &MQTTSNClient::handle_publish;
+    msg_handlers[MQTTSN_PUBACK] = &MQTTSNClient::handle_puback;
+    msg_handlers[MQTTSN_PUBREC] = &MQTTSNClient::handle_pubrec;
+    msg_handlers[MQTTSN_PUBREL] = &MQTTSNClient::handle_pubrel;
+    msg_handlers[MQTTSN_PUBCOMP] = &MQTTSNClient::handle_pubcomp;
     msg_handlers[MQTTSN_PINGRESP] = &MQTTSNClient::handle_pingresp;
     msg_handlers[MQTTSN_DISCONNECT] = &MQTTSNClient::handle_disconnect;
     
@@ -96,6 +101,9 @@ MQTTSNState MQTTSNClient::loop(void)
         (this->*state_handlers[state])();
     }
     
+    /* send off anything the transport held back to batch */
+    transport->flush();
+    
     return state;
 }
 
@@ -214,9 +222,10 @@ bool MQTTSNClient::register_topics(MQTTSNPubTopic * topics, uint16_t len)
         return false;
     }
     
-    /* register any unregistered topics */
+    /* register any unregistered topics, predefined and short ones are used as is */
+    uint8_t topicid_type;
     for (int i = 0; i < pub_topics_cnt; i++) {
-        if (pub_topics[i].tid == MQTTSN_TOPICID_NOTASSIGNED) {
+        if (pub_topics[i].tid == MQTTSN_TOPICID_NOTASSIGNED && get_fixed_topic_id(pub_topics[i].name, &topicid_type) == 0) {
             register_(&pub_topics[i]);
             return false;
         }
@@ -259,7 +268,7 @@ void MQTTSNClient::register_(MQTTSNPubTopic * topic)
     curr_msg_id++;
 }
 
-bool MQTTSNClient::publish(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags)
+bool MQTTSNClient::publish(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags)
 {
 	MQTTSN_INFO_PRINTLN("Sending PUBLISH.");
     /* if we're not connected */
@@ -269,11 +278,19 @@ bool MQTTSNClient::publish(const char * topic, uint8_t * data, uint8_t len, MQTT
     /* get the topic id */
     MQTTSNMessagePublish msg;
     msg.topic_id = 0;
+    msg.flags.all = (flags == NULL) ? 0 : flags->all;
     
-    for (int i = 0; i < pub_topics_cnt; i++) {
-        if (pub_topics[i].tid != 0 && strcmp(pub_topics[i].name, topic) == 0) {
-            msg.topic_id = pub_topics[i].tid;
-            break;
+    /* predefined topics and short names have their IDs already, no need to register them */
+    uint8_t topicid_type;
+    msg.topic_id = get_fixed_topic_id(topic, &topicid_type);
+    msg.flags.topicid_type = topicid_type;
+    
+    if (msg.topic_id == 0) {
+        for (int i = 0; i < pub_topics_cnt; i++) {
+            if (pub_topics[i].tid != 0 && strcmp(pub_topics[i].name, topic) == 0) {
+                msg.topic_id = pub_topics[i].tid;
+                break;
+            }
         }
     }
     
@@ -281,11 +298,15 @@ bool MQTTSNClient::publish(const char * topic, uint8_t * data, uint8_t len, MQTT
     if (msg.topic_id == 0)
         return false;
 
-    msg.flags.all = (flags == NULL) ? 0 : flags->all;
-
     /* msgid = 0 for qos 0 */
     if (msg.flags.qos == 1 || msg.flags.qos == 2) {
-        curr_msg_id = curr_msg_id == 0 ? 1 : curr_msg_id;
+        /* no room for another unacked msg */
+        if (inflight_pubs.full())
+            return false;
+        
+        /* 0 is reserved, and skip any IDs still awaiting PUBACK or PUBCOMP */
+        while (curr_msg_id == 0 || inflight_pubs.find(curr_msg_id) != NULL)
+            curr_msg_id++;
         msg.msg_id = curr_msg_id;
 
         /* increment */
@@ -296,13 +317,61 @@ bool MQTTSNClient::publish(const char * topic, uint8_t * data, uint8_t len, MQTT
     msg.data_len = len;
     
     out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    if (out_msg_len == 0)
+        return false;
+    
     transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
 
-    /* TODO: need to note last_out for QoS 1 publish */
+    /* keep it till it's acked */
+    if (msg.flags.qos == 1 || msg.flags.qos == 2) {
+        uint8_t awaiting = (msg.flags.qos == 1) ? MQTTSN_PUBACK : MQTTSN_PUBREC;
+        inflight_pubs.add(msg.msg_id, awaiting, out_msg, out_msg_len, device->get_millis());
+        last_out = device->get_millis();
+    }
 
     return true;
 }
 
+bool MQTTSNClient::publish_noconnect(uint16_t topic_id, uint8_t * data, uint16_t len, MQTTSNFlags * flags, uint8_t gw_id)
+{
+    MQTTSN_INFO_PRINTLN("Sending QoS -1 PUBLISH.");
+    
+    MQTTSNGWInfo * gateway = (connected && gw_id == 0) ? curr_gateway : select_gateway(gw_id);
+    if (gateway == NULL)
+        return false;
+    
+    MQTTSNMessagePublish msg;
+    msg.topic_id = topic_id;
+    
+    if (flags == NULL) {
+        msg.flags.all = 0;
+        msg.flags.topicid_type = MQTTSN_TOPIC_PREDEFINED;
+    }
+    else {
+        msg.flags.all = flags->all;
+    }
+    
+    /* normal topic IDs only mean something within a connection */
+    if (msg.flags.topicid_type == MQTTSN_TOPIC_NORMAL)
+        return false;
+    
+    msg.flags.qos = MQTTSN_QOS_NOCONNECT;
+    msg.flags.dup = 0;
+    msg.msg_id = 0x0000;
+    msg.data = data;
+    msg.data_len = len;
+    
+    out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    if (out_msg_len == 0)
+        return false;
+    
+    transport->write_packet(out_msg, out_msg_len, &gateway->gw_addr);
+    
+    /* a sensor may well sleep right after this without another loop(), so don't leave it held in a batch */
+    transport->flush();
+    return true;
+}
+
 bool MQTTSNClient::subscribe_topics(MQTTSNSubTopic * topics, uint16_t len)
 {
     sub_topics = topics;
@@ -332,6 +401,15 @@ void MQTTSNClient::subscribe(MQTTSNSubTopic * topic)
     msg.topic_name = (uint8_t *)topic->name;
     msg.topic_name_len = strlen(topic->name);
     
+    /* predefined topics are sent as their ID */
+    uint8_t topicid_type;
+    uint16_t tid = get_fixed_topic_id(topic->name, &topicid_type);
+    uint8_t tid_bytes[2] = { (uint8_t)(tid >> 8), (uint8_t)(tid & 0xff) };
+    if (topicid_type == MQTTSN_TOPIC_PREDEFINED) {
+        msg.topic_name = tid_bytes;
+        msg.topic_name_len = 2;
+    }
+    
     if (msg.topic_name_len > MQTTSN_MAX_TOPICNAME_LEN)
         return;
         
@@ -339,6 +417,7 @@ void MQTTSNClient::subscribe(MQTTSNSubTopic * topic)
     curr_msg_id = (curr_msg_id == 0) ? 1 : curr_msg_id;
     msg.msg_id = curr_msg_id;
     msg.flags.all = topic->flags.all;
+    msg.flags.topicid_type = topicid_type;
     
     /* serialize and store for later */
     msg_inflight_len = msg.pack(msg_inflight, MQTTSN_MAX_MSG_LEN);
@@ -393,11 +472,21 @@ bool MQTTSNClient::unsubscribe(const char * topic_name, MQTTSNFlags * flags)
     msg.topic_name_len = strlen(topic_name);
     if (msg.topic_name_len > MQTTSN_MAX_TOPICNAME_LEN)
         return false;
+    
+    /* predefined topics are sent as their ID */
+    uint8_t topicid_type;
+    uint16_t tid = get_fixed_topic_id(topic_name, &topicid_type);
+    uint8_t tid_bytes[2] = { (uint8_t)(tid >> 8), (uint8_t)(tid & 0xff) };
+    if (topicid_type == MQTTSN_TOPIC_PREDEFINED) {
+        msg.topic_name = tid_bytes;
+        msg.topic_name_len = 2;
+    }
         
     /* 0 is reserved */
     curr_msg_id = curr_msg_id == 0 ? 1 : curr_msg_id;
     msg.msg_id = curr_msg_id;
-    msg.flags.all = flags->all;
+    msg.flags.all = (flags == NULL) ? 0 : flags->all;
+    msg.flags.topicid_type = topicid_type;
 
     /* serialize and store for later */
     msg_inflight_len = msg.pack(msg_inflight, MQTTSN_MAX_MSG_LEN);
@@ -453,6 +542,11 @@ bool MQTTSNClient::transaction_pending(void)
     return msg_inflight_len != 0;
 }
 
+uint8_t MQTTSNClient::publishes_pending(void) const
+{
+    return inflight_pubs.count();
+}
+
 void MQTTSNClient::cancel_pending(void)
 {
     msg_inflight_len = 0;
@@ -481,7 +575,7 @@ bool MQTTSNClient::disconnect(void)
 bool MQTTSNClient::sleep(uint16_t duration)
 {
     /* if we're not connected or theres a pending reply */
-    if (!connected || msg_inflight_len) {
+    if (!connected || msg_inflight_len || inflight_pubs.count() != 0) {
         return false;
     }
         
@@ -521,6 +615,68 @@ bool MQTTSNClient::awaken(void)
     return true;
 }
 
+uint32_t MQTTSNClient::next_deadline(void)
+{
+    uint32_t now = device->get_millis();
+    uint32_t deadline = MQTTSN_NO_DEADLINE;
+    
+    /* what the state handler is waiting on */
+    switch (state) {
+        case MQTTSNState_SEARCHING:
+            deadline = gwinfo_pending ? time_left(now, gwinfo_timer, searchgw_interval) : 0;
+            break;
+        case MQTTSNState_CONNECTING:
+            deadline = connected ? 0 : MQTTSN_NO_DEADLINE;
+            break;
+        case MQTTSNState_LOST:
+            deadline = 0;
+            break;
+        case MQTTSNState_ASLEEP:
+            deadline = time_left(now, started_sleeping, sleep_interval);
+            break;
+        case MQTTSNState_AWAKE:
+            deadline = pingresp_pending ? time_left(now, pingreq_timer, MQTTSN_T_RETRY) : 0;
+            break;
+        case MQTTSNState_ACTIVE:
+            if (pingresp_pending) {
+                deadline = time_left(now, pingreq_timer, MQTTSN_T_RETRY);
+            }
+            else {
+                /* ping once either side's been quiet for too long */
+                uint32_t out_left = time_left(now, last_out, keepalive_interval);
+                uint32_t in_left = time_left(now, last_in, keepalive_interval);
+                deadline = (out_left < in_left) ? out_left : in_left;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    /* then any retries */
+    if (connected) {
+        MQTTSNInflightMsg * inflight = inflight_pubs.oldest();
+        if (inflight != NULL) {
+            uint32_t left = time_left(now, inflight->sent_at, MQTTSN_T_RETRY);
+            if (left < deadline)
+                deadline = left;
+        }
+    }
+    
+    if (msg_inflight_len != 0) {
+        uint32_t left = time_left(now, unicast_timer, MQTTSN_T_RETRY);
+        if (left < deadline)
+            deadline = left;
+    }
+    
+    return deadline;
+}
+
+uint32_t MQTTSNClient::time_left(uint32_t now, uint32_t start, uint32_t interval)
+{
+    uint32_t elapsed = now - start;
+    return (elapsed < interval) ? interval - elapsed : 0;
+}
+
 void MQTTSNClient::on_message(MQTTSNPublishCallback callback)
 {
     publish_cb = callback;
@@ -533,58 +689,66 @@ MQTTSNState MQTTSNClient::status(void) const
 
 void MQTTSNClient::handle_messages(void)
 {
-    MQTTSNAddress src;
-    
-    while (true) {
-    	device->cede();
-
-        /* try to read a packet */
-        int16_t rlen = transport->read_packet(in_msg, MQTTSN_MAX_MSG_LEN, &src);
-        if (rlen <= 0)
-            return;
-            
-        MQTTSN_INFO_PRINTLN("Got message.");
+    /* through the transport and device interfaces */
+    receive<MQTTSNTransport, MQTTSNDevice>();
+}
 
+void MQTTSNClient::handle_packet(uint16_t len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got message.");
+    
+    /* a packet can hold several msgs back to back, each header gives its msg's length */
+    uint16_t pos = 0;
+    while (pos < len) {
         /* get the msg type */
         MQTTSNHeader header;
-        uint8_t offset = header.unpack(in_msg, rlen);
-        if (offset == 0)
-            continue;
+        uint16_t offset = header.unpack(&in_msg[pos], len - pos);
+        if (offset == 0 || header.length > len - pos)
+            return;
         
-        /* make sure there's a handler */
+        /* make sure there's a handler, then call it */
         uint8_t idx = header.msg_type;
-        if (idx >= MQTTSN_NUM_MSG_TYPES || msg_handlers[idx] == NULL)
-            continue;
+        if (idx < MQTTSN_NUM_MSG_TYPES && msg_handlers[idx] != NULL)
+            (this->*msg_handlers[idx])(&in_msg[pos + offset], header.length - offset, src);
         
-        /* call the handler */
-        (this->*msg_handlers[idx])(&in_msg[offset], rlen - offset, &src);
+        pos += header.length;
     }
 }
 
 void MQTTSNClient::inflight_handler(void)
 {
+    /* resend any PUBLISHes whose retry timer is up */
+    uint32_t now = device->get_millis();
+    MQTTSNInflightMsg * inflight;
+    while (connected && (inflight = inflight_pubs.oldest()) != NULL 
+            && now - inflight->sent_at >= MQTTSN_T_RETRY) 
+    {
+        /* too many retries? */
+        if (!inflight_pubs.retry(inflight, now)) {
+            lose_gateway();
+            return;
+        }
+        
+        transport->write_packet(inflight_pubs.data(inflight), inflight_pubs.length(inflight), &curr_gateway->gw_addr);
+        MQTTSN_INFO_PRINTLN("Resending PUBLISH.");
+    }
+    
     /* if there's nothing waiting */
     if (msg_inflight_len == 0) {
         return;
     }
     
     /* do we still have time? */
-    if (device->get_millis() - unicast_timer < MQTTSN_T_RETRY) {
+    if (now - unicast_timer < MQTTSN_T_RETRY) {
         return;
     }
     
-    unicast_timer = device->get_millis();
+    unicast_timer = now;
     unicast_counter++;
     
     /* too many retries? */
     if (unicast_counter > MQTTSN_N_RETRY) {
-        connected = false;
-        msg_inflight_len = 0;
-        state = MQTTSNState_LOST;
-        
-        /* Mark the gateway as unavailable */
-        curr_gateway->available = false;
-        curr_gateway = NULL;
+        lose_gateway();
         return;
     }
     
@@ -593,7 +757,76 @@ void MQTTSNClient::inflight_handler(void)
     MQTTSN_INFO_PRINTLN("Resending msg.");
 }
 
-void MQTTSNClient::handle_advertise(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::lose_gateway(void)
+{
+    connected = false;
+    msg_inflight_len = 0;
+    inflight_pubs.clear();
+    state = MQTTSNState_LOST;
+    
+    /* Mark the gateway as unavailable */
+    curr_gateway->available = false;
+    curr_gateway = NULL;
+}
+
+const char * MQTTSNClient::get_topic_name(uint8_t topicid_type, uint16_t tid)
+{
+    /* predefined ones come straight from their ID */
+    if (topicid_type == MQTTSN_TOPIC_PREDEFINED)
+        return MQTTSNPredefinedTopics::get_name(tid);
+    
+    /* short names are kept with their ID as the topic ID */
+    bool short_name = (topicid_type == MQTTSN_TOPIC_SHORTNAME);
+    for (int i = 0; i < sub_topics_cnt; i++) {
+        if (sub_topics[i].tid == tid && short_name == (strlen(sub_topics[i].name) == MQTTSN_SHORT_TOPICNAME_LEN))
+            return sub_topics[i].name;
+    }
+    
+    if (short_name)
+        return NULL;
+    
+    /* the gateway may send msgs from our wildcard subs to topics we've registered, or that it's registered with us */
+    for (int i = 0; i < pub_topics_cnt; i++) {
+        if (pub_topics[i].tid == tid)
+            return pub_topics[i].name;
+    }
+    
+    for (uint8_t i = 0; i < MQTTSN_MAX_GW_TOPICS; i++) {
+        if (gw_topics[i].tid == tid)
+            return gw_topics[i].name;
+    }
+    
+    return NULL;
+}
+
+void MQTTSNClient::clear_gw_topics(void)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_GW_TOPICS; i++) {
+        gw_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
+    }
+    gw_topics_next = 0;
+}
+
+uint16_t MQTTSNClient::get_fixed_topic_id(const char * name, uint8_t * topicid_type)
+{
+    uint8_t name_len = strlen(name);
+    
+    uint16_t tid = MQTTSNPredefinedTopics::get_id(name, name_len);
+    if (tid != 0) {
+        *topicid_type = MQTTSN_TOPIC_PREDEFINED;
+        return tid;
+    }
+    
+    if (name_len == MQTTSN_SHORT_TOPICNAME_LEN) {
+        *topicid_type = MQTTSN_TOPIC_SHORTNAME;
+        return MQTTSN_SHORT_TOPIC_ID(name);
+    }
+    
+    *topicid_type = MQTTSN_TOPIC_NORMAL;
+    return 0;
+}
+
+void MQTTSNClient::handle_advertise(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
     
     MQTTSNMessageAdvertise msg;
@@ -619,7 +852,7 @@ void MQTTSNClient::handle_advertise(uint8_t * data, uint8_t data_len, MQTTSNAddr
     }
 }
 
-void MQTTSNClient::handle_searchgw(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_searchgw(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
     MQTTSNMessageSearchGW msg;
     if (!msg.unpack(data, data_len))
@@ -627,13 +860,13 @@ void MQTTSNClient::handle_searchgw(uint8_t * data, uint8_t data_len, MQTTSNAddre
 
     /* If someone already sent one, we just reset our timer */
     if (gwinfo_pending) {
-        gwinfo_timer = device->get_millis();
+        gwinfo_timer = rx_time;
     }
     
     /* TODO: Send GWINFO from clients */
 }
 
-void MQTTSNClient::handle_gwinfo(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_gwinfo(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
 	MQTTSN_INFO_PRINTLN("Got GWINFO.");
 
@@ -683,7 +916,7 @@ void MQTTSNClient::handle_gwinfo(uint8_t * data, uint8_t data_len, MQTTSNAddress
     gwinfo_pending = false;
 }
 
-void MQTTSNClient::handle_connack(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_connack(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got CONNACK.");
     
@@ -697,7 +930,7 @@ void MQTTSNClient::handle_connack(uint8_t * data, uint8_t data_len, MQTTSNAddres
     
     /* parse our stored msg */
     MQTTSNHeader header;
-    uint8_t offset = header.unpack(msg_inflight, msg_inflight_len);
+    uint16_t offset = header.unpack(msg_inflight, msg_inflight_len);
     if (offset == 0) {
         msg_inflight_len = 0;
         return;
@@ -728,8 +961,12 @@ void MQTTSNClient::handle_connack(uint8_t * data, uint8_t data_len, MQTTSNAddres
     /* we are now connected */
     connected = true;
     msg_inflight_len = 0;
+    inflight_pubs.clear();
+    recent_ids.clear();
+    unreleased_ids.clear();
+    clear_gw_topics();
     pingresp_pending = false;
-    last_in = device->get_millis();
+    last_in = rx_time;
     
     /* re-register and re-sub topics */
     for (int i = 0; i < pub_topics_cnt; i++) {
@@ -742,7 +979,54 @@ void MQTTSNClient::handle_connack(uint8_t * data, uint8_t data_len, MQTTSNAddres
     MQTTSN_INFO_PRINTLN("Connected.\r\n");
 }
 
-void MQTTSNClient::handle_regack(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_register(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got REGISTER.");
+    
+    /* only our connected gateway should be registering topics with us */
+    if (curr_gateway == NULL || !connected || memcmp(src->bytes, curr_gateway->gw_addr.bytes, curr_gateway->gw_addr.len) != 0) {
+        return;
+    }
+    
+    MQTTSNMessageRegister msg;
+    if (!msg.unpack(data, data_len) || msg.topic_id == 0x0000 || msg.topic_name_len == 0)
+        return;
+    
+    MQTTSNMessageRegack reply;
+    reply.topic_id = msg.topic_id;
+    reply.msg_id = msg.msg_id;
+    
+    if (msg.topic_name_len > MQTTSN_MAX_TOPICNAME_LEN) {
+        reply.return_code = MQTTSN_RC_NOTSUPPORTED;
+    }
+    else {
+        /* a re-sent REGISTER takes the same place, a new one takes the place of the oldest,
+           same as in the gateway */
+        MQTTSNGWTopic * topic = NULL;
+        for (uint8_t i = 0; i < MQTTSN_MAX_GW_TOPICS; i++) {
+            if (gw_topics[i].tid == msg.topic_id) {
+                topic = &gw_topics[i];
+                break;
+            }
+        }
+        
+        if (topic == NULL) {
+            topic = &gw_topics[gw_topics_next];
+            gw_topics_next = (gw_topics_next + 1) % MQTTSN_MAX_GW_TOPICS;
+        }
+        
+        memcpy(topic->name, msg.topic_name, msg.topic_name_len);
+        topic->name[msg.topic_name_len] = 0;
+        topic->tid = msg.topic_id;
+        MQTTSN_INFO_PRINTLN("Gateway registered %s, ID: %X", topic->name, topic->tid);
+    }
+    
+    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
+    last_in = rx_time;
+}
+
+void MQTTSNClient::handle_regack(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got REGACK.");
     
@@ -758,7 +1042,7 @@ void MQTTSNClient::handle_regack(uint8_t * data, uint8_t data_len, MQTTSNAddress
         
     /* parse our stored msg */
     MQTTSNHeader header;
-    uint8_t offset = header.unpack(msg_inflight, msg_inflight_len);
+    uint16_t offset = header.unpack(msg_inflight, msg_inflight_len);
     if (offset == 0) {
         msg_inflight_len = 0;
         return;
@@ -799,10 +1083,10 @@ void MQTTSNClient::handle_regack(uint8_t * data, uint8_t data_len, MQTTSNAddress
         return;
 
     msg_inflight_len = 0;
-    last_in = device->get_millis();
+    last_in = rx_time;
 }
 
-void MQTTSNClient::handle_publish(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_publish(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
 	MQTTSN_INFO_PRINTLN("Got PUBLISH.");
 
@@ -812,29 +1096,71 @@ void MQTTSNClient::handle_publish(uint8_t * data, uint8_t data_len, MQTTSNAddres
         return;
     }
 
-    /* now unpack the message, only QoS 0 for now */
+    /* now unpack the message */
     MQTTSNMessagePublish msg;
-    if (!msg.unpack(data, data_len) || msg.msg_id != 0x0000)
+    if (!msg.unpack(data, data_len) || msg.flags.qos > 2)
+        return;
+    
+    /* QoS 0 msgs have no ID */
+    if ((msg.flags.qos == 0) != (msg.msg_id == 0x0000))
         return;
 
     /* get the topic name */
-    const char * topic_name = NULL;
-    for (int i = 0; i < sub_topics_cnt; i++) {
-        if (sub_topics[i].tid == msg.topic_id) {
-            topic_name = sub_topics[i].name;
-            break;
+    const char * topic_name = get_topic_name(msg.flags.topicid_type, msg.topic_id);
+    
+    /* prepare puback, for QoS 1 or to reject a QoS 2 msg */
+    MQTTSNMessagePuback reply;
+    reply.topic_id = msg.topic_id;
+    reply.msg_id = msg.msg_id;
+    
+    /* tell the gateway even for QoS 0, so it registers a topic we've forgotten again */
+    if (topic_name == NULL) {
+        if (msg.flags.qos != 0 || msg.flags.topicid_type == MQTTSN_TOPIC_NORMAL) {
+            reply.return_code = MQTTSN_RC_INVALIDTID;
+            out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+            transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
         }
-    }
-
-    if (topic_name == NULL)
         return;
+    }
+    
+    /* ack QoS 1 msgs, even re-sent ones we've already handled */
+    if (msg.flags.qos == 1) {
+        out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
+        
+        if (recent_ids.seen(msg.msg_id)) {
+            MQTTSN_INFO_PRINTLN("Duplicate PUBLISH dropped.");
+            return;
+        }
+        recent_ids.add(msg.msg_id);
+    }
+    /* QoS 2 msgs are held as unreleased till the PUBREL, any copies before then are dropped */
+    else if (msg.flags.qos == 2) {
+        bool duplicate = unreleased_ids.contains(msg.msg_id);
+        
+        /* no room to track another, don't ack it so the gateway tries again later */
+        if (!duplicate && !unreleased_ids.add(msg.msg_id)) {
+            MQTTSN_ERROR_PRINTLN("Too many unreleased msgs!");
+            return;
+        }
+        
+        MQTTSNMessagePubrec rec;
+        rec.msg_id = msg.msg_id;
+        out_msg_len = rec.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
+        
+        if (duplicate) {
+            MQTTSN_INFO_PRINTLN("Duplicate PUBLISH dropped.");
+            return;
+        }
+    }
 
     MQTTSN_INFO_PRINTLN("Pub TID: %d\r\n", msg.topic_id);
     
     /* reset ping timer each time we receive a message that was buffered by the GW */
     if (state == MQTTSNState_ASLEEP && pingresp_pending) {
-        pingreq_timer = device->get_millis();
-        last_in = device->get_millis();
+        pingreq_timer = rx_time;
+        last_in = rx_time;
     }
     
     /* call user handler */
@@ -842,7 +1168,128 @@ void MQTTSNClient::handle_publish(uint8_t * data, uint8_t data_len, MQTTSNAddres
         publish_cb(topic_name, msg.data, msg.data_len, &msg.flags);
 }
 
-void MQTTSNClient::handle_suback(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_puback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBACK.");
+    
+    /* if this is to be used as proof of connectivity,
+       then we must verify that the gateway is the right one */
+    if (curr_gateway == NULL || memcmp(src->bytes, curr_gateway->gw_addr.bytes, curr_gateway->gw_addr.len) != 0) {
+        return;
+    }
+    
+    MQTTSNMessagePuback msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* check that we're waiting on it, a QoS 2 PUBLISH can be rejected with a PUBACK too */
+    MQTTSNInflightMsg * inflight = inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL)
+        return;
+    
+    if (inflight->awaiting != MQTTSN_PUBACK && !(inflight->awaiting == MQTTSN_PUBREC && msg.return_code != MQTTSN_RC_ACCEPTED))
+        return;
+    
+    inflight_pubs.remove(msg.msg_id);
+    last_in = rx_time;
+    
+    if (msg.return_code == MQTTSN_RC_ACCEPTED)
+        return;
+    
+    MQTTSN_ERROR_PRINTLN("PUBLISH %u rejected.", msg.msg_id);
+    
+    /* the gateway's forgotten our topic ID, so register it again */
+    if (msg.return_code == MQTTSN_RC_INVALIDTID) {
+        for (int i = 0; i < pub_topics_cnt; i++) {
+            if (pub_topics[i].tid == msg.topic_id)
+                pub_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
+        }
+    }
+}
+
+void MQTTSNClient::handle_pubrec(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBREC.");
+    
+    /* if this is to be used as proof of connectivity,
+       then we must verify that the gateway is the right one */
+    if (curr_gateway == NULL || memcmp(src->bytes, curr_gateway->gw_addr.bytes, curr_gateway->gw_addr.len) != 0) {
+        return;
+    }
+    
+    MQTTSNMessagePubrec msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* check that it's for a QoS 2 PUBLISH we sent */
+    MQTTSNInflightMsg * inflight = inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL || (inflight->awaiting != MQTTSN_PUBREC && inflight->awaiting != MQTTSN_PUBCOMP))
+        return;
+    
+    last_in = rx_time;
+    
+    /* the gateway has the msg, now release it and hold on to the PUBREL instead,
+       or just resend the PUBREL if we've been here before */
+    if (inflight->awaiting == MQTTSN_PUBREC) {
+        MQTTSNMessagePubrel reply;
+        reply.msg_id = msg.msg_id;
+        out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        inflight_pubs.update(inflight, MQTTSN_PUBCOMP, out_msg, out_msg_len, rx_time);
+    }
+    
+    transport->write_packet(inflight_pubs.data(inflight), inflight_pubs.length(inflight), &curr_gateway->gw_addr);
+    last_out = rx_time;
+}
+
+void MQTTSNClient::handle_pubrel(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBREL.");
+    
+    /* if this is to be used as proof of connectivity,
+       then we must verify that the gateway is the right one */
+    if (curr_gateway == NULL || memcmp(src->bytes, curr_gateway->gw_addr.bytes, curr_gateway->gw_addr.len) != 0) {
+        return;
+    }
+    
+    MQTTSNMessagePubrel msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* the gateway won't resend this msg now, so we can forget its ID */
+    unreleased_ids.remove(msg.msg_id);
+    last_in = rx_time;
+    
+    /* always reply, our previous PUBCOMP may have been lost */
+    MQTTSNMessagePubcomp reply;
+    reply.msg_id = msg.msg_id;
+    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    transport->write_packet(out_msg, out_msg_len, &curr_gateway->gw_addr);
+}
+
+void MQTTSNClient::handle_pubcomp(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBCOMP.");
+    
+    /* if this is to be used as proof of connectivity,
+       then we must verify that the gateway is the right one */
+    if (curr_gateway == NULL || memcmp(src->bytes, curr_gateway->gw_addr.bytes, curr_gateway->gw_addr.len) != 0) {
+        return;
+    }
+    
+    MQTTSNMessagePubcomp msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* check that we're waiting on it */
+    MQTTSNInflightMsg * inflight = inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL || inflight->awaiting != MQTTSN_PUBCOMP)
+        return;
+    
+    inflight_pubs.remove(msg.msg_id);
+    last_in = rx_time;
+}
+
+void MQTTSNClient::handle_suback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
 	MQTTSN_INFO_PRINTLN("Got SUBACK.");
 
@@ -858,7 +1305,7 @@ void MQTTSNClient::handle_suback(uint8_t * data, uint8_t data_len, MQTTSNAddress
         
     /* parse our stored msg */
     MQTTSNHeader header;
-    uint8_t offset = header.unpack(msg_inflight, msg_inflight_len);
+    uint16_t offset = header.unpack(msg_inflight, msg_inflight_len);
     if (offset == 0) {
         msg_inflight_len = 0;
         return;
@@ -886,10 +1333,26 @@ void MQTTSNClient::handle_suback(uint8_t * data, uint8_t data_len, MQTTSNAddress
     
     /* check our list and put in the ID */
     MQTTSNSubTopic * topic = NULL;
+    uint8_t topicid_type;
     for (int i = 0; i < sub_topics_cnt; i++) {
         topic = &sub_topics[i];
-        if (strlen(topic->name) == sent.topic_name_len && strncmp(topic->name, (char *)sent.topic_name, sent.topic_name_len) == 0) {
-            topic->tid = msg.topic_id;
+        uint16_t fixed_tid = get_fixed_topic_id(topic->name, &topicid_type);
+        if (topicid_type != sent.flags.topicid_type)
+            continue;
+        
+        /* we sent the ID of a predefined topic, the name of anything else */
+        bool match = (topicid_type == MQTTSN_TOPIC_PREDEFINED) 
+            ? (sent.topic_name_len == 2 && fixed_tid == (((uint16_t)sent.topic_name[0] << 8) | sent.topic_name[1]))
+            : (strlen(topic->name) == sent.topic_name_len && strncmp(topic->name, (char *)sent.topic_name, sent.topic_name_len) == 0);
+        
+        if (match) {
+            /* the gateway doesn't send an ID for short names or wildcards */
+            if (topicid_type != MQTTSN_TOPIC_NORMAL)
+                topic->tid = fixed_tid;
+            else if (strpbrk(topic->name, "+#") != NULL)
+                topic->tid = MQTTSN_TOPICID_WILDCARD;
+            else
+                topic->tid = msg.topic_id;
             MQTTSN_INFO_PRINTLN("Sub TID: %d\r\n", topic->tid);
             break;
         }
@@ -899,10 +1362,10 @@ void MQTTSNClient::handle_suback(uint8_t * data, uint8_t data_len, MQTTSNAddress
         return;
 
     msg_inflight_len = 0;
-    last_in = device->get_millis();
+    last_in = rx_time;
 }
 
-void MQTTSNClient::handle_unsuback(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_unsuback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
 	MQTTSN_INFO_PRINTLN("Got UNSUBACK.");
 
@@ -918,7 +1381,7 @@ void MQTTSNClient::handle_unsuback(uint8_t * data, uint8_t data_len, MQTTSNAddre
 
     /* parse our stored msg */
     MQTTSNHeader header;
-    uint8_t offset = header.unpack(msg_inflight, msg_inflight_len);
+    uint16_t offset = header.unpack(msg_inflight, msg_inflight_len);
     if (offset == 0) {
         msg_inflight_len = 0;
         return;
@@ -941,10 +1404,10 @@ void MQTTSNClient::handle_unsuback(uint8_t * data, uint8_t data_len, MQTTSNAddre
         return;
 
     msg_inflight_len = 0;
-    last_in = device->get_millis();
+    last_in = rx_time;
 }
 
-void MQTTSNClient::handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_disconnect(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
 	MQTTSN_INFO_PRINTLN("Got DISCONNECT.");
 
@@ -960,7 +1423,7 @@ void MQTTSNClient::handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNAdd
 
     /* parse our stored msg */
     MQTTSNHeader header;
-    uint8_t offset = header.unpack(msg_inflight, msg_inflight_len);
+    uint16_t offset = header.unpack(msg_inflight, msg_inflight_len);
     if (offset == 0) {
         msg_inflight_len = 0;
         return;
@@ -985,15 +1448,15 @@ void MQTTSNClient::handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNAdd
     
     /* finally we are asleep */
     state = MQTTSNState_ASLEEP;
-    started_sleeping = device->get_millis();
+    started_sleeping = rx_time;
     MQTTSN_INFO_PRINTLN("Sleep started.");
     
     pingresp_pending = false;
     msg_inflight_len = 0;
-    last_in = device->get_millis();
+    last_in = rx_time;
 }
 
-void MQTTSNClient::handle_pingresp(uint8_t * data, uint8_t data_len, MQTTSNAddress * src)
+void MQTTSNClient::handle_pingresp(uint8_t * data, uint16_t data_len, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got PINGRESP.");
     
@@ -1012,11 +1475,11 @@ void MQTTSNClient::handle_pingresp(uint8_t * data, uint8_t data_len, MQTTSNAddre
     /* we've now gotten PINGRESP so return to sleep */
     if (state == MQTTSNState_AWAKE) {
         state = MQTTSNState_ASLEEP;
-        started_sleeping = device->get_millis();
+        started_sleeping = rx_time;
         MQTTSN_INFO_PRINTLN("Resuming sleep.");
     }
     
-    last_in = device->get_millis();
+    last_in = rx_time;
 }
 
 void MQTTSNClient::searching_handler(void)
@@ -7,6 +7,8 @@
 #include "mqttsn_messages.h"
 #include "mqttsn_transport.h"
 #include "mqttsn_device.h"
+#include "mqttsn_inflight.h"
+#include "mqttsn_predefined_topics.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -47,8 +49,14 @@ typedef struct {
     uint16_t tid;
 } MQTTSNSubTopic;
 
+/* For holding topics registered with us by the gateway, for msgs from wildcard subs */
+typedef struct {
+    char name[MQTTSN_MAX_TOPICNAME_LEN + 1];
+    uint16_t tid;
+} MQTTSNGWTopic;
+
 /* template for publish message handler */
-typedef void (*MQTTSNPublishCallback)(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags);
+typedef void (*MQTTSNPublishCallback)(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags);
 
 class MQTTSNClient {
     public:
@@ -77,19 +85,35 @@ class MQTTSNClient {
      * returns true if all topics in the list have been registered */
     bool register_topics(MQTTSNPubTopic * topics, uint16_t len);
     
-    /* Publish data to a topic, returns true if the message was sent */
-    bool publish(const char * topic, uint8_t * data, uint8_t len, MQTTSNFlags * flags = NULL);
+    /* Publish data to a topic, returns true if the message was sent.
+     * Predefined topics and 2-char short names need no registering.
+     * Up to MQTTSN_MAX_INFLIGHT_MSGS QoS 1 and 2 messages can await acknowledgement at once,
+     * returns false if there's no room for another */
+    bool publish(const char * topic, uint8_t * data, uint16_t len, MQTTSNFlags * flags = NULL);
+    
+    /* Publish data at QoS -1, without being connected, returns true if the message was sent.
+     * The topic must be a predefined ID (the default) or a short name, set flags->topicid_type to pick one.
+     * Goes to the current gateway if we're connected, else to the gateway with the given ID or any known one.
+     * It goes out right away, even over a batching transport, so it's safe to sleep straight after.
+     * Nothing is acked, so there's no telling if it ever arrives */
+    bool publish_noconnect(uint16_t topic_id, uint8_t * data, uint16_t len, MQTTSNFlags * flags = NULL, uint8_t gw_id = 0);
+    
+    /* return the number of QoS 1 and 2 PUBLISHes still awaiting PUBACK or PUBCOMP */
+    uint8_t publishes_pending(void) const;
     
     /* Subscribe to a list of topics with the gateway,
-     * returns true if all topics in the list have been subscribed to */
+     * returns true if all topics in the list have been subscribed to.
+     * Predefined topics and 2-char short names are subscribed to as such, and their tid is the predefined ID or short name itself.
+     * Wildcard subs get MQTTSN_TOPICID_WILDCARD as their tid, and the gateway registers each matching topic with us as needed */
     bool subscribe_topics(MQTTSNSubTopic * topics, uint16_t len);
     
     /* Unsubscribe to a topic, returns true if the message was sent */
     bool unsubscribe(const char * topic, MQTTSNFlags * flags = NULL);
     
     /* check if there's a pending transaction,
-     * like a REGISTER, SUBSCRIBE or QoS>0 PUBLISH.
-     * Only one transaction can be pending at any given time.
+     * like a REGISTER or SUBSCRIBE.
+     * Only one transaction can be pending at any given time,
+     * QoS 1 and 2 PUBLISHes are tracked separately, see publishes_pending().
      */
     bool transaction_pending(void);
     
@@ -112,27 +136,60 @@ class MQTTSNClient {
     
     /* return client status */
     MQTTSNState status(void) const;
+    
+    /* millisecs till the next retry, keepalive ping, SEARCHGW or wake-up is due, 0 if loop() has work now;
+       MQTTSN_NO_DEADLINE if there's none. Till then loop() only has to run when the transport has a packet,
+       so a host can sleep in between */
+    uint32_t next_deadline(void);
         
+    protected:
+    /* read and handle what the transport has, every loop. MQTTSNClientT runs it on its own types */
+    virtual void handle_messages(void);
+    
+    /* the read loop, calling the transport and device as the given types */
+    template <typename Transport, typename Device>
+    void receive(void);
+    
     private:
     void assign_handlers(void);
-    void handle_messages(void);
+    void handle_packet(uint16_t len, MQTTSNAddress * src);
     void inflight_handler(void);
+    
+    /* give up on a gateway that's stopped responding */
+    void lose_gateway(void);
     void register_(MQTTSNPubTopic * topic);
     void subscribe(MQTTSNSubTopic * topic);
     bool ping(bool with_cid = false);
     MQTTSNGWInfo * select_gateway(uint8_t gw_id);
     
+    /* get the ID of a predefined topic or short name, which needs no REGISTER, along with its ID type;
+       returns 0 for any other topic */
+    static uint16_t get_fixed_topic_id(const char * name, uint8_t * topicid_type);
+    
+    /* get the name of a topic in a PUBLISH from the gateway, NULL if we don't know it */
+    const char * get_topic_name(uint8_t topicid_type, uint16_t tid);
+    
+    void clear_gw_topics(void);
+    
+    /* millisecs from now till 'interval' has passed since 'start', 0 if it has */
+    static uint32_t time_left(uint32_t now, uint32_t start, uint32_t interval);
+    
     /* message handlers */
-    void handle_advertise(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_searchgw(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_gwinfo(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_connack(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_regack(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_publish(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_suback(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_unsuback(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_pingresp(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
-    void handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNAddress * src);
+    void handle_advertise(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_searchgw(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_gwinfo(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_connack(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_register(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_regack(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_publish(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_puback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_pubrec(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_pubrel(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_pubcomp(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_suback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_unsuback(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_pingresp(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
+    void handle_disconnect(uint8_t * data, uint16_t data_len, MQTTSNAddress * src);
     
     /* client state handlers */
     void searching_handler(void);
@@ -144,7 +201,7 @@ class MQTTSNClient {
     void asleep_handler(void);
     
     /* message handlers jump table, used for dispatch */
-    void (MQTTSNClient::*msg_handlers[MQTTSN_NUM_MSG_TYPES])(uint8_t *, uint8_t, MQTTSNAddress *);
+    void (MQTTSNClient::*msg_handlers[MQTTSN_NUM_MSG_TYPES])(uint8_t *, uint16_t, MQTTSNAddress *);
     
     /* state handlers jump table, used for dispatch */
     void (MQTTSNClient::*state_handlers[MQTTSNState_NUM_STATES])(void);
@@ -163,6 +220,10 @@ class MQTTSNClient {
     
     MQTTSNDevice * device;
     MQTTSNTransport * transport;
+    
+    /* millisecs when the packet being handled came in, read once so each handler doesn't */
+    uint32_t rx_time;
+    
     const char * client_id;
     MQTTSNState state;
     
@@ -175,10 +236,19 @@ class MQTTSNClient {
     
     /* for storing unicast msgs expecting a reply */
     uint8_t msg_inflight[MQTTSN_MAX_MSG_LEN];
-    uint8_t msg_inflight_len;
+    uint16_t msg_inflight_len;
     uint32_t unicast_timer;
     uint8_t unicast_counter;
     
+    /* QoS 1 and 2 PUBLISHes awaiting PUBACK or PUBCOMP */
+    MQTTSNInflightCopies inflight_pubs;
+    
+    /* IDs of the last QoS 1 PUBLISHes from the gateway, to drop duplicates */
+    MQTTSNMsgIdHistory recent_ids;
+    
+    /* IDs of QoS 2 PUBLISHes from the gateway awaiting PUBREL */
+    MQTTSNMsgIdSet unreleased_ids;
+    
     /* keepalive and (keepalive * tolerance%) */
     uint32_t keepalive_interval;
     uint32_t keepalive_timeout;
@@ -199,13 +269,57 @@ class MQTTSNClient {
     /* msg ID counter for transactions */
     uint16_t curr_msg_id;
     
+    /* ring of topics the gateway has registered with us */
+    MQTTSNGWTopic gw_topics[MQTTSN_MAX_GW_TOPICS];
+    uint8_t gw_topics_next;
+    
     /* buffer for incoming packets */
     uint8_t in_msg[MQTTSN_MAX_MSG_LEN];
-    uint8_t in_msg_len;
+    uint16_t in_msg_len;
     
     /* buffer for outgoing packets */
     uint8_t out_msg[MQTTSN_MAX_MSG_LEN];
-    uint8_t out_msg_len;
+    uint16_t out_msg_len;
 };
 
+/* A client over a transport and a device of known types, e.g. MQTTSNClientT<MQTTSNTransportHC12, MQTTSNDeviceArduino>.
+ * Its read loop calls them on those types, which the compiler can inline when the types are final.
+ * Only the read loop is templated: what it sends still goes through the transport's interface.
+ * The defaults give the same client as MQTTSNClient */
+template <typename Transport = MQTTSNTransport, typename Device = MQTTSNDevice>
+class MQTTSNClientT : public MQTTSNClient {
+    public:
+    MQTTSNClientT(Device * device, Transport * transport) : MQTTSNClient(device, transport)
+    {
+        
+    }
+    
+    protected:
+    virtual void handle_messages(void)
+    {
+        receive<Transport, Device>();
+    }
+};
+
+template <typename Transport, typename Device>
+void MQTTSNClient::receive(void)
+{
+    Transport * trans = static_cast<Transport *>(transport);
+    Device * dev = static_cast<Device *>(device);
+    MQTTSNAddress src;
+    
+    while (true) {
+        dev->cede();
+        
+        /* try to read a packet */
+        int32_t rlen = trans->read_packet(in_msg, MQTTSN_MAX_MSG_LEN, &src);
+        if (rlen <= 0)
+            return;
+        
+        /* once a packet, rather than in every handler */
+        rx_time = dev->get_millis();
+        handle_packet(rlen, &src);
+    }
+}
+
 #endif
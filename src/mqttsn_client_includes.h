@@ -8,12 +8,17 @@
 
     #define MQTTSN_INCLUDE_DEVICE_ARDUINO
     //#define MQTTSN_INCLUDE_DEVICE_STM32F1
+    //#define MQTTSN_INCLUDE_DEVICE_POSIX
 
 /* uncomment to select a transport */
 
     #define MQTTSN_INCLUDE_TRANSPORT_RFM69X
     //#define MQTTSN_INCLUDE_TRANSPORT_HC12
     
+    /* wrap any of the above, for msgs longer than its packets, or to pack several msgs into one */
+    //#define MQTTSN_INCLUDE_TRANSPORT_FRAG
+    //#define MQTTSN_INCLUDE_TRANSPORT_BATCH
+    
     
 /*************** IGNORE EVERYTHING BELOW *******************/
 
@@ -21,6 +26,8 @@
     #include "device/mqttsn_device_arduino.h"
 #elif defined(MQTTSN_INCLUDE_DEVICE_STM32F1)
 	#include "device/mqttsn_device_stm32f1.h"
+#elif defined(MQTTSN_INCLUDE_DEVICE_POSIX)
+    #include "device/mqttsn_device_posix.h"
 #endif
 
 #if defined(MQTTSN_INCLUDE_TRANSPORT_HC12)
@@ -29,6 +36,14 @@
     #include "transport/mqttsn_transport_rfm69x.h"
 #endif
 
+#if defined(MQTTSN_INCLUDE_TRANSPORT_FRAG)
+    #include "transport/mqttsn_transport_frag.h"
+#endif
+
+#if defined(MQTTSN_INCLUDE_TRANSPORT_BATCH)
+    #include "transport/mqttsn_transport_batch.h"
+#endif
+
 #include "mqttsn_defines.h"
 #include "mqttsn_client.h"
 
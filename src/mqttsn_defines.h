@@ -8,16 +8,20 @@
 #define MQTTSN_MAX_ADDR_LEN             10
 
 /* this is the maximum MQTTSN message size,
- * should be defined according to the packet payload size of your transport
+ * should be defined according to the packet payload size of your transport,
+ * or up to 32 packets' worth when it's wrapped in the fragmenting transport.
+ * Up to 65535, msgs over 255 bytes take the longer header
  */
 #define MQTTSN_MAX_MSG_LEN              32
 
 /* maximum payload length in any single PUBLISH; 
- * 7 bytes for the remaining fields in a PUBLISH */
-#define MQTTSN_MAX_PAYLOAD_LEN          (MQTTSN_MAX_MSG_LEN - 7)
+ * 5 bytes for the remaining fields in a PUBLISH, after the header */
+#define MQTTSN_MAX_PAYLOAD_LEN          (MQTTSN_MAX_MSG_LEN - 5 - \
+                                            ((MQTTSN_MAX_MSG_LEN > 0xFF) ? MQTTSN_LONG_HEADER_LEN : MQTTSN_HEADER_LEN))
 
-/* length of fixed header */
+/* length of fixed header, and of the longer one used for msgs over 255 bytes */
 #define MQTTSN_HEADER_LEN               2
+#define MQTTSN_LONG_HEADER_LEN          4
 #define MQTTSN_MAX_CLIENTID_LEN         23
 
 /* Unassigned topic IDs set to 0 for convenience,
@@ -25,9 +29,12 @@
 #define MQTTSN_TOPICID_NOTASSIGNED      0x0000
 #define MQTTSN_TOPICID_UNSUBSCRIBED     0xFFFF
 
+/* the gateway gives no ID for wildcard subscriptions, this marks them as subscribed in the client */
+#define MQTTSN_TOPICID_WILDCARD         0xFFFE
+
 /* maximum length of a topic name;
- * 6 bytes for the remaining fields in a REGISTER */
-#define MQTTSN_MAX_TOPICNAME_LEN        (MQTTSN_MAX_MSG_LEN - 6)
+ * 6 bytes for the remaining fields in a REGISTER, and never more than a length byte can hold */
+#define MQTTSN_MAX_TOPICNAME_LEN        ((MQTTSN_MAX_MSG_LEN - 6 > 0xFF) ? 0xFF : (MQTTSN_MAX_MSG_LEN - 6))
 
 #define MQTTSN_DEFAULT_KEEPALIVE        30
 #define MQTTSN_DEFAULT_KEEPALIVE_MS     (MQTTSN_DEFAULT_KEEPALIVE * 1000UL)
@@ -36,6 +43,44 @@
 #define MQTTSN_T_RETRY                  5000UL
 #define MQTTSN_N_RETRY                  3
 
+/* returned by the client's and gateway's next_deadline() when there's nothing to wait for */
+#define MQTTSN_NO_DEADLINE              0xFFFFFFFFUL
+
+/* max number of QoS 1 and 2 PUBLISHes awaiting PUBACK or PUBCOMP at once,
+ * and of received QoS 2 PUBLISHes awaiting PUBREL;
+ * this applies to a client and to each client of a gateway */
+#define MQTTSN_MAX_INFLIGHT_MSGS        4
+
+/* number of msg IDs of recently received QoS 1 PUBLISHes to remember,
+ * for dropping re-sent duplicates */
+#define MQTTSN_MAX_RECENT_MSG_IDS       8
+
+/* The fragmenting transport splits msgs too long for a radio packet into up to 32 fragments.
+ * Max number of msgs it reassembles at once, and of sent msgs it holds for resending lost fragments */
+#define MQTTSN_FRAG_MAX_RX_MSGS         2
+#define MQTTSN_FRAG_MAX_TX_MSGS         2
+
+/* how long a receiver waits after the last fragment before asking for the missing ones,
+ * and how many times it asks before giving up on the msg */
+#define MQTTSN_FRAG_T_NACK              500UL
+#define MQTTSN_FRAG_N_NACK              3
+
+/* For hosts with C++11 threads, see mqttsn_excludes.h. Number of MQTT calls queued each way
+ * between the gateway and a threaded MQTT client (must be a power of 2),
+ * and how long threads nap when there's nothing to do, in microsecs */
+#define MQTTSN_THREADED_RING_LEN        16
+#define MQTTSN_THREADED_IDLE_US         1000
+
+/* bytes of packets queued each way between the gateway or client and a threaded transport,
+ * or a shard and its router; each packet only takes up its own length, its address's and 3 bytes more.
+ * At least twice the longest, up to 65535 */
+#define MQTTSN_THREADED_RING_BYTES      1024
+
+/* max number of shards a gateway can be split into, each with its own table of clients,
+ * and the bytes of publishes queued between each pair of them, with the same limits as above */
+#define MQTTSN_MAX_SHARDS               4
+#define MQTTSN_SHARD_RING_BYTES         1024
+
 /* max delay before sending first SEARCHGW in milliseconds */
 #define MQTTSN_T_SEARCHGW               5000UL
 /* max delay between consecutive SEARCHGWs in milliseconds */ 
@@ -59,6 +104,25 @@
 /* max number of unique topics held by the gateway, each topic maps to an ID */
 #define MQTTSN_MAX_TOPIC_MAPPINGS       20
 
+/* Topics with IDs known in advance to the gateway and all its clients, so they never need a REGISTER.
+ * List them as MQTTSN_PREDEFINED_TOPIC(id, name) with IDs counting up from 1, at most 32 of them e.g.
+ *     #define MQTTSN_PREDEFINED_TOPICS    MQTTSN_PREDEFINED_TOPIC(1, "status") \
+ *                                         MQTTSN_PREDEFINED_TOPIC(2, "cmd")
+ * The gateway holds a topic mapping for each, counted in MQTTSN_MAX_TOPIC_MAPPINGS */
+#define MQTTSN_PREDEFINED_TOPICS
+
+/* max number of levels across all wildcard topic filters held by the gateway,
+ * each level of a filter takes up a node in the gateway's filter trie unless another filter shares it */
+#define MQTTSN_MAX_FILTER_LEVELS        32
+
+/* max number of wildcard filters a single topic can match at once */
+#define MQTTSN_MAX_FILTER_MATCHES       8
+
+/* max number of topics the gateway can register with a client,
+ * for msgs delivered through a wildcard subscription. Both sides forget the oldest topic when they run out,
+ * the gateway registers it again if the client says it doesn't know it */
+#define MQTTSN_MAX_GW_TOPICS            4
+
 /* max length of MQTT topic prefix, 
  * can be as long as needed really, this is just a reasonable default */
 #define MQTTSN_MAX_TOPICPREFIX_LEN      MQTTSN_MAX_TOPICNAME_LEN
@@ -68,12 +132,48 @@
 
 #define MQTTSN_MAX_NUM_CLIENTS          10
 
-/* max number of queued publish messages yet to be delivered to MQTTSN clients */
+/* The gateway's indexes of topic names and of clients (by address and by client ID) each take
+ * twice as many buckets as the table they index, rounded up to a power of 2.
+ *
+ * MQTTSN_MAX_NUM_CLIENTS, MQTTSN_MAX_TOPIC_MAPPINGS, MQTTSN_MAX_POOLED_MSGS and MQTTSN_MAX_QUEUED_PUBLISH
+ * size the tables a gateway holds itself. A gateway can be sized at runtime instead,
+ * from a block of memory handed to it with an MQTTSNGatewaySizes, see MQTTSNGateway::arena_size().
+ * Max number of clients such a gateway can take, up to 32767: subscription handles are 16-bit
+ * as long as this times MQTTSN_MAX_INSTANCE_TOPICS stays below 65535, so keep it low on small MCUs */
+#define MQTTSN_MAX_ARENA_CLIENTS        32000
+
+/* The gateway tracks client keepalive and retry deadlines on a timer wheel,
+ * with this many slots (must be a power of 2), each covering this many millisecs.
+ * Deadlines can be detected up to one slot late */
+#define MQTTSN_TIMER_WHEEL_SLOTS        256
+#define MQTTSN_TIMER_WHEEL_TICK_MS      250UL
+
+/* max number of packets the gateway reads from each transport per loop, taking turns between them,
+ * so a busy link can't starve the others */
+#define MQTTSN_GW_RX_BUDGET             8
+
+/* max number of queued publish messages the gateway dispatches per loop, the rest wait for the next,
+ * so a burst of publishes can't hold up reading from clients */
+#define MQTTSN_GW_TX_BUDGET             8
+
+/* max number of queued publish messages yet to be delivered to MQTTSN clients,
+ * the msgs themselves wait in the pool below */
 #define MQTTSN_MAX_QUEUED_PUBLISH       64
 
-/* max number of messages buffered for a client by the gateway */
+/* max number of messages buffered for a client by the gateway,
+ * while it sleeps or while its inflight window is full */
 #define MQTTSN_MAX_BUFFERED_MSGS        8
 
+/* max number of distinct publish messages held by the gateway, whether queued for dispatch
+ * or buffered for sleeping clients or clients with a full inflight window;
+ * a message buffered for several clients only takes up one slot */
+#define MQTTSN_MAX_POOLED_MSGS          48
+
+/* max number of retained messages the gateway keeps for new subscribers, one per topic at most.
+ * They're held in the same pool as buffered msgs, so each one can take up one of MQTTSN_MAX_POOLED_MSGS,
+ * and the least recently used goes first when there's no more room */
+#define MQTTSN_MAX_RETAINED_MSGS        8
+
 #include "mqttsn_debug.h"
 
 #endif
@@ -8,6 +8,10 @@ class MQTTSNDevice {
         /* get system millisecond tick */
         virtual uint32_t get_millis(void) = 0;
         
+        /* get system microsecond tick, for timing finer than millis; wraps every ~71 minutes.
+           Devices without a finer clock just scale up the millisecond tick */
+        virtual uint32_t get_micros(void) { return get_millis() * 1000UL; }
+        
         /* delay in millisecs */
         virtual void delay_millis(uint32_t ms) = 0;
         
@@ -9,5 +9,13 @@
 //#define MQTTSN_EXCLUDE_TRANSPORT_RFM69X
 #define MQTTSN_EXCLUDE_TRANSPORT_HC12
 #define MQTTSN_EXCLUDE_TRANSPORT_DUMMY
+//#define MQTTSN_EXCLUDE_TRANSPORT_FRAG
+//#define MQTTSN_EXCLUDE_TRANSPORT_BATCH
+
+/* the threaded transport and MQTT client need C++11 threads and atomics, e.g. on a Linux host */
+#define MQTTSN_EXCLUDE_THREADS
+
+/* the gateway's own tables, sized by the MQTTSN_MAX_* defines, can go when every gateway is given an arena */
+//#define MQTTSN_EXCLUDE_BUILTIN_TABLES
 
 #endif
@@ -7,21 +7,27 @@
 #include "mqttsn_device.h"
 #include "mqttsn_transport.h"
 #include "mqttx_client.h"
+#include "mqttsn_hash.h"
+#include "mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+#include "mqttsn_shard_links.h"
+#endif
 
 #include <lite_fifo.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <new>
 
 /********************** MQTTSNInstance ************************/
 
 MQTTSNInstance::MQTTSNInstance(void) :
-    transport(NULL), msg_inflight_len(0), unicast_timer(0), unicast_counter(0),
-    keepalive_interval(0), keepalive_timeout(0), sleep_interval(0), sleep_timeout(0),
-    sleepy_fifo(sleepy_fifo_buf, MQTTSN_MAX_BUFFERED_MSGS, MQTTSN_MAX_MSG_LEN),
-    last_in(0), status(MQTTSNInstanceStatus_DISCONNECTED)
+    sub_topics(NULL), gateway(NULL), idx(0), state(NULL), client_id_len(0),
+    keepalive_interval(0), sleep_interval(0), sleep_timeout(0),
+    sleepy_fifo(sleepy_fifo_buf, MQTTSN_MAX_BUFFERED_MSGS, sizeof(MQTTSNBufferedMsg))
 {
     client_id[0] = 0;
-    memset(&address, 0, sizeof(MQTTSNAddress));
 }
 
 bool MQTTSNInstance::register_(uint8_t * cid, uint8_t cid_len, MQTTSNTransport * transport, MQTTSNAddress * addr, uint16_t duration, MQTTSNFlags * flags)
@@ -31,20 +37,21 @@ bool MQTTSNInstance::register_(uint8_t * cid, uint8_t cid_len, MQTTSNTransport *
     
     memcpy(client_id, cid, cid_len);
     client_id[cid_len] = 0;
+    client_id_len = cid_len;
     
     /* copy the address */
-    this->transport = transport;
-    memcpy(&address.bytes, addr->bytes, addr->len);
-    address.len = addr->len;
+    state->transport = transport;
+    memcpy(&state->address.bytes, addr->bytes, addr->len);
+    state->address.len = addr->len;
     
     MQTTSN_INFO_PRINT("Address: ");
-    for (int i = 0; i < address.len; i++) {
-        MQTTSN_INFO_PRINT("%X ", address.bytes[i]);
+    for (int i = 0; i < state->address.len; i++) {
+        MQTTSN_INFO_PRINT("%X ", state->address.bytes[i]);
     }
     MQTTSN_INFO_PRINT("\r\n");
         
     keepalive_interval = duration * 1000UL;
-    keepalive_timeout = (keepalive_interval > 60000) ? keepalive_interval * 1.1 : keepalive_interval * 1.5;
+    state->keepalive_timeout = (keepalive_interval > 60000) ? keepalive_interval * 1.1 : keepalive_interval * 1.5;
     
     connect_flags.all = flags == NULL ? 0 : flags->all;
     
@@ -53,18 +60,45 @@ bool MQTTSNInstance::register_(uint8_t * cid, uint8_t cid_len, MQTTSNTransport *
         sub_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
         pub_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
     }
+    
+    for (uint8_t i = 0; i < MQTTSN_MAX_GW_TOPICS; i++) {
+        reg_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
+    }
+    reg_topics_next = 0;
 
-    msg_inflight_len = 0;
-    status = MQTTSNInstanceStatus_ACTIVE;
+    clear_inflight();
+    recent_ids.clear();
+    unreleased_ids.clear();
+    state->status = MQTTSNInstanceStatus_ACTIVE;
+    
+    gateway->index_client(this);
     return true;
 }
 
 void MQTTSNInstance::deregister(void)
 {
+    if (!*this)
+        return;
+    
+    /* drop all our subscriptions */
+    for (uint16_t i = 0; i < MQTTSN_MAX_INSTANCE_TOPICS; i++) {
+        if (sub_topics[i].tid != MQTTSN_TOPICID_NOTASSIGNED)
+            delete_sub_topic(sub_topics[i].tid);
+    }
+    
+    gateway->timers.cancel(idx);
+    clear_buffered();
+    clear_inflight();
+    
+    /* must be unindexed while the address and ID are still valid */
+    gateway->unindex_client(this);
+    gateway->free_client(this);
+    
     client_id[0] = 0;
-    address.len = 0;
-    transport = NULL;
-    status = MQTTSNInstanceStatus_DISCONNECTED;
+    client_id_len = 0;
+    state->address.len = 0;
+    state->transport = NULL;
+    state->status = MQTTSNInstanceStatus_DISCONNECTED;
 }
 
 bool MQTTSNInstance::add_sub_topic(uint16_t tid, MQTTSNFlags * flags)
@@ -78,13 +112,29 @@ bool MQTTSNInstance::add_sub_topic(uint16_t tid, MQTTSNFlags * flags)
         }
     }
 
+    MQTTSNTopicMapping * mapping = gateway->get_topic_mapping(tid);
+    if (mapping == NULL)
+        return false;
+    
     /* else add the new topic to our list */
     for (uint16_t i = 0; i < MQTTSN_MAX_INSTANCE_TOPICS; i++) {
-        if (sub_topics[i].tid == MQTTSN_TOPICID_NOTASSIGNED) {
-            sub_topics[i].tid = tid;
-            sub_topics[i].flags.all = flags->all;
-            return true;
-        }
+        MQTTSNInstanceSubTopic * sub = &sub_topics[i];
+        if (sub->tid != MQTTSN_TOPICID_NOTASSIGNED)
+            continue;
+        
+        sub->tid = tid;
+        sub->flags.all = flags->all;
+        
+        /* push it onto the front of the topic's subscriber list */
+        MQTTSNSubHandle handle = (MQTTSNSubHandle)idx * MQTTSN_MAX_INSTANCE_TOPICS + i;
+        sub->prev = MQTTSN_SUBHANDLE_NONE;
+        sub->next = mapping->sub_head;
+        if (mapping->sub_head != MQTTSN_SUBHANDLE_NONE)
+            gateway->get_sub_topic(mapping->sub_head)->prev = handle;
+        
+        mapping->sub_head = handle;
+        mapping->sub_count++;
+        return true;
     }
 
     /* no more space */
@@ -115,86 +165,271 @@ bool MQTTSNInstance::add_pub_topic(uint16_t tid)
 void MQTTSNInstance::delete_sub_topic(uint16_t tid)
 {
     for (uint16_t i = 0; i < MQTTSN_MAX_INSTANCE_TOPICS; i++) {
-        if (sub_topics[i].tid == tid) {
-            sub_topics[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
-            sub_topics[i].flags.all = 0;
-            return;
-        }
+        MQTTSNInstanceSubTopic * sub = &sub_topics[i];
+        if (sub->tid != tid)
+            continue;
+        
+        /* unlink it from the topic's subscriber list */
+        MQTTSNTopicMapping * mapping = gateway->get_topic_mapping(tid);
+        if (sub->prev != MQTTSN_SUBHANDLE_NONE)
+            gateway->get_sub_topic(sub->prev)->next = sub->next;
+        else
+            mapping->sub_head = sub->next;
+        
+        if (sub->next != MQTTSN_SUBHANDLE_NONE)
+            gateway->get_sub_topic(sub->next)->prev = sub->prev;
+        
+        mapping->sub_count--;
+        
+        sub->tid = MQTTSN_TOPICID_NOTASSIGNED;
+        sub->flags.all = 0;
+        
+        if (mapping->sub_count == 0)
+            gateway->forget_filter(tid);
+        return;
     }
 }
 
-bool MQTTSNInstance::is_subbed(uint16_t tid)
+bool MQTTSNInstance::knows_topic(uint16_t tid)
 {
     for (uint16_t i = 0; i < MQTTSN_MAX_INSTANCE_TOPICS; i++) {
-        if (sub_topics[i].tid == tid) {
+        if (pub_topics[i].tid == tid)
             return true;
+        
+        /* only subs by normal name tell the client the ID */
+        if (sub_topics[i].tid == tid && sub_topics[i].flags.topicid_type == MQTTSN_TOPIC_NORMAL)
+            return true;
+    }
+    
+    MQTTSNInstanceRegTopic * reg = find_reg_topic(tid);
+    return reg != NULL && reg->msg_id == 0 && !reg->refused;
+}
+
+MQTTSNInstanceRegTopic * MQTTSNInstance::find_reg_topic(uint16_t tid)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_GW_TOPICS; i++) {
+        if (reg_topics[i].tid == tid)
+            return &reg_topics[i];
+    }
+    
+    return NULL;
+}
+
+MQTTSNInstanceRegTopic * MQTTSNInstance::add_reg_topic(uint16_t tid, uint16_t msg_id)
+{
+    /* a free slot if there's one, else the oldest that isn't waiting on its REGACK */
+    MQTTSNInstanceRegTopic * reg = find_reg_topic(MQTTSN_TOPICID_NOTASSIGNED);
+    for (uint8_t i = 0; reg == NULL && i < MQTTSN_MAX_GW_TOPICS; i++) {
+        uint8_t slot = (reg_topics_next + i) % MQTTSN_MAX_GW_TOPICS;
+        if (reg_topics[slot].msg_id == 0) {
+            reg = &reg_topics[slot];
+            reg_topics_next = (slot + 1) % MQTTSN_MAX_GW_TOPICS;
         }
     }
     
-    return false;
+    if (reg == NULL)
+        return NULL;
+    
+    reg->tid = tid;
+    reg->msg_id = msg_id;
+    reg->refused = false;
+    return reg;
 }
 
 MQTTSNInstanceStatus MQTTSNInstance::check_status(uint32_t now)
 { 
     /* check last time we got a control packet */
-    if (now - last_in > keepalive_timeout) {
-        status = MQTTSNInstanceStatus_LOST;
-        return status;
+    if (now - state->last_in > state->keepalive_timeout) {
+        state->status = MQTTSNInstanceStatus_LOST;
+        return state->status;
     }
     
-    /* if there are any outstanding msgs awaiting a response */
-    if (msg_inflight_len != 0) {
-        /* check if retry timer is up */
-        if (now - unicast_timer < MQTTSN_T_RETRY)
-            return status;
-            
-        unicast_counter++;
-
+    /* sleeping clients get their retries when they next wake */
+    if (state->status == MQTTSNInstanceStatus_ASLEEP)
+        return state->status;
+    
+    /* resend any PUBLISHes (or PUBRELs) whose retry timer is up */
+    MQTTSNInflightMsg * inflight;
+    while ((inflight = inflight_pubs.oldest()) != NULL && now - inflight->sent_at >= MQTTSN_T_RETRY) {
         /* check if retry counter is up */
-        if (unicast_counter > MQTTSN_N_RETRY) {
-            status = MQTTSNInstanceStatus_LOST;
-            return status;
+        if (!inflight_pubs.retry(inflight, now)) {
+            state->status = MQTTSNInstanceStatus_LOST;
+            return state->status;
         }
+        
+        gateway->resend_inflight(this, inflight);
+    }
+    
+    return state->status;  
+}
 
-        /* resend the msg if not */
-        transport->write_packet(msg_inflight, msg_inflight_len, &address);
-        unicast_timer = now;
+void MQTTSNInstance::clear_buffered(void)
+{
+    MQTTSNBufferedMsg buffered;
+    while (sleepy_fifo.dequeue(&buffered)) {
+        gateway->sleepy_pool.release(buffered.msg);
     }
+}
+
+void MQTTSNInstance::drop_inflight(MQTTSNInflightMsg * inflight)
+{
+    if (inflight->msg != MQTTSN_POOL_NONE)
+        gateway->sleepy_pool.release(inflight->msg);
     
-    return status;  
+    inflight_pubs.remove(inflight->msg_id);
+}
+
+void MQTTSNInstance::clear_inflight(void)
+{
+    MQTTSNInflightMsg * inflight;
+    while ((inflight = inflight_pubs.oldest()) != NULL) {
+        drop_inflight(inflight);
+    }
 }
 
 void MQTTSNInstance::mark_time(uint32_t now)
 {
-    last_in = now;
+    state->last_in = now;
+    
+    /* a later keepalive deadline can wait for our current timer to go off,
+       we only need to arm one if there's none yet i.e. on CONNECT */
+    if (!gateway->timers.is_scheduled(idx))
+        arm_timer();
+}
+
+void MQTTSNInstance::arm_timer(void)
+{
+    /* AWAKE clients are serviced on every pass until they go back to sleep */
+    if (state->status == MQTTSNInstanceStatus_AWAKE) {
+        gateway->timers.defer(idx);
+        return;
+    }
+    
+    /* check_status() marks the client lost once we're past the timeout */
+    uint32_t deadline = state->last_in + state->keepalive_timeout + 1;
+    
+    MQTTSNInflightMsg * inflight = (state->status == MQTTSNInstanceStatus_ASLEEP) ? NULL : inflight_pubs.oldest();
+    if (inflight != NULL && (int32_t)(inflight->sent_at + MQTTSN_T_RETRY - deadline) < 0)
+        deadline = inflight->sent_at + MQTTSN_T_RETRY;
+    
+    gateway->timers.schedule(idx, deadline);
 }
 
 MQTTSNInstance::operator bool() const
 {
-    return strlen(client_id) != 0;
+    return client_id_len != 0;
 }
 
 /********************** MQTTSNGateway ************************/
 
+#if !defined(MQTTSN_EXCLUDE_BUILTIN_TABLES)
+static const MQTTSNGatewaySizes builtin_sizes = {
+    MQTTSN_MAX_NUM_CLIENTS, MQTTSN_MAX_TOPIC_MAPPINGS, MQTTSN_MAX_POOLED_MSGS, MQTTSN_MAX_QUEUED_PUBLISH
+};
+
 MQTTSNGateway::MQTTSNGateway(MQTTSNDevice * device, MQTTClient * client) :
-    gw_id(0), device(device), mqtt_client(client), 
-    connected(false), curr_msg_id(0), 
+    MQTTSNGateway(device, &builtin_sizes, builtin_tables, sizeof(builtin_tables), client)
+{
+    
+}
+#endif
+
+MQTTSNGateway::MQTTSNGateway(MQTTSNDevice * device, const MQTTSNGatewaySizes * sizes, void * arena, uint32_t arena_len, MQTTClient * client) :
+    filters(&topics), clients(NULL), client_states(NULL), client_subs(NULL), max_clients(0), retained(&topics, &sleepy_pool), 
+    free_clients(NULL), free_clients_cnt(0), addr_index(NULL), cid_index(NULL), index_mask(0), tables_ok(false),
+    gw_id(0), device(device), loop_time(0), rx_next(0), rx_backlog(false), shard_links(NULL), shard(0),
+    mqtt_client(client), connected(false), curr_msg_id(0), 
     advert_interval(MQTTSN_DEFAULT_ADVERTISE_INTERVAL * 1000UL), last_advert(0),
-    pub_fifo(pub_fifo_buf, MQTTSN_MAX_QUEUED_PUBLISH, MQTTSN_MAX_MSG_LEN)
+    pub_fifo(NULL, 0, sizeof(MQTTSNQueuedPublish))
 {
     topic_prefix[0] = 0;
     for (int i = 0; i < MQTTSN_MAX_NUM_TRANSPORTS; i++) {
         transports[i] = NULL;
     }
+    
+    memset(&stats, 0, sizeof(stats));
+    tables_ok = set_tables(sizes, arena, arena_len);
+}
+
+uint32_t MQTTSNGateway::arena_size(const MQTTSNGatewaySizes * sizes)
+{
+    return mqttsn_gateway_arena_len(sizes->max_clients, sizes->max_topic_mappings, sizes->max_pooled_msgs, sizes->max_queued_publish);
+}
+
+bool MQTTSNGateway::set_tables(const MQTTSNGatewaySizes * sizes, void * arena, uint32_t arena_len)
+{
+    uint16_t num_clients = sizes->max_clients;
+    if (num_clients == 0 || num_clients > MQTTSN_MAX_ARENA_CLIENTS 
+        || sizes->max_pooled_msgs == 0 || sizes->max_pooled_msgs == MQTTSN_POOL_NONE || sizes->max_queued_publish == 0)
+    {
+        return false;
+    }
+    
+    /* with that much room, every take() below succeeds */
+    if (arena == NULL || arena_len < arena_size(sizes))
+        return false;
+    
+    MQTTSNArena tables(arena, arena_len);
+    uint32_t index_len = MQTTSNArena::index_len(num_clients);
+    
+    /* in the same order as mqttsn_gateway_arena_len() counts them */
+    uint8_t * fifo_buf = (uint8_t *)tables.take((uint32_t)sizes->max_queued_publish * sizeof(MQTTSNQueuedPublish));
+    void * clients_buf = tables.take((uint32_t)num_clients * sizeof(MQTTSNInstance));
+    client_states = (MQTTSNInstanceState *)tables.take((uint32_t)num_clients * sizeof(MQTTSNInstanceState));
+    client_subs = (MQTTSNInstanceSubTopic *)tables.take((uint32_t)num_clients * MQTTSN_MAX_INSTANCE_TOPICS * sizeof(MQTTSNInstanceSubTopic));
+    free_clients = (uint16_t *)tables.take((uint32_t)num_clients * sizeof(uint16_t));
+    addr_index = (uint16_t *)tables.take(index_len * sizeof(uint16_t));
+    cid_index = (uint16_t *)tables.take(index_len * sizeof(uint16_t));
+    void * timers_buf = tables.take(MQTTSNTimerWheel::storage_size(num_clients));
+    void * topics_buf = tables.take(MQTTSNTopicRegistry::storage_size(sizes->max_topic_mappings));
+    void * pool_buf = tables.take(MQTTSNMessagePool::storage_size(sizes->max_pooled_msgs));
+    
+    if (!topics.set_storage(topics_buf, sizes->max_topic_mappings))
+        return false;
+    
+    pub_fifo = LiteFifo(fifo_buf, sizes->max_queued_publish, sizeof(MQTTSNQueuedPublish));
+    timers.set_storage(timers_buf, num_clients);
+    sleepy_pool.set_storage(pool_buf, sizes->max_pooled_msgs);
+    
+    /* all slots start out free, lowest slots get used first */
+    clients = (MQTTSNInstance *)clients_buf;
+    for (uint16_t i = 0; i < num_clients; i++) {
+        new (&clients[i]) MQTTSNInstance();
+        clients[i].gateway = this;
+        clients[i].idx = i;
+        clients[i].state = &client_states[i];
+        clients[i].sub_topics = &client_subs[(uint32_t)i * MQTTSN_MAX_INSTANCE_TOPICS];
+        
+        memset(&client_states[i], 0, sizeof(MQTTSNInstanceState));
+        client_states[i].status = MQTTSNInstanceStatus_DISCONNECTED;
+        free_clients[i] = num_clients - 1 - i;
+    }
+    max_clients = num_clients;
+    free_clients_cnt = num_clients;
+    
+    memset(client_subs, 0, (uint32_t)num_clients * MQTTSN_MAX_INSTANCE_TOPICS * sizeof(MQTTSNInstanceSubTopic));
+    
+    index_mask = index_len - 1;
+    memset(addr_index, 0, index_len * sizeof(uint16_t));
+    memset(cid_index, 0, index_len * sizeof(uint16_t));
+    return true;
 }
 
 bool MQTTSNGateway::begin(uint8_t gw_id)
 {
+    if (!tables_ok) {
+        MQTTSN_ERROR_PRINTLN("Gateway tables don't fit in the arena.");
+        return false;
+    }
+    
     this->gw_id = gw_id;
+    loop_time = device->get_millis();
+    timers.begin(loop_time);
     if (mqtt_client) {
         mqtt_client->register_callbacks(this, MQTTSNGateway::handle_mqtt_connect, MQTTSNGateway::handle_mqtt_publish);
     }
     assign_msg_handlers();
+    return true;
 }
 
 bool MQTTSNGateway::register_transport(MQTTSNTransport * transport)
@@ -236,7 +471,12 @@ void MQTTSNGateway::assign_msg_handlers(void)
     msg_handlers[MQTTSN_SEARCHGW] = &MQTTSNGateway::handle_searchgw;
     msg_handlers[MQTTSN_CONNECT] = &MQTTSNGateway::handle_connect;
     msg_handlers[MQTTSN_REGISTER] = &MQTTSNGateway::handle_register;
+    msg_handlers[MQTTSN_REGACK] = &MQTTSNGateway::handle_regack;
     msg_handlers[MQTTSN_PUBLISH] = &MQTTSNGateway::handle_publish;
+    msg_handlers[MQTTSN_PUBACK] = &MQTTSNGateway::handle_puback;
+    msg_handlers[MQTTSN_PUBREC] = &MQTTSNGateway::handle_pubrec;
+    msg_handlers[MQTTSN_PUBREL] = &MQTTSNGateway::handle_pubrel;
+    msg_handlers[MQTTSN_PUBCOMP] = &MQTTSNGateway::handle_pubcomp;
     msg_handlers[MQTTSN_SUBSCRIBE] = &MQTTSNGateway::handle_subscribe;
     msg_handlers[MQTTSN_UNSUBSCRIBE] = &MQTTSNGateway::handle_unsubscribe;
     msg_handlers[MQTTSN_PINGREQ] = &MQTTSNGateway::handle_pingreq;
@@ -255,127 +495,167 @@ bool MQTTSNGateway::set_topic_prefix(const char * prefix)
 
 bool MQTTSNGateway::loop(void)
 {
+    if (!tables_ok)
+        return false;
+    
+    stats.loops++;
+    
     /* handle any messages from clients */
     handle_messages();
     
-    /* check status of each client */
-    for (MQTTSNInstance &clnt : clients) {
-        if (!clnt)
-            continue;
+    uint32_t now = device->get_millis();
+    loop_time = now;
+    
+    /* check status of only those clients with a deadline that's due */
+    timers.advance(now);
+    
+    uint16_t idx;
+    while ((idx = timers.pop_expired()) != MQTTSN_TIMER_NONE) {
+        MQTTSNInstance &clnt = clients[idx];
         
         /* delete any LOST clients */
-        if (clnt.check_status(device->get_millis()) == MQTTSNInstanceStatus_LOST) {
+        if (clnt.check_status(now) == MQTTSNInstanceStatus_LOST) {
             MQTTSN_INFO_PRINTLN("Client %s is lost.", clnt.client_id);
             clnt.deregister();
+            continue;
         }
         
         /* if the client is now AWAKE, send any buffered msgs */
-        if (clnt.status == MQTTSNInstanceStatus_AWAKE) {
-            /* send PINGRESP if there are no msgs left */
-            if (clnt.sleepy_fifo.available() == 0) {
+        if (clnt.state->status == MQTTSNInstanceStatus_AWAKE) {
+            /* send PINGRESP if there are no msgs left, and they've all been acked */
+            if (clnt.sleepy_fifo.available() == 0 && clnt.inflight_pubs.count() == 0) {
                 MQTTSNMessagePingresp reply;
                 out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
-                clnt.transport->write_packet(out_msg, out_msg_len, &clnt.address);
-                
-                clnt.status = MQTTSNInstanceStatus_ASLEEP;
-                clnt.mark_time(device->get_millis());
-                continue;
-            }
-            
-            clnt.sleepy_fifo.dequeue(out_msg);
-            
-            /* parse the header so we can get the length */
-            MQTTSNHeader header;
-            header.unpack(out_msg, MQTTSN_MAX_MSG_LEN);
-            out_msg_len = header.length;
-        
-            clnt.transport->write_packet(out_msg, out_msg_len, &clnt.address);
-        }
-    }
-
-    /* now distribute any pending publish msgs from the publish queue */    
-    while (pub_fifo.available()) {
-        MQTTSN_INFO_PRINTLN("Dispatching msgs.");
-        
-        pub_fifo.dequeue(out_msg);
-        
-        /* parse the header so we can get the msg type */
-        MQTTSNHeader header;
-        uint8_t offset = header.unpack(out_msg, MQTTSN_MAX_MSG_LEN);
-        if (offset == 0 || header.msg_type != MQTTSN_PUBLISH)
-            continue;
-        
-        out_msg_len = header.length;
-        
-        /* unpack the message, only QoS 0 for now */
-        MQTTSNMessagePublish msg;
-        if (!msg.unpack(&out_msg[offset], out_msg_len - offset) || msg.msg_id != 0x0000)
-            continue;
-        
-        uint16_t tid = msg.topic_id;
-        
-        /* dispatch msg to clients */
-        for (MQTTSNInstance &clnt : clients) {
-            /* skip if this client isnt subscribed to this topic */
-            if (!clnt.is_subbed(tid))
-                continue;
+                clnt.state->transport->write_packet(out_msg, out_msg_len, &clnt.state->address);
                 
-            /* buffer the msg if the client is asleep, else send it now */
-            if (clnt.status == MQTTSNInstanceStatus_ASLEEP) {
-                clnt.sleepy_fifo.enqueue(out_msg);
+                clnt.state->status = MQTTSNInstanceStatus_ASLEEP;
+                clnt.mark_time(now);
             }
             else {
-                clnt.transport->write_packet(out_msg, out_msg_len, &clnt.address);
+                /* one at a time, as long as the inflight window has room */
+                MQTTSNBufferedMsg buffered;
+                if (clnt.sleepy_fifo.peek(&buffered) 
+                    && send_publish(&clnt, buffered.msg, buffered.qos, buffered.topicid_type)) 
+                {
+                    clnt.sleepy_fifo.dequeue(&buffered);
+                    sleepy_pool.release(buffered.msg);
+                }
             }
         }
+        
+        clnt.arm_timer();
     }
+
+    /* now distribute any pending publish msgs from the publish queue, and any from other shards */
+    receive_shard_publishes();
+    dispatch_publishes();
     
     /* advertise if its time */
-    if (device->get_millis() - last_advert > advert_interval) {
+    if (now - last_advert > advert_interval) {
         advertise();
-        last_advert = device->get_millis();
+        last_advert = now;
+    }
+    
+    /* send off anything the transports held back to batch */
+    for (int i = 0; i < MQTTSN_MAX_NUM_TRANSPORTS; i++) {
+        if (transports[i] != NULL)
+            transports[i]->flush();
     }
     
     /* just to return something useful */
     return connected;
 }
 
-void MQTTSNGateway::handle_messages(void)
+void MQTTSNGateway::dispatch_publishes(void)
 {
-    MQTTSNTransport * transport;
-    
-    for (int i = 0; i < MQTTSN_MAX_NUM_TRANSPORTS; i++) {
-        transport = transports[i];
+    /* the rest wait for the next loop, once the budget's spent */
+    for (uint8_t sent = 0; pub_fifo.available(); sent++) {
+        if (sent == MQTTSN_GW_TX_BUDGET) {
+            stats.tx_budget_hits++;
+            return;
+        }
         
-        if (transport == NULL)
+        MQTTSN_INFO_PRINTLN("Dispatching msgs.");
+        
+        /* the msg is already packed in the pool, msg IDs get assigned per client when it's sent */
+        MQTTSNQueuedPublish queued;
+        pub_fifo.dequeue(&queued);
+        
+        MQTTSNTopicMapping * mapping = get_topic_mapping(queued.tid);
+        if (mapping == NULL) {
+            sleepy_pool.release(queued.msg);
             continue;
-            
-        while (true) {
-            /* try to read something, return if theres nothing */
-            MQTTSNAddress src;
-            int16_t rlen = transport->read_packet(in_msg, MQTTSN_MAX_MSG_LEN, &src);
-            if (rlen <= 0)
-                break;
-            
-            /* get the msg type */
-            MQTTSNHeader header;
-            uint8_t offset = header.unpack(in_msg, rlen);
-            if (offset == 0)
-                continue;
-            
-            /* make sure there's a handler */
-            uint8_t idx = header.msg_type;
-            if (idx >= MQTTSN_NUM_MSG_TYPES || msg_handlers[idx] == NULL)
-                continue;
-            
-            /* call the handler */
-            (this->*msg_handlers[idx])(&in_msg[offset], rlen - offset, transport, &src);
-            
-            device->cede();
         }
+        
+        /* keep a retained msg for later subscribers, an empty one just clears the old one */
+        if (queued.flags.retain) {
+            if (queued.data_len == 0)
+                retained.remove(mapping->tid);
+            else
+                retained.put(mapping->tid, queued.msg);
+        }
+        
+        /* dispatch msg to clients subscribed to the topic itself, then to those with matching wildcard subs */
+        dispatch(mapping, queued.msg, queued.flags.qos);
+        
+        uint16_t matched[MQTTSN_MAX_FILTER_MATCHES];
+        uint8_t matched_cnt = filters.match(mapping->name, mapping->name_len, matched, MQTTSN_MAX_FILTER_MATCHES);
+        for (uint8_t i = 0; i < matched_cnt; i++) {
+            dispatch(get_topic_mapping(matched[i]), queued.msg, queued.flags.qos);
+        }
+        
+        /* drop the queue's reference, the clients and the retained cache hold the rest */
+        sleepy_pool.release(queued.msg);
+    }
+}
+
+void MQTTSNGateway::handle_messages(void)
+{
+    /* through the transport and device interfaces */
+    receive<MQTTSNDevice>();
+}
+
+void MQTTSNGateway::handle_packet(uint16_t len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    /* a packet can hold several msgs back to back, each header gives its msg's length */
+    uint16_t pos = 0;
+    while (pos < len) {
+        /* get the msg type */
+        MQTTSNHeader header;
+        uint16_t offset = header.unpack(&in_msg[pos], len - pos);
+        if (offset == 0 || header.length > len - pos)
+            return;
+        
+        /* make sure there's a handler, then call it */
+        uint8_t idx = header.msg_type;
+        if (idx < MQTTSN_NUM_MSG_TYPES && msg_handlers[idx] != NULL)
+            (this->*msg_handlers[idx])(&in_msg[pos + offset], header.length - offset, transport, src);
+        
+        pos += header.length;
     }
 }
 
+MQTTSNGatewayStats MQTTSNGateway::get_stats(void) const
+{
+    return stats;
+}
+
+uint32_t MQTTSNGateway::next_deadline(void)
+{
+    /* still catching up */
+    if (rx_backlog || pub_fifo.available() != 0)
+        return 0;
+    
+    uint32_t now = device->get_millis();
+    uint32_t deadline = timers.next_expiry(now);
+    
+    /* the advert goes out once we're past the interval */
+    uint32_t since_advert = now - last_advert;
+    uint32_t advert_in = (since_advert > advert_interval) ? 0 : advert_interval - since_advert + 1;
+    
+    return (advert_in < deadline) ? advert_in : deadline;
+}
+
 bool MQTTSNGateway::get_mqtt_topic_name(const char * name, char * mqtt_name, uint16_t mqtt_name_sz) {
     if (strlen(name) + 1 > mqtt_name_sz)
         return false;
@@ -442,101 +722,483 @@ void MQTTSNGateway::delete_subscription(uint16_t tid)
     }
 }
 
-uint16_t MQTTSNGateway::get_topic_id(const uint8_t * name, uint8_t name_len)
+void MQTTSNGateway::forget_filter(uint16_t tid)
 {
-    if (name_len > MQTTSN_MAX_TOPICNAME_LEN)
-        return 0;
+    MQTTSNTopicMapping * mapping = get_topic_mapping(tid);
+    if (mapping == NULL || mapping->sub_count != 0 || !MQTTSNTopicTrie::is_filter((const uint8_t *)mapping->name, mapping->name_len))
+        return;
+    
+    if (mapping->subbed)
+        delete_subscription(tid);
+    
+    /* the trie reads the filter's levels from its mapping, so it goes first */
+    filters.remove(tid);
+    topics.remove(tid);
+}
+
+bool MQTTSNGateway::unpack_pooled(MQTTSNPoolHandle pooled, uint8_t topicid_type, MQTTSNMessagePublish * msg)
+{
+    uint8_t * data = sleepy_pool.data(pooled);
+    uint16_t data_len = sleepy_pool.length(pooled);
+    
+    MQTTSNHeader header;
+    uint16_t offset = header.unpack(data, data_len);
+    if (offset == 0 || !msg->unpack(&data[offset], data_len - offset))
+        return false;
+    
+    /* swap in the short name, for clients that subbed with one */
+    if (topicid_type == MQTTSN_TOPIC_SHORTNAME) {
+        MQTTSNTopicMapping * mapping = get_topic_mapping(msg->topic_id);
+        if (mapping == NULL || mapping->name_len != MQTTSN_SHORT_TOPICNAME_LEN)
+            return false;
         
-    /* check if we already have that topic */
-    for (uint16_t i = 0; i < MQTTSN_MAX_TOPIC_MAPPINGS; i++) {
-        MQTTSNTopicMapping * mapping = &mappings[i];
+        msg->topic_id = MQTTSN_SHORT_TOPIC_ID(mapping->name);
+    }
+    
+    /* predefined topics keep their ID */
+    msg->flags.topicid_type = topicid_type;
+    return true;
+}
+
+bool MQTTSNGateway::send_publish(MQTTSNInstance * clnt, MQTTSNPoolHandle pooled, uint8_t qos, uint8_t topicid_type)
+{
+    /* nothing to be done with a bad msg but drop it */
+    MQTTSNMessagePublish msg;
+    if (!unpack_pooled(pooled, topicid_type, &msg))
+        return true;
+    
+    /* the client can't take a normal ID it doesn't know, e.g. for a topic matched by a wildcard sub */
+    if (topicid_type == MQTTSN_TOPIC_NORMAL && !clnt->knows_topic(msg.topic_id)) {
+        /* the client won't take this topic, so the msg can only be dropped */
+        MQTTSNInstanceRegTopic * reg = clnt->find_reg_topic(msg.topic_id);
+        if (reg != NULL && reg->refused)
+            return true;
         
-        if (strlen(mapping->name) == name_len && memcmp(mapping->name, name, name_len) == 0) {
-            return mapping->tid;
-        }
+        register_topic(clnt, msg.topic_id);
+        return false;
     }
+    
+    msg.flags.qos = qos;
+    msg.flags.dup = 0;
+    msg.msg_id = 0x0000;
+    
+    if (msg.flags.qos == 1 || msg.flags.qos == 2) {
+        if (clnt->inflight_pubs.full())
+            return false;
         
-    /* else add it */
-    for (uint16_t i = 0; i < MQTTSN_MAX_TOPIC_MAPPINGS; i++) {
-        MQTTSNTopicMapping * mapping = &mappings[i];
+        msg.msg_id = next_msg_id(clnt);
+    }
+    
+    out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    if (out_msg_len == 0)
+        return true;
+    
+    /* hold on to the pooled msg till it's acked, and make sure we get a chance to resend it */
+    if (msg.flags.qos == 1 || msg.flags.qos == 2) {
+        uint8_t awaiting = (msg.flags.qos == 1) ? MQTTSN_PUBACK : MQTTSN_PUBREC;
+        MQTTSNInflightMsg * inflight = clnt->inflight_pubs.add(msg.msg_id, awaiting, loop_time);
+        inflight->msg = pooled;
+        inflight->qos = qos;
+        inflight->topicid_type = topicid_type;
+        sleepy_pool.retain(pooled);
         
-        if (strlen(mapping->name) == 0) {
-            memcpy(mapping->name, name, name_len);
-            mapping->name[name_len] = 0;
-            
-            mapping->tid = i + 1;
-            while (mapping->tid == MQTTSN_TOPICID_UNSUBSCRIBED || mapping->tid == MQTTSN_TOPICID_NOTASSIGNED)
-                mapping->tid++;
-            return mapping->tid;
-        }
+        if (clnt->inflight_pubs.count() == 1)
+            clnt->arm_timer();
     }
     
-    return 0;
+    clnt->state->transport->write_packet(out_msg, out_msg_len, &clnt->state->address);
+    return true;
 }
 
-MQTTSNTopicMapping * MQTTSNGateway::get_topic_mapping(uint16_t tid)
+void MQTTSNGateway::register_topic(MQTTSNInstance * clnt, uint16_t tid)
 {
-    /* check if we already have that topic */
-    for (uint16_t i = 0; i < MQTTSN_MAX_TOPIC_MAPPINGS; i++) {
-        if (mappings[i].tid == tid) {
-            return &mappings[i];
-        }
-    }
+    /* already on its way */
+    if (clnt->find_reg_topic(tid) != NULL)
+        return;
     
-    return NULL;
+    MQTTSNTopicMapping * mapping = get_topic_mapping(tid);
+    if (mapping == NULL || clnt->inflight_pubs.full())
+        return;
+    
+    MQTTSN_INFO_PRINTLN("Sending REGISTER.");
+    
+    MQTTSNMessageRegister msg;
+    msg.topic_id = tid;
+    msg.msg_id = next_msg_id(clnt);
+    msg.topic_name = (uint8_t *)mapping->name;
+    msg.topic_name_len = mapping->name_len;
+    
+    out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    if (out_msg_len == 0 || clnt->add_reg_topic(tid, msg.msg_id) == NULL)
+        return;
+    
+    /* retried like a PUBLISH till the REGACK comes */
+    clnt->inflight_pubs.add(msg.msg_id, MQTTSN_REGACK, loop_time)->topic_id = tid;
+    if (clnt->inflight_pubs.count() == 1)
+        clnt->arm_timer();
+    
+    clnt->state->transport->write_packet(out_msg, out_msg_len, &clnt->state->address);
 }
 
-MQTTSNInstance * MQTTSNGateway::get_client(MQTTSNTransport * transport, MQTTSNAddress * addr)
+void MQTTSNGateway::resend_inflight(MQTTSNInstance * clnt, MQTTSNInflightMsg * inflight)
 {
-    MQTTSNInstance * clnt;
-    
-    for (int i = 0; i < MQTTSN_MAX_NUM_CLIENTS; i++) {
-        clnt = &clients[i];
-        
-        /* check that the transports and addresses match */
-        if (*clnt && clnt->transport == transport && clnt->address.len == addr->len 
-            && memcmp(&clnt->address.bytes, addr->bytes, addr->len) == 0)
-        {
-            return clnt;
+    out_msg_len = 0;
+    if (inflight->awaiting == MQTTSN_REGACK) {
+        MQTTSNTopicMapping * mapping = get_topic_mapping(inflight->topic_id);
+        if (mapping != NULL) {
+            MQTTSNMessageRegister msg;
+            msg.topic_id = inflight->topic_id;
+            msg.msg_id = inflight->msg_id;
+            msg.topic_name = (uint8_t *)mapping->name;
+            msg.topic_name_len = mapping->name_len;
+            out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        }
+    }
+    else if (inflight->awaiting == MQTTSN_PUBCOMP) {
+        MQTTSNMessagePubrel msg;
+        msg.msg_id = inflight->msg_id;
+        out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    }
+    else {
+        MQTTSNMessagePublish msg;
+        if (unpack_pooled(inflight->msg, inflight->topicid_type, &msg)) {
+            msg.flags.qos = inflight->qos;
+            msg.flags.dup = 1;
+            msg.msg_id = inflight->msg_id;
+            out_msg_len = msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
         }
     }
     
-    return NULL;
+    /* whatever can't be packed again is left to run out of retries */
+    if (out_msg_len != 0)
+        clnt->state->transport->write_packet(out_msg, out_msg_len, &clnt->state->address);
 }
 
-MQTTSNInstance * MQTTSNGateway::get_client(const char * cid, uint8_t cid_len)
+void MQTTSNGateway::dispatch(MQTTSNTopicMapping * mapping, MQTTSNPoolHandle msg, uint8_t pub_qos)
 {
-    MQTTSNInstance * clnt;
-    
-    for (int i = 0; i < MQTTSN_MAX_NUM_CLIENTS; i++) {
-        clnt = &clients[i];
+    MQTTSNSubHandle handle = mapping->sub_head;
+    while (handle != MQTTSN_SUBHANDLE_NONE) {
+        MQTTSNInstance * clnt = get_sub_client(handle);
+        MQTTSNInstanceSubTopic * sub = get_sub_topic(handle);
+        handle = sub->next;
         
-        /* find a client with the specified name */
-        if (*clnt && strlen(clnt->client_id) == cid_len && strncmp(clnt->client_id, cid, cid_len) == 0) {
-            return clnt;
-        }
+        /* deliver at the lower of the publish and subscription QoS, under the name the client subbed with */
+        uint8_t qos = (pub_qos < sub->flags.qos) ? pub_qos : sub->flags.qos;
+        deliver(clnt, msg, qos, sub->flags.topicid_type);
     }
-    
-    return NULL;
 }
 
-void MQTTSNGateway::handle_searchgw(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::deliver(MQTTSNInstance * clnt, MQTTSNPoolHandle msg, uint8_t qos, uint8_t topicid_type)
 {
-    MQTTSN_INFO_PRINTLN("Got SEARCHGW.");
-    MQTTSNMessageSearchGW msg;
-    if (!msg.unpack(data, data_len))
+    /* send it now if we can, else buffer it behind anything already waiting */
+    if (clnt->state->status != MQTTSNInstanceStatus_ASLEEP && clnt->sleepy_fifo.available() == 0
+        && send_publish(clnt, msg, qos, topicid_type)) 
+    {
         return;
+    }
     
-    MQTTSNMessageGWInfo reply;
-    reply.gw_id = gw_id;
-    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
-    transport->broadcast(out_msg, out_msg_len);
-    MQTTSN_INFO_PRINTLN("GWINFO broadcast.\r\n");
+    /* it's pooled already, so buffering it costs nothing more */
+    MQTTSNBufferedMsg buffered;
+    buffered.msg = msg;
+    buffered.qos = qos;
+    buffered.topicid_type = topicid_type;
+    
+    sleepy_pool.retain(msg);
+    if (!clnt->sleepy_fifo.enqueue(&buffered))
+        sleepy_pool.release(msg);
 }
 
-void MQTTSNGateway::handle_connect(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+MQTTSNPoolHandle MQTTSNGateway::pool_msg(MQTTSNMessagePublish * msg)
 {
-    MQTTSN_INFO_PRINTLN("Got CONNECT.");
+    /* queued and buffered msgs come first, a retained one nobody else holds gives up its slot if need be */
+    MQTTSNPoolHandle pooled = sleepy_pool.alloc();
+    if (pooled == MQTTSN_POOL_NONE && retained.evict_unshared())
+        pooled = sleepy_pool.alloc();
+    
+    if (pooled == MQTTSN_POOL_NONE)
+        return MQTTSN_POOL_NONE;
+    
+    uint16_t len = msg->pack(sleepy_pool.data(pooled), MQTTSN_MAX_MSG_LEN);
+    if (len == 0) {
+        sleepy_pool.release(pooled);
+        return MQTTSN_POOL_NONE;
+    }
+    
+    sleepy_pool.set_length(pooled, len);
+    return pooled;
+}
+
+void MQTTSNGateway::send_retained(MQTTSNInstance * clnt, uint16_t tid, MQTTSNFlags * flags, bool wildcard)
+{
+    if (!wildcard) {
+        send_retained_msg(clnt, retained.get(tid), flags);
+        return;
+    }
+    
+    /* a filter gets the retained msg of every topic it matches */
+    for (uint8_t slot = 0; slot < MQTTSN_MAX_RETAINED_MSGS; slot++) {
+        MQTTSNTopicMapping * mapping = get_topic_mapping(retained.get_tid(slot));
+        if (mapping == NULL)
+            continue;
+        
+        uint16_t matched[MQTTSN_MAX_FILTER_MATCHES];
+        uint8_t matched_cnt = filters.match(mapping->name, mapping->name_len, matched, MQTTSN_MAX_FILTER_MATCHES);
+        for (uint8_t i = 0; i < matched_cnt; i++) {
+            if (matched[i] == tid) {
+                send_retained_msg(clnt, retained.get(mapping->tid), flags);
+                break;
+            }
+        }
+    }
+}
+
+void MQTTSNGateway::send_retained_msg(MQTTSNInstance * clnt, MQTTSNPoolHandle msg, MQTTSNFlags * flags)
+{
+    if (msg == MQTTSN_POOL_NONE)
+        return;
+    
+    uint8_t * data = sleepy_pool.data(msg);
+    uint16_t data_len = sleepy_pool.length(msg);
+    
+    /* just for its QoS */
+    MQTTSNHeader header;
+    MQTTSNMessagePublish pub;
+    uint16_t offset = header.unpack(data, data_len);
+    if (offset == 0 || !pub.unpack(&data[offset], data_len - offset))
+        return;
+    
+    uint8_t qos = (pub.flags.qos < flags->qos) ? pub.flags.qos : flags->qos;
+    deliver(clnt, msg, qos, flags->topicid_type);
+}
+
+void MQTTSNGateway::send_buffered(MQTTSNInstance * clnt)
+{
+    MQTTSNBufferedMsg buffered;
+    while (clnt->sleepy_fifo.peek(&buffered)) {
+        if (!send_publish(clnt, buffered.msg, buffered.qos, buffered.topicid_type))
+            return;
+        
+        clnt->sleepy_fifo.dequeue(&buffered);
+        sleepy_pool.release(buffered.msg);
+    }
+}
+
+uint16_t MQTTSNGateway::next_msg_id(MQTTSNInstance * clnt)
+{
+    /* 0 is reserved for msg IDs */
+    do {
+        curr_msg_id++;
+    } while (curr_msg_id == 0 || clnt->inflight_pubs.find(curr_msg_id) != NULL);
+    
+    return curr_msg_id;
+}
+
+const char * MQTTSNGateway::get_topic_name(uint8_t topicid_type, uint16_t topic_id)
+{
+    if (topicid_type == MQTTSN_TOPIC_NORMAL) {
+        MQTTSNTopicMapping * mapping = get_topic_mapping(topic_id);
+        return (mapping == NULL) ? NULL : mapping->name;
+    }
+    
+    /* the ID is the name itself */
+    if (topicid_type == MQTTSN_TOPIC_SHORTNAME) {
+        short_topic_name[0] = topic_id >> 8;
+        short_topic_name[1] = topic_id & 0xff;
+        short_topic_name[MQTTSN_SHORT_TOPICNAME_LEN] = 0;
+        return short_topic_name;
+    }
+    
+    /* predefined topics are looked up straight from their ID */
+    return MQTTSNPredefinedTopics::get_name(topic_id);
+}
+
+uint16_t MQTTSNGateway::get_topic_id(const uint8_t * name, uint8_t name_len)
+{
+    /* predefined topics hold the first mappings, with the same IDs */
+    uint16_t tid = MQTTSNPredefinedTopics::get_id((const char *)name, name_len);
+    if (tid != 0)
+        return tid;
+    
+    return topics.get_topic_id(name, name_len);
+}
+
+uint16_t MQTTSNGateway::get_sub_topic_id(uint8_t topicid_type, const uint8_t * topic, uint8_t topic_len)
+{
+    /* a predefined topic is sent as its ID */
+    if (topicid_type == MQTTSN_TOPIC_PREDEFINED) {
+        if (topic_len != 2)
+            return 0;
+        
+        uint16_t tid = ((uint16_t)topic[0] << 8) | topic[1];
+        return (MQTTSNPredefinedTopics::get_name(tid) == NULL) ? 0 : tid;
+    }
+    
+    /* a short name is sent as is, and still shares a mapping with the normal name */
+    if (topicid_type == MQTTSN_TOPIC_SHORTNAME && topic_len != MQTTSN_SHORT_TOPICNAME_LEN)
+        return 0;
+    
+    return get_topic_id(topic, topic_len);
+}
+
+MQTTSNTopicMapping * MQTTSNGateway::get_topic_mapping(uint16_t tid)
+{
+    return topics.get_topic_mapping(tid);
+}
+
+MQTTSNInstance * MQTTSNGateway::get_client(MQTTSNTransport * transport, MQTTSNAddress * addr)
+{
+    uint16_t pos = addr_bucket(transport, addr);
+    
+    while (addr_index[pos] != 0) {
+        MQTTSNInstanceState * state = &client_states[addr_index[pos] - 1];
+        
+        /* check that the transports and addresses match, without touching the rest of the client */
+        if (state->transport == transport && state->address.len == addr->len 
+            && memcmp(state->address.bytes, addr->bytes, addr->len) == 0)
+        {
+            return &clients[addr_index[pos] - 1];
+        }
+        
+        pos = (pos + 1) & index_mask;
+    }
+    
+    return NULL;
+}
+
+MQTTSNInstance * MQTTSNGateway::get_client(const char * cid, uint8_t cid_len)
+{
+    uint16_t pos = cid_bucket(cid, cid_len);
+    
+    while (cid_index[pos] != 0) {
+        MQTTSNInstance * clnt = &clients[cid_index[pos] - 1];
+        
+        /* find a client with the specified name */
+        if (clnt->client_id_len == cid_len && memcmp(clnt->client_id, cid, cid_len) == 0) {
+            return clnt;
+        }
+        
+        pos = (pos + 1) & index_mask;
+    }
+    
+    return NULL;
+}
+
+MQTTSNInstance * MQTTSNGateway::alloc_client(void)
+{
+    if (free_clients_cnt == 0)
+        return NULL;
+    
+    return &clients[free_clients[--free_clients_cnt]];
+}
+
+void MQTTSNGateway::free_client(MQTTSNInstance * clnt)
+{
+    free_clients[free_clients_cnt++] = clnt->idx;
+}
+
+MQTTSNInstance * MQTTSNGateway::get_sub_client(MQTTSNSubHandle handle)
+{
+    return &clients[handle / MQTTSN_MAX_INSTANCE_TOPICS];
+}
+
+MQTTSNInstanceSubTopic * MQTTSNGateway::get_sub_topic(MQTTSNSubHandle handle)
+{
+    return &client_subs[handle];
+}
+
+uint16_t MQTTSNGateway::addr_bucket(MQTTSNTransport * transport, const MQTTSNAddress * addr) const
+{
+    uint32_t h = mqttsn_hash(&transport, sizeof(transport));
+    return mqttsn_hash(addr->bytes, addr->len, h) & index_mask;
+}
+
+uint16_t MQTTSNGateway::cid_bucket(const char * cid, uint8_t cid_len) const
+{
+    return mqttsn_hash(cid, cid_len) & index_mask;
+}
+
+void MQTTSNGateway::index_client(MQTTSNInstance * clnt)
+{
+    /* the caller has already discarded any client with the same address or ID,
+       so we just take the first empty bucket */
+    uint16_t pos = addr_bucket(clnt->state->transport, &clnt->state->address);
+    while (addr_index[pos] != 0)
+        pos = (pos + 1) & index_mask;
+    addr_index[pos] = clnt->idx + 1;
+    
+    pos = cid_bucket(clnt->client_id, clnt->client_id_len);
+    while (cid_index[pos] != 0)
+        pos = (pos + 1) & index_mask;
+    cid_index[pos] = clnt->idx + 1;
+}
+
+void MQTTSNGateway::unindex_client(MQTTSNInstance * clnt)
+{
+    uint16_t pos = addr_bucket(clnt->state->transport, &clnt->state->address);
+    while (addr_index[pos] != 0) {
+        if (addr_index[pos] == clnt->idx + 1) {
+            index_remove(addr_index, pos, true);
+            break;
+        }
+        pos = (pos + 1) & index_mask;
+    }
+    
+    pos = cid_bucket(clnt->client_id, clnt->client_id_len);
+    while (cid_index[pos] != 0) {
+        if (cid_index[pos] == clnt->idx + 1) {
+            index_remove(cid_index, pos, false);
+            break;
+        }
+        pos = (pos + 1) & index_mask;
+    }
+}
+
+void MQTTSNGateway::index_remove(uint16_t * index, uint16_t pos, bool by_addr)
+{
+    const uint16_t mask = index_mask;
+    
+    /* no tombstones: empty the bucket, then shift back any later entries
+       in the same probe run that can no longer be reached past the gap */
+    uint16_t gap = pos;
+    index[gap] = 0;
+    
+    for (pos = (pos + 1) & mask; index[pos] != 0; pos = (pos + 1) & mask) {
+        uint16_t home;
+        if (by_addr) {
+            MQTTSNInstanceState * state = &client_states[index[pos] - 1];
+            home = addr_bucket(state->transport, &state->address);
+        }
+        else {
+            MQTTSNInstance * clnt = &clients[index[pos] - 1];
+            home = cid_bucket(clnt->client_id, clnt->client_id_len);
+        }
+        
+        /* move the entry if the gap lies between its home bucket and where it sits now */
+        if (((pos - home) & mask) >= ((pos - gap) & mask)) {
+            index[gap] = index[pos];
+            index[pos] = 0;
+            gap = pos;
+        }
+    }
+}
+
+void MQTTSNGateway::handle_searchgw(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got SEARCHGW.");
+    MQTTSNMessageSearchGW msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    MQTTSNMessageGWInfo reply;
+    reply.gw_id = gw_id;
+    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    transport->broadcast(out_msg, out_msg_len);
+    MQTTSN_INFO_PRINTLN("GWINFO broadcast.\r\n");
+}
+
+void MQTTSNGateway::handle_connect(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got CONNECT.");
     
     MQTTSNMessageConnect msg;
     if (!msg.unpack(data, data_len) || msg.client_id_len == 0)
@@ -547,28 +1209,29 @@ void MQTTSNGateway::handle_connect(uint8_t * data, uint8_t data_len, MQTTSNTrans
     reply.return_code = MQTTSN_RC_CONGESTION;
     
     /* discard any existing client with the same name or address */
-    for (MQTTSNInstance &clnt : clients) {
-        if (!clnt)
-            continue;
-        
-        bool same_name = strlen(clnt.client_id) == msg.client_id_len && memcmp(clnt.client_id, msg.client_id, msg.client_id_len) == 0;
-        bool same_address = clnt.transport == transport && clnt.address.len == src->len && memcmp(clnt.address.bytes, src->bytes, src->len) == 0;
-        
-        if (same_name || same_address) {
-            MQTTSN_INFO_PRINTLN("Discarding duplicate client: %s", clnt.client_id);
-            clnt.deregister();
-        }
+    MQTTSNInstance * clnt = get_client((char *)msg.client_id, msg.client_id_len);
+    if (clnt != NULL) {
+        MQTTSN_INFO_PRINTLN("Discarding duplicate client: %s", clnt->client_id);
+        clnt->deregister();
+    }
+    
+    clnt = get_client(transport, src);
+    if (clnt != NULL) {
+        MQTTSN_INFO_PRINTLN("Discarding duplicate client: %s", clnt->client_id);
+        clnt->deregister();
     }
         
     /* now add the client to our list, if there's room */
-    for (MQTTSNInstance &clnt : clients) {
-        if (!clnt) {
-            clnt.register_(msg.client_id, msg.client_id_len, transport, src, msg.duration, &msg.flags);
-            clnt.mark_time(device->get_millis());
+    clnt = alloc_client();
+    if (clnt != NULL) {
+        if (clnt->register_(msg.client_id, msg.client_id_len, transport, src, msg.duration, &msg.flags)) {
+            clnt->mark_time(loop_time);
             reply.return_code = MQTTSN_RC_ACCEPTED;
             
-            MQTTSN_INFO_PRINTLN("New client: %s", clnt.client_id);
-            break;
+            MQTTSN_INFO_PRINTLN("New client: %s", clnt->client_id);
+        }
+        else {
+            free_client(clnt);
         }
     }
     
@@ -577,7 +1240,7 @@ void MQTTSNGateway::handle_connect(uint8_t * data, uint8_t data_len, MQTTSNTrans
     MQTTSN_INFO_PRINTLN("CONNACK sent.\r\n");
 }
 
-void MQTTSNGateway::handle_register(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_register(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got REGISTER.");
     
@@ -591,7 +1254,7 @@ void MQTTSNGateway::handle_register(uint8_t * data, uint8_t data_len, MQTTSNTran
     if (!msg.unpack(data, data_len) || msg.topic_id != 0x0000 || msg.topic_name_len == 0)
         return;
         
-    clnt->mark_time(device->get_millis());
+    clnt->mark_time(loop_time);
 
     /* construct REGACK response */
     MQTTSNMessageRegack reply;
@@ -618,52 +1281,455 @@ void MQTTSNGateway::handle_register(uint8_t * data, uint8_t data_len, MQTTSNTran
     MQTTSN_INFO_PRINTLN("REGACK sent.\r\n");
 }
 
-void MQTTSNGateway::handle_publish(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_regack(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
-    MQTTSN_INFO_PRINTLN("Got PUBLISH.");
+    MQTTSN_INFO_PRINTLN("Got REGACK.");
     
     /* check that we know this client */
     MQTTSNInstance * clnt = get_client(transport, src);
     if (clnt == NULL)
         return;
-        
-    /* now unpack the message, only QoS 0 for now */
-    MQTTSNMessagePublish msg;
-    if (!msg.unpack(data, data_len) || msg.msg_id != 0x0000)
+    
+    MQTTSNMessageRegack msg;
+    if (!msg.unpack(data, data_len))
         return;
+    
+    /* check that we're waiting on it */
+    MQTTSNInflightMsg * inflight = clnt->inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL || inflight->awaiting != MQTTSN_REGACK)
+        return;
+    
+    clnt->drop_inflight(inflight);
+    clnt->mark_time(loop_time);
+    
+    /* it may have been pushed out by a newer topic since */
+    MQTTSNInstanceRegTopic * reg = clnt->find_reg_topic(msg.topic_id);
+    if (reg != NULL && reg->msg_id == msg.msg_id) {
+        if (msg.return_code == MQTTSN_RC_ACCEPTED) {
+            reg->msg_id = 0;
+        }
+        else {
+            MQTTSN_ERROR_PRINTLN("REGISTER %u rejected by client %s.", msg.msg_id, clnt->client_id);
+            reg->msg_id = 0;
+            reg->refused = true;
+        }
+    }
+    
+    /* msgs for the topic can go now, or be dropped if it was refused; AWAKE clients get theirs from the loop */
+    if (clnt->state->status == MQTTSNInstanceStatus_ACTIVE)
+        send_buffered(clnt);
+}
 
-    MQTTSNTopicMapping * mapping = get_topic_mapping(msg.topic_id);
-    if (mapping == NULL)
+void MQTTSNGateway::handle_publish(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBLISH.");
+    
+    MQTTSNMessagePublish msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* QoS -1 msgs can come from anyone */
+    if (msg.flags.qos == MQTTSN_QOS_NOCONNECT) {
+        handle_publish_noconnect(&msg);
+        return;
+    }
+    
+    /* else check that we know this client */
+    MQTTSNInstance * clnt = get_client(transport, src);
+    if (clnt == NULL)
+        return;
+    
+    /* QoS 0 msgs have no ID */
+    if ((msg.flags.qos == 0) != (msg.msg_id == 0x0000))
+        return;
+    
+    clnt->mark_time(loop_time);
+    
+    /* a re-sent copy of something we've already passed on just needs acking again */
+    bool duplicate = (msg.flags.qos == 1 && clnt->recent_ids.seen(msg.msg_id))
+        || (msg.flags.qos == 2 && clnt->unreleased_ids.contains(msg.msg_id));
+    
+    /* no room to track another QoS 2 msg, don't ack it so the client tries again later */
+    if (msg.flags.qos == 2 && !duplicate && clnt->unreleased_ids.full()) {
+        MQTTSN_ERROR_PRINTLN("Too many unreleased msgs!");
         return;
+    }
+    
+    /* prepare puback, for QoS 1 or a rejected QoS 2 */
+    MQTTSNMessagePuback reply;
+    reply.topic_id = msg.topic_id;
+    reply.msg_id = msg.msg_id;
 
+    /* short names need no mapping to be passed on */
+    const char * name = get_topic_name(msg.flags.topicid_type, msg.topic_id);
+    if (name == NULL) {
+        reply.return_code = MQTTSN_RC_INVALIDTID;
+    }
+    else if (duplicate) {
+        MQTTSN_INFO_PRINTLN("Duplicate PUBLISH dropped.");
+    }
     /* if we're connected to the MQTT broker, just pass on the PUBLISH */
-    if (mqtt_client != NULL && connected) {
-        if (!get_mqtt_topic_name(mapping->name, topic_name_full, MQTTSN_MAX_MQTT_TOPICNAME_LEN + 1))
+    else if (mqtt_client != NULL && connected) {
+        if (!get_mqtt_topic_name(name, topic_name_full, MQTTSN_MAX_MQTT_TOPICNAME_LEN + 1))
             return;
         
         mqtt_client->publish(topic_name_full, msg.data, msg.data_len, &msg.flags);
         MQTTSN_INFO_PRINTLN("MQTT PUBLISH to %s", topic_name_full);
     }
+    /* we're on our own, so we'll distribute it locally as broker */
+    else if (!queue_publish(&msg, name)) {
+        reply.return_code = MQTTSN_RC_CONGESTION;
+    }
     else {
-        /* if no client is subbed to this topic */
-        if (!mapping->subbed)
+        forward_publish(&msg, name);
+    }
+    
+    /* QoS 2 msgs we've taken are held as unreleased till the PUBREL,
+       so any copies that turn up before then get dropped */
+    if (msg.flags.qos == 2 && reply.return_code == MQTTSN_RC_ACCEPTED) {
+        if (!duplicate)
+            clnt->unreleased_ids.add(msg.msg_id);
+        
+        MQTTSNMessagePubrec rec;
+        rec.msg_id = msg.msg_id;
+        out_msg_len = rec.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        transport->write_packet(out_msg, out_msg_len, src);
+        MQTTSN_INFO_PRINTLN("PUBREC sent.");
+    }
+    else if (msg.flags.qos != 0) {
+        if (reply.return_code == MQTTSN_RC_ACCEPTED && !duplicate)
+            clnt->recent_ids.add(msg.msg_id);
+        
+        out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        transport->write_packet(out_msg, out_msg_len, src);
+        MQTTSN_INFO_PRINTLN("PUBACK sent.");
+    }
+    
+    MQTTSN_INFO_PRINT("\r\n");
+}
+
+void MQTTSNGateway::handle_publish_noconnect(MQTTSNMessagePublish * msg)
+{
+    /* normal topic IDs only mean something to a connected client */
+    if (msg->flags.topicid_type == MQTTSN_TOPIC_NORMAL)
+        return;
+    
+    const char * name = get_topic_name(msg->flags.topicid_type, msg->topic_id);
+    if (name == NULL)
+        return;
+    
+    /* there's nobody to ack, so it goes on as QoS 0 */
+    msg->flags.qos = 0;
+    msg->msg_id = 0x0000;
+    
+    /* if we're connected to the MQTT broker, just pass on the PUBLISH */
+    if (mqtt_client != NULL && connected) {
+        if (!get_mqtt_topic_name(name, topic_name_full, MQTTSN_MAX_MQTT_TOPICNAME_LEN + 1))
             return;
+        
+        mqtt_client->publish(topic_name_full, msg->data, msg->data_len, &msg->flags);
+        MQTTSN_INFO_PRINTLN("MQTT PUBLISH to %s", topic_name_full);
+        return;
+    }
+    
+    if (queue_publish(msg, name))
+        forward_publish(msg, name);
+}
+
+bool MQTTSNGateway::queue_publish(MQTTSNMessagePublish * msg, const char * name)
+{
+    /* only short names need looking up, predefined topics have mappings with the same ID.
+       A retained msg is kept even if nobody's subbed yet, so its short name needs a mapping */
+    MQTTSNTopicMapping * mapping;
+    if (msg->flags.topicid_type == MQTTSN_TOPIC_SHORTNAME && msg->flags.retain)
+        mapping = get_topic_mapping(get_topic_id((const uint8_t *)name, strlen(name)));
+    else if (msg->flags.topicid_type == MQTTSN_TOPIC_SHORTNAME)
+        mapping = get_topic_mapping(topics.find_topic_id((const uint8_t *)name, strlen(name)));
+    else
+        mapping = get_topic_mapping(msg->topic_id);
+    
+    /* nobody to send it to, and nothing to keep */
+    uint16_t matched;
+    if (mapping == NULL || (!msg->flags.retain && !mapping->subbed 
+        && filters.match(mapping->name, mapping->name_len, &matched, 1) == 0))
+    {
+        return true;
+    }
+    
+    /* subscribers get it under whatever name they subbed with, when it's dispatched */
+    msg->topic_id = mapping->tid;
+    msg->flags.topicid_type = MQTTSN_TOPIC_NORMAL;
+    if (!enqueue_publish(msg))
+        return false;
+    
+    MQTTSN_INFO_PRINTLN("Message queued.");
+    return true;
+}
+
+bool MQTTSNGateway::enqueue_publish(MQTTSNMessagePublish * msg)
+{
+    /* packed once, straight into the pool where it stays till the last client's done with it */
+    MQTTSNQueuedPublish queued;
+    queued.msg = pool_msg(msg);
+    if (queued.msg == MQTTSN_POOL_NONE) {
+        MQTTSN_ERROR_PRINTLN("Sleepy pool is full!");
+        return false;
+    }
+    
+    queued.tid = msg->topic_id;
+    queued.flags = msg->flags;
+    queued.data_len = msg->data_len;
+    if (!pub_fifo.enqueue(&queued)) {
+        MQTTSN_ERROR_PRINTLN("Publish FIFO is full!");
+        sleepy_pool.release(queued.msg);
+        return false;
+    }
+    
+    return true;
+}
+
+void MQTTSNGateway::set_shard(MQTTSNShardLinks * links, uint8_t shard)
+{
+    shard_links = links;
+    this->shard = shard;
+}
+
+void MQTTSNGateway::forward_publish(MQTTSNMessagePublish * msg, const char * name)
+{
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+    if (shard_links == NULL)
+        return;
+    
+    /* by name, each shard has its own topic IDs */
+    uint8_t name_len = strlen(name);
+    if (name_len > MQTTSN_MAX_TOPICNAME_LEN || msg->data_len > MQTTSN_MAX_PAYLOAD_LEN)
+        return;
+    
+    for (uint8_t i = 0; i < shard_links->count(); i++) {
+        if (i == shard)
+            continue;
+        
+        MQTTSNRecordRing * ring = shard_links->ring(shard, i);
+        uint16_t fwd_len = 2 + name_len + msg->data_len;
+        uint8_t * fwd = ring->reserve(fwd_len);
+        if (fwd == NULL) {
+            MQTTSN_ERROR_PRINTLN("Shard %u link is full!", i);
+            continue;
+        }
+        
+        fwd[0] = msg->flags.all;
+        fwd[1] = name_len;
+        memcpy(fwd + 2, name, name_len);
+        if (msg->data_len != 0)
+            memcpy(fwd + 2 + name_len, msg->data, msg->data_len);
+        
+        ring->commit(fwd_len);
+    }
+#else
+    (void)msg;
+    (void)name;
+#endif
+}
+
+void MQTTSNGateway::receive_shard_publishes(void)
+{
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+    if (shard_links == NULL)
+        return;
+    
+    for (uint8_t i = 0; i < shard_links->count(); i++) {
+        if (i == shard)
+            continue;
+        
+        MQTTSNRecordRing * ring = shard_links->ring(i, shard);
+        uint8_t * fwd;
+        uint16_t fwd_len;
+        while ((fwd = ring->front(&fwd_len)) != NULL) {
+            MQTTSNFlags flags;
+            flags.all = fwd[0];
+            uint8_t name_len = fwd[1];
+            
+            /* queue_publish() wants the name as a string */
+            char name[MQTTSN_MAX_TOPICNAME_LEN + 1];
+            memcpy(name, fwd + 2, name_len);
+            name[name_len] = 0;
             
-        /* we're on our own, add the msg to our queue
-           so we'll distribute it locally as broker */
-        msg.pack(out_msg, MQTTSN_MAX_MSG_LEN);
-        if (!pub_fifo.enqueue(out_msg)) {
-            MQTTSN_ERROR_PRINTLN("Publish FIFO is full!");
+            /* only topics someone here knows about, or is subbed to through a wildcard, or that's to be retained */
+            uint16_t tid = topics.find_topic_id((const uint8_t *)name, name_len);
+            uint16_t matched;
+            if (tid == 0 && (flags.retain || filters.match(name, name_len, &matched, 1) != 0))
+                tid = get_topic_id((const uint8_t *)name, name_len);
+            
+            if (tid != 0) {
+                MQTTSNMessagePublish msg;
+                msg.topic_id = tid;
+                msg.flags = flags;
+                msg.flags.topicid_type = MQTTSN_TOPIC_NORMAL;
+                msg.data = fwd + 2 + name_len;
+                msg.data_len = fwd_len - 2 - name_len;
+                
+                /* no room here yet, it stays on the link and the rest wait behind it till the next loop */
+                if (!queue_publish(&msg, name)) {
+                    stats.shard_backlogs++;
+                    break;
+                }
+            }
+            
+            ring->pop();
         }
-        else {
-            MQTTSN_INFO_PRINTLN("Message queued.");
+    }
+#endif
+}
+
+void MQTTSNGateway::handle_puback(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBACK.");
+    
+    /* check that we know this client */
+    MQTTSNInstance * clnt = get_client(transport, src);
+    if (clnt == NULL)
+        return;
+    
+    MQTTSNMessagePuback msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* the client's forgotten a topic we registered with it, so it'll need registering again.
+       It says so for QoS 0 msgs too, which have no ID and are lost, the next one on the topic registers it */
+    bool forgotten = false;
+    if (msg.return_code == MQTTSN_RC_INVALIDTID && msg.topic_id != MQTTSN_TOPICID_NOTASSIGNED) {
+        MQTTSNInstanceRegTopic * reg = clnt->find_reg_topic(msg.topic_id);
+        if (reg != NULL && reg->msg_id == 0) {
+            reg->tid = MQTTSN_TOPICID_NOTASSIGNED;
+            reg->refused = false;
+            forgotten = true;
         }
     }
     
-    MQTTSN_INFO_PRINT("\r\n");
+    if (msg.msg_id == 0)
+        return;
+    
+    /* check that we're waiting on it, a QoS 2 PUBLISH can be rejected with a PUBACK too */
+    MQTTSNInflightMsg * inflight = clnt->inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL)
+        return;
+    
+    if (inflight->awaiting != MQTTSN_PUBACK && !(inflight->awaiting == MQTTSN_PUBREC && msg.return_code != MQTTSN_RC_ACCEPTED))
+        return;
+    
+    /* a msg on a topic it forgot goes back in line, behind the REGISTER that'll be sent for it */
+    MQTTSNPoolHandle resend = MQTTSN_POOL_NONE;
+    uint8_t qos = inflight->qos;
+    uint8_t topicid_type = inflight->topicid_type;
+    if (forgotten && inflight->topicid_type == MQTTSN_TOPIC_NORMAL) {
+        resend = inflight->msg;
+        sleepy_pool.retain(resend);
+    }
+    
+    clnt->drop_inflight(inflight);
+    clnt->mark_time(loop_time);
+    
+    if (msg.return_code != MQTTSN_RC_ACCEPTED)
+        MQTTSN_ERROR_PRINTLN("PUBLISH %u rejected by client %s.", msg.msg_id, clnt->client_id);
+    
+    if (resend != MQTTSN_POOL_NONE) {
+        deliver(clnt, resend, qos, topicid_type);
+        sleepy_pool.release(resend);
+    }
+    
+    /* the window has room again, AWAKE clients get theirs from the loop */
+    if (clnt->state->status == MQTTSNInstanceStatus_ACTIVE)
+        send_buffered(clnt);
 }
 
-void MQTTSNGateway::handle_subscribe(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_pubrec(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBREC.");
+    
+    /* check that we know this client */
+    MQTTSNInstance * clnt = get_client(transport, src);
+    if (clnt == NULL)
+        return;
+    
+    MQTTSNMessagePubrec msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* check that it's for a QoS 2 PUBLISH we sent */
+    MQTTSNInflightMsg * inflight = clnt->inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL || (inflight->awaiting != MQTTSN_PUBREC && inflight->awaiting != MQTTSN_PUBCOMP))
+        return;
+    
+    clnt->mark_time(loop_time);
+    
+    /* the client has the msg, now release it and wait on the PUBCOMP instead,
+       or just resend the PUBREL if we've been here before */
+    if (inflight->awaiting == MQTTSN_PUBREC) {
+        sleepy_pool.release(inflight->msg);
+        inflight->msg = MQTTSN_POOL_NONE;
+        clnt->inflight_pubs.update(inflight, MQTTSN_PUBCOMP, loop_time);
+    }
+    
+    MQTTSNMessagePubrel reply;
+    reply.msg_id = msg.msg_id;
+    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    transport->write_packet(out_msg, out_msg_len, src);
+    MQTTSN_INFO_PRINTLN("PUBREL sent.");
+}
+
+void MQTTSNGateway::handle_pubrel(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBREL.");
+    
+    /* check that we know this client */
+    MQTTSNInstance * clnt = get_client(transport, src);
+    if (clnt == NULL)
+        return;
+    
+    MQTTSNMessagePubrel msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    clnt->mark_time(loop_time);
+    
+    /* the client won't resend this msg now, so we can forget its ID */
+    clnt->unreleased_ids.remove(msg.msg_id);
+    
+    /* always reply, our previous PUBCOMP may have been lost */
+    MQTTSNMessagePubcomp reply;
+    reply.msg_id = msg.msg_id;
+    out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+    transport->write_packet(out_msg, out_msg_len, src);
+    MQTTSN_INFO_PRINTLN("PUBCOMP sent.");
+}
+
+void MQTTSNGateway::handle_pubcomp(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+{
+    MQTTSN_INFO_PRINTLN("Got PUBCOMP.");
+    
+    /* check that we know this client */
+    MQTTSNInstance * clnt = get_client(transport, src);
+    if (clnt == NULL)
+        return;
+    
+    MQTTSNMessagePubcomp msg;
+    if (!msg.unpack(data, data_len))
+        return;
+    
+    /* check that we're waiting on it */
+    MQTTSNInflightMsg * inflight = clnt->inflight_pubs.find(msg.msg_id);
+    if (inflight == NULL || inflight->awaiting != MQTTSN_PUBCOMP)
+        return;
+    
+    clnt->drop_inflight(inflight);
+    clnt->mark_time(loop_time);
+    
+    /* the window has room again, AWAKE clients get theirs from the loop */
+    if (clnt->state->status == MQTTSNInstanceStatus_ACTIVE)
+        send_buffered(clnt);
+}
+
+void MQTTSNGateway::handle_subscribe(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got SUBSCRIBE.");
     
@@ -677,27 +1743,36 @@ void MQTTSNGateway::handle_subscribe(uint8_t * data, uint8_t data_len, MQTTSNTra
     if (!msg.unpack(data, data_len))
         return;
 
-    clnt->mark_time(device->get_millis());
+    clnt->mark_time(loop_time);
 
     /* construct suback response */
     MQTTSNMessageSuback reply;
     reply.msg_id = msg.msg_id;
     reply.return_code = MQTTSN_RC_ACCEPTED;
 
-    /* get the ID, create a new mapping if needed */
-    uint16_t tid = get_topic_id(msg.topic_name, msg.topic_name_len);
-    if (tid == 0)
+    /* get the ID, create a new mapping if needed; wildcard filters get a mapping too, for their subscribers */
+    uint16_t tid = get_sub_topic_id(msg.flags.topicid_type, msg.topic_name, msg.topic_name_len);
+    bool wildcard = (msg.flags.topicid_type == MQTTSN_TOPIC_NORMAL && MQTTSNTopicTrie::is_filter(msg.topic_name, msg.topic_name_len));
+    if (tid == 0 || (wildcard && !filters.insert(tid))) {
+        forget_filter(tid);
+        reply.return_code = MQTTSN_RC_INVALIDTID;
+        out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
+        transport->write_packet(out_msg, out_msg_len, src);
         return;
+    }
     
     reply.return_code = MQTTSN_RC_ACCEPTED;
     /* add the topic to the instance */
     if (!clnt->add_sub_topic(tid, &msg.flags)) {
+        forget_filter(tid);
         reply.return_code = MQTTSN_RC_CONGESTION;
         MQTTSN_ERROR_PRINTLN("Topic congestion!");
     }
     else {
         MQTTSN_INFO_PRINTLN("Topic name: %.*s, ID: %X", msg.topic_name_len, msg.topic_name, tid);
-        reply.topic_id = tid;
+        
+        /* the client already knows the ID of a short name, and topics matching a filter get registered with it as they come */
+        reply.topic_id = (msg.flags.topicid_type == MQTTSN_TOPIC_SHORTNAME || wildcard) ? 0x0000 : tid;
     }
 
     /* now send our reply */
@@ -706,14 +1781,25 @@ void MQTTSNGateway::handle_subscribe(uint8_t * data, uint8_t data_len, MQTTSNTra
     
     MQTTSN_INFO_PRINTLN("SUBACK sent.");
     
+    if (reply.return_code != MQTTSN_RC_ACCEPTED) {
+        MQTTSN_INFO_PRINTLN();
+        return;
+    }
+    
+    /* the broker sends its own retained msgs when we SUBSCRIBE to it, so we only send ours when it won't */
+    MQTTSNTopicMapping * mapping = get_topic_mapping(tid);
+    bool mqtt_sub = mqtt_client != NULL && connected && (!mapping->subbed || mapping->sub_qos < msg.flags.qos);
+    
     /* send the new sub to MQTT broker */
-    if (reply.return_code == MQTTSN_RC_ACCEPTED)
-        add_subscription(tid, msg.flags.qos);
-        
+    add_subscription(tid, msg.flags.qos);
+    
+    if (!mqtt_sub)
+        send_retained(clnt, tid, &msg.flags, wildcard);
+    
     MQTTSN_INFO_PRINTLN();
 }
 
-void MQTTSNGateway::handle_unsubscribe(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_unsubscribe(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got UNSUBSCRIBE.");
     
@@ -727,14 +1813,14 @@ void MQTTSNGateway::handle_unsubscribe(uint8_t * data, uint8_t data_len, MQTTSNT
     if (!msg.unpack(data, data_len))
         return;
 
-    clnt->mark_time(device->get_millis());
+    clnt->mark_time(loop_time);
 
     /* construct unsuback response */
     MQTTSNMessageUnsuback reply;
     reply.msg_id = msg.msg_id;
 
     /* get the topic ID first */
-    uint16_t tid = get_topic_id(msg.topic_name, msg.topic_name_len);
+    uint16_t tid = get_sub_topic_id(msg.flags.topicid_type, msg.topic_name, msg.topic_name_len);
     if (tid == 0)
         return;
 
@@ -746,16 +1832,15 @@ void MQTTSNGateway::handle_unsubscribe(uint8_t * data, uint8_t data_len, MQTTSNT
     transport->write_packet(out_msg, out_msg_len, src);
 
     /* check if anybody's still subscribed */
-    for (int i = 0; i < MQTTSN_MAX_NUM_CLIENTS; i++) {
-        if (clients[i] && clients[i].is_subbed(tid))
-            return;
-    }
+    MQTTSNTopicMapping * mapping = get_topic_mapping(tid);
+    if (mapping == NULL || mapping->sub_count != 0)
+        return;
 
     /* if not, delete the sub from MQTT broker */
     delete_subscription(tid);
 }
 
-void MQTTSNGateway::handle_pingreq(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_pingreq(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got PINGREQ.");
     
@@ -775,14 +1860,15 @@ void MQTTSNGateway::handle_pingreq(uint8_t * data, uint8_t data_len, MQTTSNTrans
             return;
         
         /* if we got a PING from a sleeping client */
-        if (clnt->status == MQTTSNInstanceStatus_ASLEEP) {
-            clnt->status = MQTTSNInstanceStatus_AWAKE;
-            clnt->mark_time(device->get_millis());
+        if (clnt->state->status == MQTTSNInstanceStatus_ASLEEP) {
+            clnt->state->status = MQTTSNInstanceStatus_AWAKE;
+            clnt->mark_time(loop_time);
+            clnt->arm_timer();
             return;
         }
     }
     
-    clnt->mark_time(device->get_millis());
+    clnt->mark_time(loop_time);
 
     /* now send our reply */
     MQTTSNMessagePingresp reply;
@@ -790,7 +1876,7 @@ void MQTTSNGateway::handle_pingreq(uint8_t * data, uint8_t data_len, MQTTSNTrans
     transport->write_packet(out_msg, out_msg_len, src);
 }
 
-void MQTTSNGateway::handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
+void MQTTSNGateway::handle_disconnect(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src)
 {
     MQTTSN_INFO_PRINTLN("Got DISCONNECT.");
     
@@ -807,16 +1893,19 @@ void MQTTSNGateway::handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNTr
         
         /* client wants to sleep, so note duration and clear msg buffer */
         clnt->keepalive_interval = msg.duration * 1000UL;
-        clnt->keepalive_timeout = (clnt->keepalive_interval > 60000) ? clnt->keepalive_interval * 1.1 : clnt->keepalive_interval * 1.5;
-        clnt->status = MQTTSNInstanceStatus_ASLEEP;
-        clnt->sleepy_fifo.clear();
+        clnt->state->keepalive_timeout = (clnt->keepalive_interval > 60000) ? clnt->keepalive_interval * 1.1 : clnt->keepalive_interval * 1.5;
+        clnt->state->status = MQTTSNInstanceStatus_ASLEEP;
+        clnt->clear_buffered();
     }
 
     /* now send our reply */
     MQTTSNMessageDisconnect reply;
     out_msg_len = reply.pack(out_msg, MQTTSN_MAX_MSG_LEN);
     transport->write_packet(out_msg, out_msg_len, src);
-    clnt->mark_time(device->get_millis());
+    clnt->mark_time(loop_time);
+    
+    /* the sleep duration may well be shorter than the keepalive */
+    clnt->arm_timer();
 }
 
 void MQTTSNGateway::handle_mqtt_connect(void * which, bool conn_state)
@@ -837,24 +1926,13 @@ void MQTTSNGateway::handle_mqtt_connect(void * which, bool conn_state)
     /* now that we just reconnected to MQTT broker,
        re-subscribe to all sub topics of all our MQTT-SN clients */
     self->connected = true;
-    for (uint16_t i = 0; i < MQTTSN_MAX_TOPIC_MAPPINGS; i++) {
-        MQTTSNTopicMapping * mapping = &self->mappings[i];
-        if (!mapping->subbed)
+    for (uint16_t tid = 1; tid <= self->topics.count(); tid++) {
+        MQTTSNTopicMapping * mapping = self->topics.get_topic_mapping(tid);
+        if (mapping == NULL || !mapping->subbed)
             continue;
           
-        MQTTSNInstance * clnt;
-        bool sub_exists = false;
-        for (int i = 0; i < MQTTSN_MAX_NUM_CLIENTS; i++) {
-            clnt = &self->clients[i];
-            
-            /* check that at least one client is subbed to this topic */
-            if (*clnt && clnt->is_subbed(mapping->tid)) {
-                sub_exists = true;
-                break;
-            }
-        }
-        
-        if (!sub_exists) {
+        /* check that at least one client is subbed to this topic */
+        if (mapping->sub_count == 0) {
             mapping->subbed = false;
             continue;
         }
@@ -869,12 +1947,10 @@ void MQTTSNGateway::handle_mqtt_connect(void * which, bool conn_state)
     MQTTSN_INFO_PRINT("\r\n");
 }
 
-void MQTTSNGateway::handle_mqtt_publish(void * which, const char * topic, uint8_t * payload, uint8_t length, MQTTSNFlags * flags)
+void MQTTSNGateway::handle_mqtt_publish(void * which, const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags)
 {
     MQTTSNGateway * self = static_cast<MQTTSNGateway*>(which);
     
-    /* TODO: adapt for qos 1 later with msg id */
-    
     /* craft a message */
     MQTTSNMessagePublish msg;
     
@@ -893,18 +1969,21 @@ void MQTTSNGateway::handle_mqtt_publish(void * which, const char * topic, uint8_
         topic += prefix_len + 1;
     }
     
-    uint16_t topic_id = self->get_topic_id((uint8_t *)topic, strlen(topic));
+    /* only topics someone here knows about, or is subbed to through a wildcard, or that's to be retained */
+    uint8_t topic_len = strlen(topic);
+    uint16_t topic_id = self->topics.find_topic_id((const uint8_t *)topic, topic_len);
+    uint16_t matched;
+    if (topic_id == 0 && (flags->retain || self->filters.match(topic, topic_len, &matched, 1) != 0))
+        topic_id = self->get_topic_id((const uint8_t *)topic, topic_len);
 
     if (topic_id == 0)
         return;
     
     msg.topic_id = topic_id;
     msg.flags.all = flags->all;
+    msg.flags.topicid_type = MQTTSN_TOPIC_NORMAL;
     
-    /* serialize and add to our pub queue */
-    msg.pack(self->out_msg, MQTTSN_MAX_MSG_LEN);
-    if (!self->pub_fifo.enqueue(self->out_msg)) {
-        MQTTSN_ERROR_PRINTLN("Publish FIFO is full!");
-    }
+    /* serialize and add to our pub queue, if it fits and anyone's to get it */
+    self->queue_publish(&msg, topic);
 }
 
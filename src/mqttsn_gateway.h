@@ -5,11 +5,23 @@
 #define MQTTSN_GATEWAY_H_
 
 #include "mqttsn_defines.h"
+#include "mqttsn_excludes.h"
+#include "mqttsn_arena.h"
 #include "mqttsn_messages.h"
 #include "mqttsn_transport.h"
+#include "mqttsn_device.h"
+#include "mqttsn_topic_registry.h"
+#include "mqttsn_predefined_topics.h"
+#include "mqttsn_topic_trie.h"
+#include "mqttsn_timer_wheel.h"
+#include "mqttsn_message_pool.h"
+#include "mqttsn_retained_cache.h"
+#include "mqttsn_inflight.h"
 #include <lite_fifo.h>
 #include <stdint.h>
 
+class MQTTSNShardLinks;
+
 typedef struct {
     uint16_t tid;
 } MQTTSNInstancePubTopic;
@@ -17,8 +29,59 @@ typedef struct {
 typedef struct {
     uint16_t tid;
     MQTTSNFlags flags;
+    
+    /* neighbours in the topic's list of subscriptions */
+    MQTTSNSubHandle prev, next;
 } MQTTSNInstanceSubTopic;
 
+/* a topic the gateway registered with the client, for msgs from its wildcard subs */
+typedef struct {
+    uint16_t tid;
+    
+    /* ID of the REGISTER while we wait on its REGACK, 0 once it's acked */
+    uint16_t msg_id;
+    
+    /* set if the client rejected it, its msgs are dropped rather than registered again */
+    bool refused;
+} MQTTSNInstanceRegTopic;
+
+/* publish msg held in the gateway's pool for a client,
+   with the QoS and topic ID type it's to be delivered with */
+typedef struct {
+    MQTTSNPoolHandle msg;
+    uint8_t qos;
+    uint8_t topicid_type;
+} MQTTSNBufferedMsg;
+
+/* publish msg waiting to be dispatched locally, packed under its topic's normal ID in the gateway's pool.
+   What dispatch needs to know is kept here, so the msg isn't parsed again */
+typedef struct {
+    MQTTSNPoolHandle msg;
+    uint16_t tid;
+    MQTTSNFlags flags;
+    
+    /* length of the payload, an empty retained msg clears the topic's old one */
+    uint16_t data_len;
+} MQTTSNQueuedPublish;
+
+/* Sizes of a gateway's tables, for one given a block of memory to carve them from at runtime:
+ * counterparts of MQTTSN_MAX_NUM_CLIENTS, MQTTSN_MAX_TOPIC_MAPPINGS, MQTTSN_MAX_POOLED_MSGS and MQTTSN_MAX_QUEUED_PUBLISH */
+typedef struct {
+    uint16_t max_clients;
+    uint16_t max_topic_mappings;
+    uint16_t max_pooled_msgs;
+    uint16_t max_queued_publish;
+} MQTTSNGatewaySizes;
+
+/* counts of gateway loops, and of the times a transport or the publish queue used up its whole budget in one.
+   shard_backlogs counts the times a publish from another shard had to wait for room here */
+typedef struct {
+    uint32_t loops;
+    uint32_t rx_budget_hits;
+    uint32_t tx_budget_hits;
+    uint32_t shard_backlogs;
+} MQTTSNGatewayStats;
+
 typedef enum {
     MQTTSNInstanceStatus_ACTIVE,
     MQTTSNInstanceStatus_LOST,
@@ -28,86 +91,154 @@ typedef enum {
     MQTTSNInstanceStatus_AWAKE,
 } MQTTSNInstanceStatus;
 
+/* The part of a client read on every address lookup, delivery and timer check.
+ * The gateway keeps these in a dense array of their own, apart from the bulky rest of each client
+ * i.e. its topics and buffered or inflight msgs, so going through many clients touches few cache lines */
+typedef struct {
+    MQTTSNTransport * transport;
+    
+    /* track when transactions start or complete, and keepalive * 1.5 */
+    uint32_t last_in;
+    uint32_t keepalive_timeout;
+    
+    MQTTSNAddress address;
+    MQTTSNInstanceStatus status;
+} MQTTSNInstanceState;
+
 class MQTTSNDevice;
 class MQTTClient;
+class MQTTSNGateway;
+
+/* client indexes take twice as many buckets as there are clients and hold a slot number, so we can't go beyond this */
+static_assert(MQTTSN_MAX_ARENA_CLIENTS <= 0x7FFF, "Too many clients");
+static_assert(MQTTSN_MAX_NUM_CLIENTS <= MQTTSN_MAX_ARENA_CLIENTS, "Too many clients");
 
 class MQTTSNInstance {
     friend class MQTTSNGateway;
     
     MQTTSNInstance(void);
     
-    /* insert a new client's info */
+    /* insert a new client's info, and add it to the gateway's indexes */
     bool register_(uint8_t * cid, uint8_t cid_len, MQTTSNTransport * transport, MQTTSNAddress * addr, uint16_t duration, MQTTSNFlags * flags);
     
-    /* delete an existing client, after it gets lost or DISCONNECTed */
+    /* delete an existing client, after it gets lost or DISCONNECTed,
+       this also removes it from the gateway's indexes */
     void deregister(void);
     
-    /* add a new subscription for the client */
+    /* add a new subscription for the client, and link it into the topic's subscriber list */
     bool add_sub_topic(uint16_t tid, MQTTSNFlags * flags);
     
     /* add a new topic registered by the client */
     bool add_pub_topic(uint16_t tid);
     
-    /* delete a client's subscription */
+    /* delete a client's subscription, and unlink it from the topic's subscriber list */
     void delete_sub_topic(uint16_t tid);
     
-    /* check if the client is subs to this topic */
-    bool is_subbed(uint16_t tid);
+    /* check if the client knows a topic's ID: it registered the topic, subscribed to it,
+       or we registered it with the client and got a REGACK */
+    bool knows_topic(uint16_t tid);
+    
+    /* get a topic we've registered with the client, or are registering, NULL if there's none */
+    MQTTSNInstanceRegTopic * find_reg_topic(uint16_t tid);
+    
+    /* take a slot for a topic we're registering with the client, forgetting the oldest one if we're full.
+       One still waiting on its REGACK is never forgotten, NULL if they all are */
+    MQTTSNInstanceRegTopic * add_reg_topic(uint16_t tid, uint16_t msg_id);
     
     /* re-send any inflight msgs and check the client's status */
     MQTTSNInstanceStatus check_status(uint32_t now);
     
+    /* drop any msgs buffered while the client slept */
+    void clear_buffered(void);
+    
+    /* forget an inflight msg, or all of them, letting go of their pooled PUBLISHes */
+    void drop_inflight(MQTTSNInflightMsg * inflight);
+    void clear_inflight(void);
+    
     /* used after a transaction is initiated by the client */
     void mark_time(uint32_t now);
     
+    /* (re)arm our timer on the gateway's wheel for the nearest of our deadlines */
+    void arm_timer(void);
+    
     explicit operator bool() const;
     
-    /* list of pub and sub topics for this client */
+    /* list of pub and sub topics for this client,
+       the subs are our slice of the gateway's array of them, which its subscriber lists run through */
     MQTTSNInstancePubTopic pub_topics[MQTTSN_MAX_INSTANCE_TOPICS];
-    MQTTSNInstanceSubTopic sub_topics[MQTTSN_MAX_INSTANCE_TOPICS];
+    MQTTSNInstanceSubTopic * sub_topics;
+    
+    /* ring of topics we've registered with the client. The client may forget them in another order,
+       in which case it says so with a PUBACK of INVALIDTID and we register the topic again */
+    MQTTSNInstanceRegTopic reg_topics[MQTTSN_MAX_GW_TOPICS];
+    uint8_t reg_topics_next;
+    
+    /* owning gateway and our slot in its clients table */
+    MQTTSNGateway * gateway;
+    uint16_t idx;
+    
+    /* our transport, address, status and keepalive, in the gateway's dense array of them */
+    MQTTSNInstanceState * state;
     
     char client_id[MQTTSN_MAX_CLIENTID_LEN + 1];
+    uint8_t client_id_len;
     MQTTSNFlags connect_flags;
-    MQTTSNTransport * transport;
-    MQTTSNAddress address;
     
-    /* for storing unicast msgs expecting a reply */
-    uint8_t msg_inflight[MQTTSN_MAX_MSG_LEN];
-    uint8_t msg_inflight_len;
-    uint32_t unicast_timer;
-    uint8_t unicast_counter;
+    /* QoS 1 and 2 PUBLISHes sent to the client and awaiting PUBACK or PUBCOMP,
+       their retries are held while the client sleeps */
+    MQTTSNInflightWindow inflight_pubs;
+    
+    /* IDs of the last QoS 1 PUBLISHes from the client, to drop duplicates */
+    MQTTSNMsgIdHistory recent_ids;
+    
+    /* IDs of QoS 2 PUBLISHes from the client awaiting PUBREL */
+    MQTTSNMsgIdSet unreleased_ids;
     
-    /* keepalive and (keepalive * 1.5) */
     uint32_t keepalive_interval;
-    uint32_t keepalive_timeout;
     
     uint32_t sleep_interval;
     uint32_t sleep_timeout;
     
-    /* queue for holding publish messages awaiting dispatch, while client sleeps */
+    /* queue for holding publish messages awaiting dispatch, while client sleeps
+       or its inflight window is full, holds handles to msgs in the gateway's pool */
     LiteFifo sleepy_fifo;
-    uint8_t sleepy_fifo_buf[MQTTSN_MAX_BUFFERED_MSGS * MQTTSN_MAX_MSG_LEN];
-    
-    /* track when transactions start or complete */
-    uint32_t last_in;
-    MQTTSNInstanceStatus status;
+    uint8_t sleepy_fifo_buf[MQTTSN_MAX_BUFFERED_MSGS * sizeof(MQTTSNBufferedMsg)];
 };
 
-/* for gateway mapping of topic name to topic ID and type */
-typedef struct {
-    char name[MQTTSN_MAX_TOPICNAME_LEN + 1];
-    uint8_t ttype;
-    bool subbed;
-    uint8_t sub_qos;
-    uint16_t tid;
-} MQTTSNTopicMapping;
 
+/* bytes of memory needed for a gateway's tables of the given sizes, each starts on an MQTTSN_ARENA_ALIGN boundary */
+constexpr uint32_t mqttsn_gateway_arena_len(uint16_t clients, uint16_t mappings, uint16_t pooled, uint16_t queued)
+{
+    return MQTTSNArena::block_len(
+        MQTTSNArena::align((uint32_t)queued * sizeof(MQTTSNQueuedPublish)) +
+        MQTTSNArena::align((uint32_t)clients * sizeof(MQTTSNInstance)) +
+        MQTTSNArena::align((uint32_t)clients * sizeof(MQTTSNInstanceState)) +
+        MQTTSNArena::align((uint32_t)clients * MQTTSN_MAX_INSTANCE_TOPICS * sizeof(MQTTSNInstanceSubTopic)) +
+        MQTTSNArena::align((uint32_t)clients * sizeof(uint16_t)) +
+        2 * MQTTSNArena::align(MQTTSNArena::index_len(clients) * sizeof(uint16_t)) +
+        MQTTSNArena::align(MQTTSNTimerWheel::storage_size(clients)) +
+        MQTTSNArena::align(MQTTSNTopicRegistry::storage_size(mappings)) +
+        MQTTSNArena::align(MQTTSNMessagePool::storage_size(pooled)));
+}
 
 class MQTTSNGateway {    
+    friend class MQTTSNInstance;
+    
     public:
+#if !defined(MQTTSN_EXCLUDE_BUILTIN_TABLES)
+    /* a gateway with its own tables, sized by the MQTTSN_MAX_* defines */
     MQTTSNGateway(MQTTSNDevice * device, MQTTClient * client = NULL);
+#endif
     
-    /* start the gateway with a unique gateway ID */
+    /* A gateway with tables of the given sizes, carved out of arena_len bytes at 'arena',
+     * which it keeps for as long as it lives. Nothing is allocated after this,
+     * and begin() fails if they don't fit, see arena_size() */
+    MQTTSNGateway(MQTTSNDevice * device, const MQTTSNGatewaySizes * sizes, void * arena, uint32_t arena_len, MQTTClient * client = NULL);
+    
+    /* bytes of arena needed for tables of the given sizes */
+    static uint32_t arena_size(const MQTTSNGatewaySizes * sizes);
+    
+    /* start the gateway with a unique gateway ID, fails if its tables couldn't be set up */
     bool begin(uint8_t gw_id);
     
     /* register transports that are used to talk to clients */
@@ -115,60 +246,218 @@ class MQTTSNGateway {
     
     void set_advertise_interval(uint16_t seconds);
     
-    /* gateway tasks loop */
+    /* gateway tasks loop, reads and dispatches no more than MQTTSN_GW_RX_BUDGET and MQTTSN_GW_TX_BUDGET msgs */
     bool loop(void);
     
+    /* how often the loop's budgets are being hit */
+    MQTTSNGatewayStats get_stats(void) const;
+    
+    /* millisecs till the next keepalive, retry or advertise deadline, 0 if the last loop left work behind;
+       MQTTSN_NO_DEADLINE if there's none. Till then loop() only has to run when a transport has a packet,
+       so the host can sleep or block on its transports in between */
+    uint32_t next_deadline(void);
+    
     /* Set a prefix for every client topic
        e.g. Topic "lights" could be prefixed with the client's name "home" to yield "home/lights" */ 
     bool set_topic_prefix(const char * prefix);
     
+    /* Make this gateway one shard of several, see MQTTSNShardRouter. Acting as the broker,
+       the publishes it takes are passed on to the other shards, and theirs to it; needs threads */
+    void set_shard(MQTTSNShardLinks * links, uint8_t shard);
+    
+    protected:
+    /* read and handle what the transports have, once a loop. MQTTSNGatewayT runs it on its own types */
+    virtual void handle_messages(void);
+    
+    /* the read loop, reading transport i as the i-th of the given types, if there is one */
+    template <typename Device, typename... Transports>
+    void receive(void);
+    
     private:
+    /* read transport 'slot' as the type it was registered as, going through the types from slot i */
+    template <typename Transport, typename... Rest>
+    int32_t read_slot(uint8_t slot, uint8_t i, MQTTSNAddress * src);
+    
+    /* past the last type, the transport is read through its interface */
+    template <typename... None>
+    int32_t read_slot(uint8_t slot, uint8_t, MQTTSNAddress * src, None...)
+    {
+        return transports[slot]->read_packet(in_msg, MQTTSN_MAX_MSG_LEN, src);
+    }
+    
+    /* carve our tables out of the arena, returns false if they don't fit */
+    bool set_tables(const MQTTSNGatewaySizes * sizes, void * arena, uint32_t arena_len);
+    
     void advertise(void);
     void assign_msg_handlers(void);
-    void handle_messages(void);
+    void handle_packet(uint16_t len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    
+    /* hand out queued publish msgs to their subscribers */
+    void dispatch_publishes(void);
     
     /* add and delete subs from our table of topic mappings */
     void add_subscription(uint16_t tid, uint8_t qos);
     void delete_subscription(uint16_t tid);
     
+    /* drop a wildcard filter once nobody's subscribed to it, with its MQTT sub, trie nodes and mapping */
+    void forget_filter(uint16_t tid);
+    
     uint16_t get_topic_id(const uint8_t * name, uint8_t name_len);
+    
+    /* get the ID of the topic in a SUBSCRIBE or UNSUBSCRIBE, going by its ID type; 0 if it's invalid */
+    uint16_t get_sub_topic_id(uint8_t topicid_type, const uint8_t * topic, uint8_t topic_len);
     MQTTSNTopicMapping * get_topic_mapping(uint16_t tid);
     MQTTSNInstance * get_client(MQTTSNTransport * transport, MQTTSNAddress * addr);
     MQTTSNInstance * get_client(const char * cid, uint8_t cid_len);
+    
+    /* client table management, new clients come from a stack of free slots */
+    MQTTSNInstance * alloc_client(void);
+    void free_client(MQTTSNInstance * clnt);
+    void index_client(MQTTSNInstance * clnt);
+    void unindex_client(MQTTSNInstance * clnt);
+    void index_remove(uint16_t * index, uint16_t pos, bool by_addr);
+    uint16_t addr_bucket(MQTTSNTransport * transport, const MQTTSNAddress * addr) const;
+    uint16_t cid_bucket(const char * cid, uint8_t cid_len) const;
+    
+    /* get the client and subscription slot a handle refers to */
+    MQTTSNInstance * get_sub_client(MQTTSNSubHandle handle);
+    MQTTSNInstanceSubTopic * get_sub_topic(MQTTSNSubHandle handle);
     bool get_mqtt_topic_name(const char * name, char * mqtt_name, uint16_t mqtt_name_sz);
     
+    /* get the name of a topic given its ID and ID type, NULL if it's unknown */
+    const char * get_topic_name(uint8_t topicid_type, uint16_t topic_id);
+    
+    /* send a PUBLISH to a client at the given QoS with a fresh msg ID, under its short name if the topic ID type says so.
+       QoS 1 and 2 msgs are held until acked; returns false if the client's inflight window is full,
+       or if the client doesn't know the topic's ID yet, in which case the topic gets REGISTERed with it first */
+    bool send_publish(MQTTSNInstance * clnt, MQTTSNPoolHandle pooled, uint8_t qos, uint8_t topicid_type);
+    
+    /* unpack a pooled PUBLISH as a client with the given topic ID type is to get it, false if it can't be */
+    bool unpack_pooled(MQTTSNPoolHandle pooled, uint8_t topicid_type, MQTTSNMessagePublish * msg);
+    
+    /* pack an inflight msg again from what the window keeps of it, and re-send it */
+    void resend_inflight(MQTTSNInstance * clnt, MQTTSNInflightMsg * inflight);
+    
+    /* queue a client's PUBLISH to be distributed locally under its topic's normal ID, if anyone's subbed;
+       returns false if the queue is full */
+    bool queue_publish(MQTTSNMessagePublish * msg, const char * name);
+    
+    /* pack a PUBLISH with a normal topic ID into the pool and queue it for dispatch,
+       returns false if there's no room in either */
+    bool enqueue_publish(MQTTSNMessagePublish * msg);
+    
+    /* pass a client's publish on to the other shards, and queue theirs here */
+    void forward_publish(MQTTSNMessagePublish * msg, const char * name);
+    void receive_shard_publishes(void);
+    
+    /* send a REGISTER for a topic to a client, unless one's already on its way */
+    void register_topic(MQTTSNInstance * clnt, uint16_t tid);
+    
+    /* send or buffer a pooled PUBLISH for each subscriber of a topic or filter */
+    void dispatch(MQTTSNTopicMapping * mapping, MQTTSNPoolHandle msg, uint8_t pub_qos);
+    
+    /* send a pooled PUBLISH to a client now if it's awake and nothing's waiting ahead of it,
+       else buffer it, taking another reference to it */
+    void deliver(MQTTSNInstance * clnt, MQTTSNPoolHandle msg, uint8_t qos, uint8_t topicid_type);
+    
+    /* pack a msg straight into the pool, evicting retained msgs to make room if needed */
+    MQTTSNPoolHandle pool_msg(MQTTSNMessagePublish * msg);
+    
+    /* send a new subscriber the retained msg of its topic, or of every topic its filter matches */
+    void send_retained(MQTTSNInstance * clnt, uint16_t tid, MQTTSNFlags * flags, bool wildcard);
+    void send_retained_msg(MQTTSNInstance * clnt, MQTTSNPoolHandle msg, MQTTSNFlags * flags);
+    
+    /* send as many of a client's buffered msgs as its inflight window allows */
+    void send_buffered(MQTTSNInstance * clnt);
+    
+    /* get the next msg ID for a client, skipping any it hasn't acked yet */
+    uint16_t next_msg_id(MQTTSNInstance * clnt);
+    
     /* MQTTSN message handlers */
-    void handle_searchgw(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_connect(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_register(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_publish(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_subscribe(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_unsubscribe(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_pingreq(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
-    void handle_disconnect(uint8_t * data, uint8_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_searchgw(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_connect(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_register(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_regack(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_publish(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_publish_noconnect(MQTTSNMessagePublish * msg);
+    void handle_puback(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_pubrec(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_pubrel(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_pubcomp(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_subscribe(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_unsubscribe(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_pingreq(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
+    void handle_disconnect(uint8_t * data, uint16_t data_len, MQTTSNTransport * transport, MQTTSNAddress * src);
     
     /* MQTT event handlers */
     static void handle_mqtt_connect(void * which, bool conn_state);
-    static void handle_mqtt_publish(void * which, const char * topic, uint8_t * payload, uint8_t length, MQTTSNFlags * flags);
+    static void handle_mqtt_publish(void * which, const char * topic, uint8_t * payload, uint16_t length, MQTTSNFlags * flags);
     
     /* prepended to every MQTTSN client topic, except those that begin with a $ */
     char topic_prefix[MQTTSN_MAX_TOPICPREFIX_LEN + 1];
     
+    /* for holding a short topic name as a string */
+    char short_topic_name[MQTTSN_SHORT_TOPICNAME_LEN + 1];
+    
     /* for holding complete MQTT topic name during publish/subscribe */
     char topic_name_full[MQTTSN_MAX_MQTT_TOPICNAME_LEN + 1];
     
     /* table of topic mappings */
-    MQTTSNTopicMapping mappings[MQTTSN_MAX_TOPIC_MAPPINGS];
+    MQTTSNTopicRegistry topics;
     
-    /* list of clients connected to this gateway */
-    MQTTSNInstance clients[MQTTSN_MAX_NUM_CLIENTS];
+    /* wildcard filters subscribed to by clients, each has a mapping in the table above */
+    MQTTSNTopicTrie filters;
+    
+    /* list of clients connected to this gateway, with their hot state and their subscriptions
+       in arrays of their own, by client slot */
+    MQTTSNInstance * clients;
+    MQTTSNInstanceState * client_states;
+    MQTTSNInstanceSubTopic * client_subs;
+    uint16_t max_clients;
+    
+    /* publish msgs waiting for dispatch, and those buffered for sleeping or busy clients, shared between them */
+    MQTTSNMessagePool sleepy_pool;
+    
+    /* last retained msg of each topic, held in the pool above */
+    MQTTSNRetainedCache retained;
+    
+    /* keepalive and retry deadlines of the clients, timer IDs are client slots */
+    MQTTSNTimerWheel timers;
+    
+    /* stack of unused client slots */
+    uint16_t * free_clients;
+    uint16_t free_clients_cnt;
+    
+    /* open-addressed (linear probing) indexes of clients by transport/address and by client ID,
+       each bucket holds a client's slot + 1, or 0 if it's empty */
+    uint16_t * addr_index;
+    uint16_t * cid_index;
+    uint16_t index_mask;
+    
+    /* set once the tables above are carved out */
+    bool tables_ok;
     
     /* message handlers jump table, used for dispatch */
-    void (MQTTSNGateway::*msg_handlers[MQTTSN_NUM_MSG_TYPES])(uint8_t *, uint8_t, MQTTSNTransport *, MQTTSNAddress *);
+    void (MQTTSNGateway::*msg_handlers[MQTTSN_NUM_MSG_TYPES])(uint8_t *, uint16_t, MQTTSNTransport *, MQTTSNAddress *);
     
     uint8_t gw_id;
     MQTTSNDevice * device;
     MQTTSNTransport * transports[MQTTSN_MAX_NUM_TRANSPORTS];
+    
+    /* millisecs as of this loop, read from the device once per round of packets
+       so the handlers don't each make a call for it */
+    uint32_t loop_time;
+    
+    /* the transport read first next loop, so they all get a turn at going first */
+    uint8_t rx_next;
+    
+    /* set when a transport used up its budget, so it may have more to read */
+    bool rx_backlog;
+    
+    /* the other shards, if this gateway is one of several */
+    MQTTSNShardLinks * shard_links;
+    uint8_t shard;
+    MQTTSNGatewayStats stats;
     MQTTClient * mqtt_client;
     
     /* for MQTT connection state */
@@ -180,18 +469,166 @@ class MQTTSNGateway {
     uint32_t advert_interval;
     uint32_t last_advert;
     
-    /* queue for holding publish messages awaiting dispatch */
+    /* queue of publish messages awaiting dispatch, the msgs themselves are in the pool */
     LiteFifo pub_fifo;
-    uint8_t pub_fifo_buf[MQTTSN_MAX_QUEUED_PUBLISH * MQTTSN_MAX_MSG_LEN];
     
     /* buffer for incoming packets */
     uint8_t in_msg[MQTTSN_MAX_MSG_LEN];
-    uint8_t in_msg_len;
+    uint16_t in_msg_len;
     
     /* buffer for outgoing packets */
     uint8_t out_msg[MQTTSN_MAX_MSG_LEN];
-    uint8_t out_msg_len;
+    uint16_t out_msg_len;
+    
+#if !defined(MQTTSN_EXCLUDE_BUILTIN_TABLES)
+    /* where our own tables are carved from, when we aren't given an arena */
+    uint8_t builtin_tables[mqttsn_gateway_arena_len(MQTTSN_MAX_NUM_CLIENTS, MQTTSN_MAX_TOPIC_MAPPINGS, 
+                                                    MQTTSN_MAX_POOLED_MSGS, MQTTSN_MAX_QUEUED_PUBLISH)];
+#endif
 };
 
+/* the sizes of an MQTTSNGatewayT's tables, in place of the MQTTSN_MAX_* defines,
+ * e.g. MQTTSNGatewayLimits<200, 400> for 200 clients and 400 topic mappings */
+template <uint16_t MaxClients = MQTTSN_MAX_NUM_CLIENTS, uint16_t MaxTopicMappings = MQTTSN_MAX_TOPIC_MAPPINGS,
+          uint16_t MaxPooledMsgs = MQTTSN_MAX_POOLED_MSGS, uint16_t MaxQueuedPublish = MQTTSN_MAX_QUEUED_PUBLISH>
+struct MQTTSNGatewayLimits {
+    static_assert(MaxClients != 0 && MaxClients <= MQTTSN_MAX_ARENA_CLIENTS, "Too many clients for one gateway");
+    static_assert(MaxTopicMappings <= MQTTSN_MAX_ARENA_TOPICS, "Too many topic mappings for one gateway");
+    static_assert(MaxPooledMsgs != 0 && MaxPooledMsgs != MQTTSN_POOL_NONE && MaxQueuedPublish != 0, "Gateway needs room for msgs");
+    
+    static constexpr uint16_t max_clients = MaxClients;
+    static constexpr uint16_t max_topic_mappings = MaxTopicMappings;
+    static constexpr uint16_t max_pooled_msgs = MaxPooledMsgs;
+    static constexpr uint16_t max_queued_publish = MaxQueuedPublish;
+    static constexpr uint32_t arena_len = mqttsn_gateway_arena_len(MaxClients, MaxTopicMappings, MaxPooledMsgs, MaxQueuedPublish);
+};
+
+/* the tables of an MQTTSNGatewayT, in a base of their own so they're there before the gateway carves them up */
+template <typename Limits>
+struct MQTTSNGatewayTables {
+    MQTTSNGatewayTables(void)
+    {
+        sizes.max_clients = Limits::max_clients;
+        sizes.max_topic_mappings = Limits::max_topic_mappings;
+        sizes.max_pooled_msgs = Limits::max_pooled_msgs;
+        sizes.max_queued_publish = Limits::max_queued_publish;
+    }
+    
+    MQTTSNGatewaySizes sizes;
+    uint8_t tables[Limits::arena_len];
+};
+
+/* A gateway over a device and transports of known types, with its own tables sized by Limits, e.g.
+ *   MQTTSNGatewayT<MQTTSNDeviceArduino, MQTTSNGatewayLimits<200, 400>, MQTTSNTransportRFM69X, MQTTSNTransportHC12> big(&device);
+ *   big.register_transports(&radio, &hc12);
+ * Its read loop calls each transport and the device on its own type, which the compiler can inline when the type is final,
+ * and gateways of different sizes can live side by side in one program.
+ * Only the read loop is templated: replies, broadcasts and the MQTT client are still called through their interfaces.
+ * Define MQTTSN_EXCLUDE_BUILTIN_TABLES so they don't carry the default-sized tables along as well */
+template <typename Device, typename Limits, typename... Transports>
+class MQTTSNGatewayT : private MQTTSNGatewayTables<Limits>, protected MQTTSNGateway
+{
+    static_assert(sizeof...(Transports) != 0 && sizeof...(Transports) <= MQTTSN_MAX_NUM_TRANSPORTS, "Gateway needs 1 to MQTTSN_MAX_NUM_TRANSPORTS transports");
+    
+    public:
+    MQTTSNGatewayT(Device * device, MQTTClient * client = NULL) :
+        MQTTSNGateway(device, &this->sizes, this->tables, sizeof(this->tables), client), registered(false)
+    {
+        
+    }
+    
+    using MQTTSNGateway::begin;
+    using MQTTSNGateway::set_advertise_interval;
+    using MQTTSNGateway::loop;
+    using MQTTSNGateway::get_stats;
+    using MQTTSNGateway::next_deadline;
+    using MQTTSNGateway::set_topic_prefix;
+    using MQTTSNGateway::set_shard;
+    
+    /* register one transport of each of our types, in order; only once, 
+       so each transport is always read as the type it was given as */
+    bool register_transports(Transports *... transports)
+    {
+        if (registered)
+            return false;
+        
+        MQTTSNTransport * list[] = {transports...};
+        for (uint8_t i = 0; i < sizeof...(Transports); i++) {
+            MQTTSNGateway::register_transport(list[i]);
+        }
+        
+        registered = true;
+        return true;
+    }
+    
+    protected:
+    virtual void handle_messages(void)
+    {
+        receive<Device, Transports...>();
+    }
+    
+    private:
+    bool registered;
+};
+
+template <typename Transport, typename... Rest>
+int32_t MQTTSNGateway::read_slot(uint8_t slot, uint8_t i, MQTTSNAddress * src)
+{
+    if (slot != i)
+        return read_slot<Rest...>(slot, i + 1, src);
+    
+    /* it was registered as a Transport, so it's one or a subclass of one */
+    return static_cast<Transport *>(transports[i])->read_packet(in_msg, MQTTSN_MAX_MSG_LEN, src);
+}
+
+template <typename Device, typename... Transports>
+void MQTTSNGateway::receive(void)
+{
+    Device * dev = static_cast<Device *>(device);
+    
+    /* packets left to read from each transport this loop */
+    uint8_t budgets[MQTTSN_MAX_NUM_TRANSPORTS];
+    for (int i = 0; i < MQTTSN_MAX_NUM_TRANSPORTS; i++) {
+        budgets[i] = (transports[i] != NULL) ? MQTTSN_GW_RX_BUDGET : 0;
+    }
+    
+    uint8_t first = rx_next;
+    rx_next = (rx_next + 1) % MQTTSN_MAX_NUM_TRANSPORTS;
+    rx_backlog = false;
+    
+    /* one packet from each transport in turn, till they're all drained or out of budget */
+    bool busy = true;
+    while (busy) {
+        busy = false;
+        
+        /* once a round, rather than in every handler */
+        loop_time = dev->get_millis();
+        
+        for (int k = 0; k < MQTTSN_MAX_NUM_TRANSPORTS; k++) {
+            int i = (first + k) % MQTTSN_MAX_NUM_TRANSPORTS;
+            if (budgets[i] == 0)
+                continue;
+            
+            /* try to read something, move on if theres nothing */
+            MQTTSNAddress src;
+            int32_t rlen = read_slot<Transports...>(i, 0, &src);
+            if (rlen <= 0) {
+                budgets[i] = 0;
+                continue;
+            }
+            
+            handle_packet(rlen, transports[i], &src);
+            dev->cede();
+            
+            if (--budgets[i] == 0) {
+                stats.rx_budget_hits++;
+                rx_backlog = true;
+            }
+            else
+                busy = true;
+        }
+    }
+}
+
 #endif
 
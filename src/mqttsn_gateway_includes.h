@@ -7,6 +7,7 @@
 /* uncomment to select a device */
 
     #define MQTTSN_INCLUDE_DEVICE_ARDUINO
+    //#define MQTTSN_INCLUDE_DEVICE_POSIX
     
 /* uncomment to select transport(s) */
 
@@ -14,15 +15,29 @@
     #define MQTTSN_INCLUDE_TRANSPORT_HC12
     #define MQTTSN_INCLUDE_TRANSPORT_DUMMY
     
+    /* wrap any of the above, for msgs longer than its packets, or to pack several msgs into one */
+    //#define MQTTSN_INCLUDE_TRANSPORT_FRAG
+    //#define MQTTSN_INCLUDE_TRANSPORT_BATCH
+    
+    /* or to give it a thread of its own, or split its clients between gateway shards on threads of their own,
+       on hosts with threads (see mqttsn_excludes.h) */
+    //#define MQTTSN_INCLUDE_TRANSPORT_THREADED
+    //#define MQTTSN_INCLUDE_TRANSPORT_SHARD
+    
 /* uncomment to select an MQTT client lib */
 
     #define MQTTSN_INCLUDE_MQTTCLIENT_PUBSUB
     
+    /* wrap it to run it on a thread of its own, on hosts with threads */
+    //#define MQTTSN_INCLUDE_MQTTCLIENT_THREADED
+    
     
 /*************** IGNORE EVERYTHING BELOW *******************/
 
 #if defined(MQTTSN_INCLUDE_DEVICE_ARDUINO)
     #include "device/mqttsn_device_arduino.h"
+#elif defined(MQTTSN_INCLUDE_DEVICE_POSIX)
+    #include "device/mqttsn_device_posix.h"
 #endif
 
 /* possible to use multiple transports */
@@ -38,10 +53,31 @@
     #include "mqttsn_transport_dummy.h"
 #endif
 
+#if defined(MQTTSN_INCLUDE_TRANSPORT_FRAG)
+    #include "transport/mqttsn_transport_frag.h"
+#endif
+
+#if defined(MQTTSN_INCLUDE_TRANSPORT_BATCH)
+    #include "transport/mqttsn_transport_batch.h"
+#endif
+
+#if defined(MQTTSN_INCLUDE_TRANSPORT_THREADED)
+    #include "transport/mqttsn_transport_threaded.h"
+#endif
+
+#if defined(MQTTSN_INCLUDE_TRANSPORT_SHARD)
+    #include "transport/mqttsn_transport_shard.h"
+    #include "mqttsn_shard_links.h"
+#endif
+
 #if defined(MQTTSN_INCLUDE_MQTTCLIENT_PUBSUB)
     #include "mqtt/mqtt_client_pubsub.h"
 #endif
 
+#if defined(MQTTSN_INCLUDE_MQTTCLIENT_THREADED)
+    #include "mqtt/mqtt_client_threaded.h"
+#endif
+
 #include "mqttsn_defines.h"
 #include "mqttsn_gateway.h"
 
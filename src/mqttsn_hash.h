@@ -0,0 +1,30 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_HASH_H_
+#define MQTTSN_HASH_H_
+
+#include <stdint.h>
+
+#define MQTTSN_HASH_SEED                2166136261UL
+
+/* 32-bit FNV-1a, used for the gateway's lookup tables.
+   Keys made of several parts can be hashed by passing the previous result as the seed */
+inline uint32_t mqttsn_hash(const void * data, uint16_t len, uint32_t h = MQTTSN_HASH_SEED)
+{
+    const uint8_t * bytes = (const uint8_t *)data;
+    for (uint16_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 16777619UL;
+    }
+
+    return h;
+}
+
+/* same as above over a whole string, for hashing at compile time */
+constexpr uint32_t mqttsn_hash_str(const char * str, uint32_t h = MQTTSN_HASH_SEED)
+{
+    return (*str == 0) ? h : mqttsn_hash_str(str + 1, (uint32_t)((h ^ (uint8_t)*str) * 16777619UL));
+}
+
+#endif
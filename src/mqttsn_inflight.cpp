@@ -0,0 +1,270 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_inflight.h"
+#include "mqttsn_messages.h"
+#include "mqttsn_defines.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**************** MQTTSNInflightWindow ***************/
+
+MQTTSNInflightWindow::MQTTSNInflightWindow(void) : msgs_cnt(0)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        msgs[i].msg_id = 0;
+    }
+}
+
+MQTTSNInflightMsg * MQTTSNInflightWindow::add(uint16_t msg_id, uint8_t awaiting, uint32_t now)
+{
+    if (msg_id == 0)
+        return NULL;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        MQTTSNInflightMsg * inflight = &msgs[i];
+        if (inflight->msg_id != 0)
+            continue;
+
+        inflight->msg_id = msg_id;
+        inflight->msg = MQTTSN_POOL_NONE;
+        inflight->topic_id = 0;
+        msgs_cnt++;
+        
+        update(inflight, awaiting, now);
+        return inflight;
+    }
+
+    /* no more space */
+    return NULL;
+}
+
+void MQTTSNInflightWindow::update(MQTTSNInflightMsg * inflight, uint8_t awaiting, uint32_t now)
+{
+    inflight->awaiting = awaiting;
+    inflight->sent_at = now;
+    inflight->retries = 0;
+}
+
+bool MQTTSNInflightWindow::remove(uint16_t msg_id)
+{
+    MQTTSNInflightMsg * inflight = find(msg_id);
+    if (inflight == NULL)
+        return false;
+
+    inflight->msg_id = 0;
+    msgs_cnt--;
+    return true;
+}
+
+MQTTSNInflightMsg * MQTTSNInflightWindow::find(uint16_t msg_id)
+{
+    if (msg_id == 0 || msgs_cnt == 0)
+        return NULL;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        if (msgs[i].msg_id == msg_id)
+            return &msgs[i];
+    }
+
+    return NULL;
+}
+
+MQTTSNInflightMsg * MQTTSNInflightWindow::oldest(void)
+{
+    MQTTSNInflightMsg * found = NULL;
+    if (msgs_cnt == 0)
+        return NULL;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        MQTTSNInflightMsg * inflight = &msgs[i];
+        if (inflight->msg_id == 0)
+            continue;
+
+        if (found == NULL || (int32_t)(inflight->sent_at - found->sent_at) < 0)
+            found = inflight;
+    }
+
+    return found;
+}
+
+bool MQTTSNInflightWindow::retry(MQTTSNInflightMsg * inflight, uint32_t now)
+{
+    if (++inflight->retries > MQTTSN_N_RETRY)
+        return false;
+
+    inflight->sent_at = now;
+    return true;
+}
+
+void MQTTSNInflightWindow::clear(void)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        msgs[i].msg_id = 0;
+    }
+    msgs_cnt = 0;
+}
+
+uint8_t MQTTSNInflightWindow::count(void) const
+{
+    return msgs_cnt;
+}
+
+bool MQTTSNInflightWindow::full(void) const
+{
+    return msgs_cnt == MQTTSN_MAX_INFLIGHT_MSGS;
+}
+
+/**************** MQTTSNInflightCopies ***************/
+
+MQTTSNInflightMsg * MQTTSNInflightCopies::add(uint16_t msg_id, uint8_t awaiting, const uint8_t * msg, uint16_t msg_len, uint32_t now)
+{
+    if (msg_len > MQTTSN_MAX_MSG_LEN)
+        return NULL;
+    
+    MQTTSNInflightMsg * inflight = MQTTSNInflightWindow::add(msg_id, awaiting, now);
+    if (inflight == NULL)
+        return NULL;
+    
+    update(inflight, awaiting, msg, msg_len, now);
+    return inflight;
+}
+
+void MQTTSNInflightCopies::update(MQTTSNInflightMsg * inflight, uint8_t awaiting, const uint8_t * msg, uint16_t msg_len, uint32_t now)
+{
+    MQTTSNInflightWindow::update(inflight, awaiting, now);
+    
+    uint8_t slot = inflight - msgs;
+    memcpy(copies[slot], msg, msg_len);
+    copy_lens[slot] = msg_len;
+}
+
+bool MQTTSNInflightCopies::retry(MQTTSNInflightMsg * inflight, uint32_t now)
+{
+    if (!MQTTSNInflightWindow::retry(inflight, now))
+        return false;
+    
+    /* set the DUP flag of a PUBLISH, it comes right after the header */
+    uint8_t * msg = data(inflight);
+    uint16_t msg_len = length(inflight);
+    
+    MQTTSNHeader header;
+    uint16_t offset = header.unpack(msg, msg_len);
+    if (offset != 0 && offset < msg_len && header.msg_type == MQTTSN_PUBLISH) {
+        MQTTSNFlags flags;
+        flags.all = msg[offset];
+        flags.dup = 1;
+        msg[offset] = flags.all;
+    }
+    
+    return true;
+}
+
+uint8_t * MQTTSNInflightCopies::data(MQTTSNInflightMsg * inflight)
+{
+    return copies[inflight - msgs];
+}
+
+uint16_t MQTTSNInflightCopies::length(MQTTSNInflightMsg * inflight) const
+{
+    return copy_lens[inflight - msgs];
+}
+
+/**************** MQTTSNMsgIdSet ***************/
+
+MQTTSNMsgIdSet::MQTTSNMsgIdSet(void)
+{
+    clear();
+}
+
+bool MQTTSNMsgIdSet::contains(uint16_t msg_id) const
+{
+    if (msg_id == 0)
+        return false;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        if (ids[i] == msg_id)
+            return true;
+    }
+
+    return false;
+}
+
+bool MQTTSNMsgIdSet::add(uint16_t msg_id)
+{
+    if (msg_id == 0)
+        return false;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        if (ids[i] == 0) {
+            ids[i] = msg_id;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MQTTSNMsgIdSet::remove(uint16_t msg_id)
+{
+    if (msg_id == 0)
+        return;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        if (ids[i] == msg_id)
+            ids[i] = 0;
+    }
+}
+
+bool MQTTSNMsgIdSet::full(void) const
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        if (ids[i] == 0)
+            return false;
+    }
+
+    return true;
+}
+
+void MQTTSNMsgIdSet::clear(void)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT_MSGS; i++) {
+        ids[i] = 0;
+    }
+}
+
+/**************** MQTTSNMsgIdHistory ***************/
+
+MQTTSNMsgIdHistory::MQTTSNMsgIdHistory(void) : pos(0)
+{
+    clear();
+}
+
+bool MQTTSNMsgIdHistory::seen(uint16_t msg_id) const
+{
+    if (msg_id == 0)
+        return false;
+
+    for (uint8_t i = 0; i < MQTTSN_MAX_RECENT_MSG_IDS; i++) {
+        if (ids[i] == msg_id)
+            return true;
+    }
+
+    return false;
+}
+
+void MQTTSNMsgIdHistory::add(uint16_t msg_id)
+{
+    ids[pos] = msg_id;
+    pos = (pos + 1) % MQTTSN_MAX_RECENT_MSG_IDS;
+}
+
+void MQTTSNMsgIdHistory::clear(void)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_RECENT_MSG_IDS; i++) {
+        ids[i] = 0;
+    }
+    pos = 0;
+}
@@ -0,0 +1,127 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_INFLIGHT_H_
+#define MQTTSN_INFLIGHT_H_
+
+#include "mqttsn_defines.h"
+#include "mqttsn_message_pool.h"
+#include <stdint.h>
+
+/* a sent msg awaiting acknowledgement */
+typedef struct {
+    /* 0 if the slot is free */
+    uint16_t msg_id;
+    
+    /* type of the reply we're waiting on: PUBACK, PUBREC, PUBCOMP or REGACK */
+    uint8_t awaiting;
+    
+    /* what the gateway needs to pack the msg again for a retry, rather than keep a copy of it:
+       the pooled PUBLISH with the QoS and topic ID type it went out with, or the topic of a REGISTER */
+    MQTTSNPoolHandle msg;
+    uint16_t topic_id;
+    uint8_t qos;
+    uint8_t topicid_type;
+
+    /* when it was last (re)sent, and how many times it's been re-sent */
+    uint32_t sent_at;
+    uint8_t retries;
+} MQTTSNInflightMsg;
+
+/* Window of QoS 1 and 2 PUBLISHes sent to a peer and not yet acknowledged,
+ * so several can be outstanding at once. Each is kept until its PUBACK (or PUBCOMP) arrives,
+ * or until it's been re-sent MQTTSN_N_RETRY times.
+ * For QoS 2, the PUBLISH is swapped for a PUBREL once the PUBREC arrives.
+ * Only the msg's ID and state are kept, the owner fills in how to rebuild it */
+class MQTTSNInflightWindow {
+    public:
+    MQTTSNInflightWindow(void);
+
+    /* note a msg that was just sent, NULL if the window is full */
+    MQTTSNInflightMsg * add(uint16_t msg_id, uint8_t awaiting, uint32_t now);
+    
+    /* move on to the next step of a handshake, as its msg was just sent */
+    void update(MQTTSNInflightMsg * inflight, uint8_t awaiting, uint32_t now);
+
+    /* drop a msg once it's acked, returns false if we weren't waiting on it */
+    bool remove(uint16_t msg_id);
+
+    MQTTSNInflightMsg * find(uint16_t msg_id);
+
+    /* the msg that's been waiting longest i.e. the next one due for a retry, NULL if there's none */
+    MQTTSNInflightMsg * oldest(void);
+
+    /* note that a msg is about to be re-sent, returns false if it's out of retries */
+    bool retry(MQTTSNInflightMsg * inflight, uint32_t now);
+
+    void clear(void);
+
+    uint8_t count(void) const;
+    bool full(void) const;
+
+    protected:
+    MQTTSNInflightMsg msgs[MQTTSN_MAX_INFLIGHT_MSGS];
+    uint8_t msgs_cnt;
+};
+
+/* The client's window, which keeps a copy of each msg to resend it as it is */
+class MQTTSNInflightCopies : public MQTTSNInflightWindow {
+    public:
+    /* keep a copy of a msg that was just sent, NULL if the window is full */
+    MQTTSNInflightMsg * add(uint16_t msg_id, uint8_t awaiting, const uint8_t * msg, uint16_t msg_len, uint32_t now);
+    
+    /* move on to the next step of a handshake, with the msg that was just sent for it */
+    void update(MQTTSNInflightMsg * inflight, uint8_t awaiting, const uint8_t * msg, uint16_t msg_len, uint32_t now);
+    
+    /* as above, also setting DUP on PUBLISHes */
+    bool retry(MQTTSNInflightMsg * inflight, uint32_t now);
+    
+    /* the copy of a msg */
+    uint8_t * data(MQTTSNInflightMsg * inflight);
+    uint16_t length(MQTTSNInflightMsg * inflight) const;
+    
+    private:
+    uint8_t copies[MQTTSN_MAX_INFLIGHT_MSGS][MQTTSN_MAX_MSG_LEN];
+    uint16_t copy_lens[MQTTSN_MAX_INFLIGHT_MSGS];
+};
+
+/* Set of the IDs of QoS 2 PUBLISHes received from a peer that we've sent PUBREC for,
+ * and are now waiting on the PUBREL. While an ID is in here, any copy of its PUBLISH is a duplicate */
+class MQTTSNMsgIdSet {
+    public:
+    MQTTSNMsgIdSet(void);
+
+    bool contains(uint16_t msg_id) const;
+
+    /* returns false if there's no room */
+    bool add(uint16_t msg_id);
+    void remove(uint16_t msg_id);
+    bool full(void) const;
+
+    void clear(void);
+
+    private:
+    /* 0 is never a valid msg ID so it marks an empty slot */
+    uint16_t ids[MQTTSN_MAX_INFLIGHT_MSGS];
+};
+
+/* Ring of the IDs of the last few QoS 1 PUBLISHes received from a peer,
+ * used to spot re-sent copies of msgs we've already delivered */
+class MQTTSNMsgIdHistory {
+    public:
+    MQTTSNMsgIdHistory(void);
+
+    bool seen(uint16_t msg_id) const;
+
+    /* remember an ID, forgetting the oldest one if we're full */
+    void add(uint16_t msg_id);
+
+    void clear(void);
+
+    private:
+    /* 0 is never a valid msg ID so it marks an empty slot */
+    uint16_t ids[MQTTSN_MAX_RECENT_MSG_IDS];
+    uint8_t pos;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_message_pool.h"
+#include "mqttsn_defines.h"
+
+#include <stdint.h>
+#include <string.h>
+
+MQTTSNMessagePool::MQTTSNMessagePool(void) : bufs(NULL), lens(NULL), refs(NULL), free_slots(NULL), free_cnt(0)
+{
+
+}
+
+void MQTTSNMessagePool::set_storage(void * storage, uint16_t capacity)
+{
+    /* the 16-bit arrays go first, so they stay aligned */
+    lens = (uint16_t *)storage;
+    refs = lens + capacity;
+    free_slots = (MQTTSNPoolHandle *)(refs + capacity);
+    bufs = (uint8_t *)(free_slots + capacity);
+    
+    for (uint16_t i = 0; i < capacity; i++) {
+        free_slots[i] = capacity - 1 - i;
+        lens[i] = 0;
+        refs[i] = 0;
+    }
+    free_cnt = capacity;
+}
+
+MQTTSNPoolHandle MQTTSNMessagePool::alloc(const uint8_t * data, uint16_t len)
+{
+    if (free_cnt == 0 || len > MQTTSN_MAX_MSG_LEN)
+        return MQTTSN_POOL_NONE;
+
+    MQTTSNPoolHandle handle = free_slots[--free_cnt];
+    memcpy(bufs + (uint32_t)handle * MQTTSN_MAX_MSG_LEN, data, len);
+    lens[handle] = len;
+    refs[handle] = 1;
+    return handle;
+}
+
+MQTTSNPoolHandle MQTTSNMessagePool::alloc(void)
+{
+    if (free_cnt == 0)
+        return MQTTSN_POOL_NONE;
+
+    MQTTSNPoolHandle handle = free_slots[--free_cnt];
+    lens[handle] = 0;
+    refs[handle] = 1;
+    return handle;
+}
+
+void MQTTSNMessagePool::set_length(MQTTSNPoolHandle handle, uint16_t len)
+{
+    lens[handle] = len;
+}
+
+void MQTTSNMessagePool::retain(MQTTSNPoolHandle handle)
+{
+    refs[handle]++;
+}
+
+void MQTTSNMessagePool::release(MQTTSNPoolHandle handle)
+{
+    if (refs[handle] == 0 || --refs[handle] != 0)
+        return;
+
+    free_slots[free_cnt++] = handle;
+}
+
+uint8_t * MQTTSNMessagePool::data(MQTTSNPoolHandle handle)
+{
+    return bufs + (uint32_t)handle * MQTTSN_MAX_MSG_LEN;
+}
+
+uint16_t MQTTSNMessagePool::length(MQTTSNPoolHandle handle) const
+{
+    return lens[handle];
+}
+
+uint16_t MQTTSNMessagePool::ref_count(MQTTSNPoolHandle handle) const
+{
+    return refs[handle];
+}
+
+uint16_t MQTTSNMessagePool::available(void) const
+{
+    return free_cnt;
+}
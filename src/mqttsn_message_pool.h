@@ -0,0 +1,64 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_MESSAGE_POOL_H_
+#define MQTTSN_MESSAGE_POOL_H_
+
+#include "mqttsn_defines.h"
+#include <stdint.h>
+
+typedef uint16_t MQTTSNPoolHandle;
+
+/* returned when the pool is out of space */
+#define MQTTSN_POOL_NONE                0xFFFF
+
+static_assert(MQTTSN_MAX_POOLED_MSGS < MQTTSN_POOL_NONE, "Too many pooled messages");
+
+/* Reference-counted store for packed messages, shared by every client of the gateway.
+ * A message is held once no matter how many clients have it queued,
+ * and its slot is freed when the last of them releases it */
+class MQTTSNMessagePool {
+    public:
+    MQTTSNMessagePool(void);
+
+    /* hand the pool storage_size(capacity) bytes to hold 'capacity' msgs in, before anything else.
+       The storage must be aligned for uint16_t */
+    void set_storage(void * storage, uint16_t capacity);
+    static constexpr uint32_t storage_size(uint16_t capacity)
+    {
+        return (uint32_t)capacity * (MQTTSN_MAX_MSG_LEN + 2 * sizeof(uint16_t) + sizeof(MQTTSNPoolHandle));
+    }
+
+    /* copy a message in with a single reference, returns MQTTSN_POOL_NONE if there's no room */
+    MQTTSNPoolHandle alloc(const uint8_t * data, uint16_t len);
+
+    /* take a free slot with a single reference, for a msg to be packed straight into it,
+       its length is set once it's in. Returns MQTTSN_POOL_NONE if there's no room */
+    MQTTSNPoolHandle alloc(void);
+    void set_length(MQTTSNPoolHandle handle, uint16_t len);
+
+    /* add and drop references, the last release frees the slot */
+    void retain(MQTTSNPoolHandle handle);
+    void release(MQTTSNPoolHandle handle);
+
+    uint8_t * data(MQTTSNPoolHandle handle);
+    uint16_t length(MQTTSNPoolHandle handle) const;
+
+    /* number of references held to a msg */
+    uint16_t ref_count(MQTTSNPoolHandle handle) const;
+
+    /* number of free slots */
+    uint16_t available(void) const;
+
+    private:
+    /* MQTTSN_MAX_MSG_LEN bytes for each slot, then its length and reference count */
+    uint8_t * bufs;
+    uint16_t * lens;
+    uint16_t * refs;
+
+    /* stack of free slots */
+    MQTTSNPoolHandle * free_slots;
+    uint16_t free_cnt;
+};
+
+#endif
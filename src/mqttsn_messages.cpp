@@ -14,40 +14,59 @@ MQTTSNHeader::MQTTSNHeader(uint8_t msg_type) : msg_type(msg_type), length(0)
 
 }
 
-uint8_t MQTTSNHeader::pack(uint8_t * buffer, uint8_t buflen, uint8_t datalen)
+uint16_t MQTTSNHeader::pack(uint8_t * buffer, uint16_t buflen, uint16_t datalen)
 {
-    length = datalen + MQTTSN_HEADER_LEN;
+    /* the length byte can only count up to 255, past that it's 0x01 and then 2 bytes of length */
+    if (datalen + MQTTSN_HEADER_LEN <= 0xFF)
+        length = datalen + MQTTSN_HEADER_LEN;
+    else if (datalen <= 0xFFFF - MQTTSN_LONG_HEADER_LEN)
+        length = datalen + MQTTSN_LONG_HEADER_LEN;
+    else
+        return 0;
     
     /* check that the buffer is big enough */
     if (buflen < length) {
         return 0;
     }
     
-    /* max msg size for now is 255 */
-    if (length < 256) {
+    if (length <= 0xFF) {
         buffer[0] = length;
         buffer[1] = msg_type;
         return MQTTSN_HEADER_LEN;
     }
     
-    return 0;
+    buffer[0] = 0x01;
+    buffer[1] = length >> 8;
+    buffer[2] = length & 0xff;
+    buffer[3] = msg_type;
+    return MQTTSN_LONG_HEADER_LEN;
 }
 
-uint8_t MQTTSNHeader::unpack(uint8_t * buffer, uint8_t buflen)
+uint16_t MQTTSNHeader::unpack(uint8_t * buffer, uint16_t buflen)
 {
     /* check that we have enough to parse */
     if (buflen < MQTTSN_HEADER_LEN || buffer[0] == 0) {
         return 0;
     }
     
-    /* multi-byte length (> 255) not supported */
-    if (buffer[0] == 1) {
+    if (buffer[0] != 0x01) {
+        length = buffer[0];
+        msg_type = buffer[1];
+        return MQTTSN_HEADER_LEN;
+    }
+    
+    /* multi-byte length, which must really need it */
+    if (buflen < MQTTSN_LONG_HEADER_LEN) {
+        return 0;
+    }
+    
+    length = ((uint16_t)buffer[1] << 8) | buffer[2];
+    if (length < MQTTSN_LONG_HEADER_LEN) {
         return 0;
     }
     
-    length = buffer[0];
-    msg_type = buffer[1];
-    return MQTTSN_HEADER_LEN;
+    msg_type = buffer[3];
+    return MQTTSN_LONG_HEADER_LEN;
 }
 
 /**************** MQTTSNFlags ***************/
@@ -84,10 +103,10 @@ MQTTSNMessageAdvertise::MQTTSNMessageAdvertise(uint8_t gw_id) : gw_id(gw_id), du
     
 }
 
-uint8_t MQTTSNMessageAdvertise::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageAdvertise::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_ADVERTISE;
-    uint8_t offset = header.pack(buffer, buflen, 3);
+    uint16_t offset = header.pack(buffer, buflen, 3);
     if (!offset) {
         return 0;
     }
@@ -98,7 +117,7 @@ uint8_t MQTTSNMessageAdvertise::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageAdvertise::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageAdvertise::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect exactly 3 bytes */
     uint8_t fixed_len = 1 + 2;
@@ -118,10 +137,10 @@ MQTTSNMessageSearchGW::MQTTSNMessageSearchGW(uint8_t radius) : radius(radius)
     
 }
 
-uint8_t MQTTSNMessageSearchGW::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSearchGW::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_SEARCHGW;
-    uint8_t offset = header.pack(buffer, buflen, 1);
+    uint16_t offset = header.pack(buffer, buflen, 1);
     if (!offset) {
         return 0;
     }
@@ -130,7 +149,7 @@ uint8_t MQTTSNMessageSearchGW::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageSearchGW::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSearchGW::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 1 byte */
     if (buflen != 1) {
@@ -149,10 +168,10 @@ MQTTSNMessageGWInfo::MQTTSNMessageGWInfo(uint8_t gw_id) :
     
 }
 
-uint8_t MQTTSNMessageGWInfo::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageGWInfo::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_GWINFO;
-    uint8_t offset = header.pack(buffer, buflen, 1 + gw_addr_len);
+    uint16_t offset = header.pack(buffer, buflen, 1 + gw_addr_len);
     if (!offset) {
         return 0;
     }
@@ -167,11 +186,11 @@ uint8_t MQTTSNMessageGWInfo::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageGWInfo::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageGWInfo::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 1 byte at least */
     uint8_t fixed_len = 1;
-    if (buflen < fixed_len) {
+    if (buflen < fixed_len || buflen > fixed_len + 0xFF) {
         return 0;
     }
     
@@ -189,10 +208,10 @@ MQTTSNMessageConnect::MQTTSNMessageConnect(uint16_t duration) :
     flags.all = 0;
 }
 
-uint8_t MQTTSNMessageConnect::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageConnect::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_CONNECT;
-    uint8_t offset = header.pack(buffer, buflen, 1 + 1 + 2 + client_id_len);
+    uint16_t offset = header.pack(buffer, buflen, 1 + 1 + 2 + client_id_len);
     if (!offset) {
         return 0;
     }
@@ -208,11 +227,11 @@ uint8_t MQTTSNMessageConnect::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageConnect::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageConnect::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 5 bytes at least, client ID is not optional */
     uint8_t fixed_len = 1 + 1 + 2;
-    if (buflen < fixed_len + 1) {
+    if (buflen < fixed_len + 1 || buflen > fixed_len + 0xFF) {
         return 0;
     }
     
@@ -232,10 +251,10 @@ MQTTSNMessageConnack::MQTTSNMessageConnack(uint8_t return_code) : return_code(re
     
 }
 
-uint8_t MQTTSNMessageConnack::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageConnack::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_CONNACK;
-    uint8_t offset = header.pack(buffer, buflen, 1);
+    uint16_t offset = header.pack(buffer, buflen, 1);
     if (!offset) {
         return 0;
     }
@@ -244,7 +263,7 @@ uint8_t MQTTSNMessageConnack::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageConnack::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageConnack::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 1 byte */
     if (buflen != 1) {
@@ -263,10 +282,10 @@ MQTTSNMessageRegister::MQTTSNMessageRegister(uint16_t topic_id) :
     
 }
 
-uint8_t MQTTSNMessageRegister::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageRegister::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_REGISTER;
-    uint8_t offset = header.pack(buffer, buflen, 2 + 2 + topic_name_len);
+    uint16_t offset = header.pack(buffer, buflen, 2 + 2 + topic_name_len);
     if (!offset) {
         return 0;
     }
@@ -282,11 +301,11 @@ uint8_t MQTTSNMessageRegister::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageRegister::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageRegister::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 5 bytes at least, topic name is not optional */
     uint8_t fixed_len = 2 + 2;
-    if (buflen < fixed_len + 1) {
+    if (buflen < fixed_len + 1 || buflen > fixed_len + 0xFF) {
         return 0;
     }
     
@@ -306,10 +325,10 @@ MQTTSNMessageRegack::MQTTSNMessageRegack(uint8_t return_code) :
     
 }
 
-uint8_t MQTTSNMessageRegack::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageRegack::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_REGACK;
-    uint8_t offset = header.pack(buffer, buflen, 2 + 2 + 1);
+    uint16_t offset = header.pack(buffer, buflen, 2 + 2 + 1);
     if (!offset) {
         return 0;
     }
@@ -324,7 +343,7 @@ uint8_t MQTTSNMessageRegack::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageRegack::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageRegack::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 5 bytes at least, topic name is not optional */
     uint8_t fixed_len = 2 + 2 + 1;
@@ -347,10 +366,10 @@ MQTTSNMessagePublish::MQTTSNMessagePublish(uint16_t msg_id) :
     flags.all = 0;
 }
 
-uint8_t MQTTSNMessagePublish::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePublish::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_PUBLISH;
-    uint8_t offset = header.pack(buffer, buflen, 1 + 2 + 2 + data_len);
+    uint16_t offset = header.pack(buffer, buflen, 1 + 2 + 2 + data_len);
     if (!offset) {
         return 0;
     }
@@ -367,7 +386,7 @@ uint8_t MQTTSNMessagePublish::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessagePublish::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePublish::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 5 bytes at least, payload is optional */
     uint8_t fixed_len = 1 + 2 + 2;
@@ -392,10 +411,10 @@ MQTTSNMessagePuback::MQTTSNMessagePuback(uint8_t return_code) :
     
 }
 
-uint8_t MQTTSNMessagePuback::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePuback::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_PUBACK;
-    uint8_t offset = header.pack(buffer, buflen, 2 + 2 + 1);
+    uint16_t offset = header.pack(buffer, buflen, 2 + 2 + 1);
     if (!offset) {
         return 0;
     }
@@ -410,7 +429,7 @@ uint8_t MQTTSNMessagePuback::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessagePuback::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePuback::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 5 bytes at least, topic name is not optional */
     uint8_t fixed_len = 2 + 2 + 1;
@@ -425,6 +444,108 @@ uint8_t MQTTSNMessagePuback::unpack(uint8_t * buffer, uint8_t buflen)
     return buflen;
 }
 
+/**************** MQTTSNMessagePubrec ***************/
+
+MQTTSNMessagePubrec::MQTTSNMessagePubrec(void) : msg_id(0)
+{
+    
+}
+
+uint16_t MQTTSNMessagePubrec::pack(uint8_t * buffer, uint16_t buflen) 
+{
+    header.msg_type = MQTTSN_PUBREC;
+    uint16_t offset = header.pack(buffer, buflen, 2);
+    if (!offset) {
+        return 0;
+    }
+    
+    /* fill in the message content */
+    buffer[offset++] = msg_id >> 8;
+    buffer[offset++] = msg_id & 0xff;
+    
+    return offset;
+}
+
+uint16_t MQTTSNMessagePubrec::unpack(uint8_t * buffer, uint16_t buflen) 
+{
+    /* we expect exactly 2 bytes */
+    uint8_t fixed_len = 2;
+    if (buflen != fixed_len) {
+        return 0;
+    }
+    
+    msg_id = ((uint16_t)buffer[0] << 8) | buffer[1];
+    return buflen;
+}
+
+/**************** MQTTSNMessagePubrel ***************/
+
+MQTTSNMessagePubrel::MQTTSNMessagePubrel(void) : msg_id(0)
+{
+    
+}
+
+uint16_t MQTTSNMessagePubrel::pack(uint8_t * buffer, uint16_t buflen) 
+{
+    header.msg_type = MQTTSN_PUBREL;
+    uint16_t offset = header.pack(buffer, buflen, 2);
+    if (!offset) {
+        return 0;
+    }
+    
+    /* fill in the message content */
+    buffer[offset++] = msg_id >> 8;
+    buffer[offset++] = msg_id & 0xff;
+    
+    return offset;
+}
+
+uint16_t MQTTSNMessagePubrel::unpack(uint8_t * buffer, uint16_t buflen) 
+{
+    /* we expect exactly 2 bytes */
+    uint8_t fixed_len = 2;
+    if (buflen != fixed_len) {
+        return 0;
+    }
+    
+    msg_id = ((uint16_t)buffer[0] << 8) | buffer[1];
+    return buflen;
+}
+
+/**************** MQTTSNMessagePubcomp ***************/
+
+MQTTSNMessagePubcomp::MQTTSNMessagePubcomp(void) : msg_id(0)
+{
+    
+}
+
+uint16_t MQTTSNMessagePubcomp::pack(uint8_t * buffer, uint16_t buflen) 
+{
+    header.msg_type = MQTTSN_PUBCOMP;
+    uint16_t offset = header.pack(buffer, buflen, 2);
+    if (!offset) {
+        return 0;
+    }
+    
+    /* fill in the message content */
+    buffer[offset++] = msg_id >> 8;
+    buffer[offset++] = msg_id & 0xff;
+    
+    return offset;
+}
+
+uint16_t MQTTSNMessagePubcomp::unpack(uint8_t * buffer, uint16_t buflen) 
+{
+    /* we expect exactly 2 bytes */
+    uint8_t fixed_len = 2;
+    if (buflen != fixed_len) {
+        return 0;
+    }
+    
+    msg_id = ((uint16_t)buffer[0] << 8) | buffer[1];
+    return buflen;
+}
+
 /**************** MQTTSNMessageSubscribe ***************/
 
 MQTTSNMessageSubscribe::MQTTSNMessageSubscribe(void) : 
@@ -433,10 +554,10 @@ MQTTSNMessageSubscribe::MQTTSNMessageSubscribe(void) :
     flags.all = 0;
 }
 
-uint8_t MQTTSNMessageSubscribe::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSubscribe::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_SUBSCRIBE;
-    uint8_t offset = header.pack(buffer, buflen, 1 + 2 + topic_name_len);
+    uint16_t offset = header.pack(buffer, buflen, 1 + 2 + topic_name_len);
     if (!offset) {
         return 0;
     }
@@ -451,11 +572,11 @@ uint8_t MQTTSNMessageSubscribe::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageSubscribe::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSubscribe::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 4 bytes at least, topic name/ID is not optional */
     uint8_t fixed_len = 1 + 2;
-    if (buflen < fixed_len + 1) {
+    if (buflen < fixed_len + 1 || buflen > fixed_len + 0xFF) {
         return 0;
     }
     
@@ -475,10 +596,10 @@ MQTTSNMessageUnsubscribe::MQTTSNMessageUnsubscribe(void) :
     flags.all = 0;
 }
 
-uint8_t MQTTSNMessageUnsubscribe::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageUnsubscribe::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_UNSUBSCRIBE;
-    uint8_t offset = header.pack(buffer, buflen, 1 + 2 + topic_name_len);
+    uint16_t offset = header.pack(buffer, buflen, 1 + 2 + topic_name_len);
     if (!offset) {
         return 0;
     }
@@ -493,11 +614,11 @@ uint8_t MQTTSNMessageUnsubscribe::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageUnsubscribe::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageUnsubscribe::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect 4 bytes at least, topic name/ID is not optional */
     uint8_t fixed_len = 1 + 2;
-    if (buflen < fixed_len + 1) {
+    if (buflen < fixed_len + 1 || buflen > fixed_len + 0xFF) {
         return 0;
     }
     
@@ -517,10 +638,10 @@ MQTTSNMessageSuback::MQTTSNMessageSuback(uint8_t return_code) :
     flags.all = 0;
 }
 
-uint8_t MQTTSNMessageSuback::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSuback::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_SUBACK;
-    uint8_t offset = header.pack(buffer, buflen, 1 + 2 + 2 + 1);
+    uint16_t offset = header.pack(buffer, buflen, 1 + 2 + 2 + 1);
     if (!offset) {
         return 0;
     }
@@ -536,7 +657,7 @@ uint8_t MQTTSNMessageSuback::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageSuback::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageSuback::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect exactly 6 bytes */
     uint8_t fixed_len = 1 + 2 + 2 + 1;
@@ -559,10 +680,10 @@ MQTTSNMessageUnsuback::MQTTSNMessageUnsuback(void) : msg_id(0)
     
 }
 
-uint8_t MQTTSNMessageUnsuback::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageUnsuback::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_UNSUBACK;
-    uint8_t offset = header.pack(buffer, buflen, 2);
+    uint16_t offset = header.pack(buffer, buflen, 2);
     if (!offset) {
         return 0;
     }
@@ -574,7 +695,7 @@ uint8_t MQTTSNMessageUnsuback::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageUnsuback::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageUnsuback::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect exactly 2 bytes */
     uint8_t fixed_len = 2;
@@ -595,10 +716,10 @@ MQTTSNMessagePingreq::MQTTSNMessagePingreq(void) :
     
 }
 
-uint8_t MQTTSNMessagePingreq::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePingreq::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_PINGREQ;
-    uint8_t offset = header.pack(buffer, buflen, client_id_len);
+    uint16_t offset = header.pack(buffer, buflen, client_id_len);
     if (!offset) {
         return 0;
     }
@@ -613,10 +734,10 @@ uint8_t MQTTSNMessagePingreq::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessagePingreq::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePingreq::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* empty payload should not be passed, client ID must be present */
-    if (buflen == 0) {
+    if (buflen == 0 || buflen > 0xFF) {
         return 0;
     }
     
@@ -634,10 +755,10 @@ MQTTSNMessagePingresp::MQTTSNMessagePingresp(void)
     
 }
 
-uint8_t MQTTSNMessagePingresp::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePingresp::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_PINGRESP;
-    uint8_t offset = header.pack(buffer, buflen);
+    uint16_t offset = header.pack(buffer, buflen);
     if (!offset) {
         return 0;
     }
@@ -645,7 +766,7 @@ uint8_t MQTTSNMessagePingresp::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessagePingresp::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessagePingresp::unpack(uint8_t * buffer, uint16_t buflen) 
 {    
     return 0;
 }
@@ -657,10 +778,10 @@ MQTTSNMessageDisconnect::MQTTSNMessageDisconnect(void) : duration(0)
     
 }
 
-uint8_t MQTTSNMessageDisconnect::pack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageDisconnect::pack(uint8_t * buffer, uint16_t buflen) 
 {
     header.msg_type = MQTTSN_DISCONNECT;
-    uint8_t offset = header.pack(buffer, buflen, duration ? 2 : 0);
+    uint16_t offset = header.pack(buffer, buflen, duration ? 2 : 0);
     if (!offset) {
         return 0;
     }
@@ -674,7 +795,7 @@ uint8_t MQTTSNMessageDisconnect::pack(uint8_t * buffer, uint8_t buflen)
     return offset;
 }
 
-uint8_t MQTTSNMessageDisconnect::unpack(uint8_t * buffer, uint8_t buflen) 
+uint16_t MQTTSNMessageDisconnect::unpack(uint8_t * buffer, uint16_t buflen) 
 {
     /* we expect exactly 2 bytes */
     if (buflen != 2) {
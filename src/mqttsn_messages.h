@@ -7,6 +7,9 @@
 #include "mqttsn_defines.h"
 #include <stdint.h>
 
+/* lengths are 16-bit throughout */
+static_assert(MQTTSN_MAX_MSG_LEN <= 0xFFFF, "MQTTSN_MAX_MSG_LEN can't be more than 65535");
+
 /* message types */
 enum {
     MQTTSN_ADVERTISE,
@@ -47,6 +50,13 @@ enum {
     MQTTSN_TOPIC_SHORTNAME
 };
 
+/* short topic names have exactly 2 chars, and are sent in place of a topic ID */
+#define MQTTSN_SHORT_TOPICNAME_LEN      2
+#define MQTTSN_SHORT_TOPIC_ID(name)     (((uint16_t)(uint8_t)(name)[0] << 8) | (uint8_t)(name)[1])
+
+/* QoS field value of a QoS -1 PUBLISH, which is sent without a connection */
+#define MQTTSN_QOS_NOCONNECT            3
+
 /* return codes */
 enum {
     MQTTSN_RC_ACCEPTED,
@@ -59,10 +69,11 @@ enum {
 class MQTTSNHeader {
     public:
     MQTTSNHeader(uint8_t msg_type = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen, uint8_t datalen = 0);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen, uint16_t datalen = 0);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
-    uint8_t msg_type, length;
+    uint8_t msg_type;
+    uint16_t length;
 };
 
 /* flags */
@@ -93,8 +104,8 @@ typedef struct {
 /* messages */
 class MQTTSNMessage {
     public:
-    uint8_t pack(uint8_t * buffer, uint8_t buflen) { return 0; }
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen) { return 0; }
+    uint16_t pack(uint8_t * buffer, uint16_t buflen) { return 0; }
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen) { return 0; }
     
     MQTTSNHeader header;
 };
@@ -102,8 +113,8 @@ class MQTTSNMessage {
 class MQTTSNMessageAdvertise : public MQTTSNMessage {
     public:
     MQTTSNMessageAdvertise(uint8_t gw_id = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint8_t gw_id;
     uint16_t duration;
@@ -112,8 +123,8 @@ class MQTTSNMessageAdvertise : public MQTTSNMessage {
 class MQTTSNMessageSearchGW : public MQTTSNMessage {
     public:
     MQTTSNMessageSearchGW(uint8_t radius = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint8_t radius;
 };
@@ -121,8 +132,8 @@ class MQTTSNMessageSearchGW : public MQTTSNMessage {
 class MQTTSNMessageGWInfo : public MQTTSNMessage {
     public:
     MQTTSNMessageGWInfo(uint8_t gw_id = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint8_t gw_id;
     uint8_t * gw_addr;
@@ -132,8 +143,8 @@ class MQTTSNMessageGWInfo : public MQTTSNMessage {
 class MQTTSNMessageConnect : public MQTTSNMessage {
     public:
     MQTTSNMessageConnect(uint16_t duration = MQTTSN_DEFAULT_KEEPALIVE);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     MQTTSNFlags flags;
     uint8_t protocol_id;
@@ -145,8 +156,8 @@ class MQTTSNMessageConnect : public MQTTSNMessage {
 class MQTTSNMessageConnack : public MQTTSNMessage {
     public:
     MQTTSNMessageConnack(uint8_t return_code = MQTTSN_RC_ACCEPTED);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint8_t return_code;
 };
@@ -154,8 +165,8 @@ class MQTTSNMessageConnack : public MQTTSNMessage {
 class MQTTSNMessageRegister : public MQTTSNMessage {
     public:
     MQTTSNMessageRegister(uint16_t topic_id = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t topic_id;
     uint16_t msg_id;
@@ -166,8 +177,8 @@ class MQTTSNMessageRegister : public MQTTSNMessage {
 class MQTTSNMessageRegack : public MQTTSNMessage {
     public:
     MQTTSNMessageRegack(uint8_t return_code = MQTTSN_RC_ACCEPTED);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t topic_id;
     uint16_t msg_id;
@@ -177,32 +188,59 @@ class MQTTSNMessageRegack : public MQTTSNMessage {
 class MQTTSNMessagePublish : public MQTTSNMessage {
     public:
     MQTTSNMessagePublish(uint16_t msg_id = 0);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t topic_id;
     uint16_t msg_id;
     MQTTSNFlags flags;
     uint8_t * data;
-    uint8_t data_len;
+    uint16_t data_len;
 };
 
 class MQTTSNMessagePuback : public MQTTSNMessage {
     public:
     MQTTSNMessagePuback(uint8_t return_code = MQTTSN_RC_ACCEPTED);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t topic_id;
     uint16_t msg_id;
     uint8_t return_code;
 };
 
+class MQTTSNMessagePubrec : public MQTTSNMessage {
+    public:
+    MQTTSNMessagePubrec(void);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
+    
+    uint16_t msg_id;
+};
+
+class MQTTSNMessagePubrel : public MQTTSNMessage {
+    public:
+    MQTTSNMessagePubrel(void);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
+    
+    uint16_t msg_id;
+};
+
+class MQTTSNMessagePubcomp : public MQTTSNMessage {
+    public:
+    MQTTSNMessagePubcomp(void);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
+    
+    uint16_t msg_id;
+};
+
 class MQTTSNMessageSubscribe : public MQTTSNMessage {
     public:
     MQTTSNMessageSubscribe(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t msg_id;
     MQTTSNFlags flags;
@@ -213,8 +251,8 @@ class MQTTSNMessageSubscribe : public MQTTSNMessage {
 class MQTTSNMessageUnsubscribe : public MQTTSNMessage {
     public:
     MQTTSNMessageUnsubscribe(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t msg_id;
     MQTTSNFlags flags;
@@ -225,8 +263,8 @@ class MQTTSNMessageUnsubscribe : public MQTTSNMessage {
 class MQTTSNMessageSuback : public MQTTSNMessage {
     public:
     MQTTSNMessageSuback(uint8_t return_code = MQTTSN_RC_ACCEPTED);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t topic_id;
     uint16_t msg_id;
@@ -237,8 +275,8 @@ class MQTTSNMessageSuback : public MQTTSNMessage {
 class MQTTSNMessageUnsuback : public MQTTSNMessage {
     public:
     MQTTSNMessageUnsuback(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t msg_id;
 };
@@ -246,8 +284,8 @@ class MQTTSNMessageUnsuback : public MQTTSNMessage {
 class MQTTSNMessagePingreq : public MQTTSNMessage {
     public:
     MQTTSNMessagePingreq(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint8_t * client_id;
     uint8_t client_id_len;
@@ -256,15 +294,15 @@ class MQTTSNMessagePingreq : public MQTTSNMessage {
 class MQTTSNMessagePingresp : public MQTTSNMessage {
     public:
     MQTTSNMessagePingresp(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
 };
 
 class MQTTSNMessageDisconnect : public MQTTSNMessage {
     public:
     MQTTSNMessageDisconnect(void);
-    uint8_t pack(uint8_t * buffer, uint8_t buflen);
-    uint8_t unpack(uint8_t * buffer, uint8_t buflen);
+    uint16_t pack(uint8_t * buffer, uint16_t buflen);
+    uint16_t unpack(uint8_t * buffer, uint16_t buflen);
     
     uint16_t duration;
 };
@@ -0,0 +1,137 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_predefined_topics.h"
+#include "mqttsn_defines.h"
+#include "mqttsn_hash.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* the table, with an end marker so it's never empty */
+static constexpr MQTTSNPredefinedTopic topics[] = {
+#define MQTTSN_PREDEFINED_TOPIC(id, name)   { id, name },
+    MQTTSN_PREDEFINED_TOPICS
+#undef MQTTSN_PREDEFINED_TOPIC
+    { 0, "" }
+};
+
+static constexpr uint16_t topics_cnt = sizeof(topics) / sizeof(topics[0]) - 1;
+
+/* the hash table is a little sparse, which keeps the search for a perfect hash short,
+   so there's a limit on how many topics it can take */
+static_assert(topics_cnt <= 32, "Too many predefined topics");
+
+static constexpr uint16_t pow2_at_least(uint16_t n, uint16_t pow2 = 1)
+{
+    return (pow2 >= n) ? pow2 : pow2_at_least(n, pow2 * 2);
+}
+
+static constexpr uint16_t hash_table_len = pow2_at_least(topics_cnt * topics_cnt);
+
+/* the seed just perturbs the FNV basis, then the high bits get folded in before masking */
+static constexpr uint16_t bucket(uint32_t h)
+{
+    return (h ^ (h >> 15)) & (hash_table_len - 1);
+}
+
+static constexpr uint32_t seeded(uint32_t seed)
+{
+    return MQTTSN_HASH_SEED ^ (uint32_t)(seed * 0x9E3779B9UL);
+}
+
+static constexpr uint16_t name_bucket(uint16_t i, uint32_t seed)
+{
+    return bucket(mqttsn_hash_str(topics[i].name, seeded(seed)));
+}
+
+/* check for any pair of topics that land in the same bucket */
+static constexpr bool collides_with(uint16_t i, uint16_t j, uint32_t seed)
+{
+    return j < topics_cnt && (name_bucket(i, seed) == name_bucket(j, seed) || collides_with(i, j + 1, seed));
+}
+
+static constexpr bool collides(uint32_t seed, uint16_t i = 0)
+{
+    return i < topics_cnt && (collides_with(i, i + 1, seed) || collides(seed, i + 1));
+}
+
+static constexpr uint32_t max_seeds = 64;
+
+static constexpr uint32_t find_seed(uint32_t seed = 0)
+{
+    return (seed == max_seeds || !collides(seed)) ? seed : find_seed(seed + 1);
+}
+
+static constexpr uint32_t hash_seed = find_seed();
+static_assert(hash_seed != max_seeds, "No perfect hash for the predefined topics, check for duplicate names");
+
+/* sanity checks on the list */
+static constexpr uint16_t name_len(const char * name)
+{
+    return (*name == 0) ? 0 : 1 + name_len(name + 1);
+}
+
+static constexpr bool topics_valid(uint16_t i = 0)
+{
+    return i == topics_cnt || (topics[i].tid == i + 1
+        && name_len(topics[i].name) != 0 && name_len(topics[i].name) <= MQTTSN_MAX_TOPICNAME_LEN
+        && topics_valid(i + 1));
+}
+
+static_assert(topics_valid(), "Predefined topic IDs must count up from 1, and names must be non-empty and fit MQTTSN_MAX_TOPICNAME_LEN");
+static_assert(topics_cnt < MQTTSN_MAX_TOPIC_MAPPINGS, "Predefined topics leave no room for other topic mappings");
+
+/* the hash table itself: each bucket holds a topic's ID, or 0 if it's empty */
+static constexpr uint8_t find_in_bucket(uint16_t b, uint16_t i = 0)
+{
+    return (i == topics_cnt) ? 0 : (name_bucket(i, hash_seed) == b) ? topics[i].tid : find_in_bucket(b, i + 1);
+}
+
+template<uint16_t... Is> struct BucketSeq {};
+
+/* halve, build both halves, then join them, to keep template recursion shallow */
+template<typename A, typename B> struct JoinSeq;
+template<uint16_t... As, uint16_t... Bs> struct JoinSeq<BucketSeq<As...>, BucketSeq<Bs...>> {
+    typedef BucketSeq<As..., (sizeof...(As) + Bs)...> type;
+};
+
+template<uint16_t N> struct MakeSeq {
+    typedef typename JoinSeq<typename MakeSeq<N / 2>::type, typename MakeSeq<N - N / 2>::type>::type type;
+};
+template<> struct MakeSeq<1> { typedef BucketSeq<0> type; };
+
+template<typename Seq> struct HashTable;
+template<uint16_t... Is> struct HashTable<BucketSeq<Is...>> {
+    static constexpr uint8_t buckets[sizeof...(Is)] = { find_in_bucket(Is)... };
+};
+template<uint16_t... Is> constexpr uint8_t HashTable<BucketSeq<Is...>>::buckets[sizeof...(Is)];
+
+typedef HashTable<MakeSeq<hash_table_len>::type> PredefinedHashTable;
+
+const char * MQTTSNPredefinedTopics::get_name(uint16_t tid)
+{
+    if (tid == MQTTSN_TOPICID_NOTASSIGNED || tid > topics_cnt)
+        return NULL;
+
+    return topics[tid - 1].name;
+}
+
+uint16_t MQTTSNPredefinedTopics::get_id(const char * name, uint8_t name_len)
+{
+    if (topics_cnt == 0)
+        return 0;
+
+    /* one bucket to check, and the name must match exactly since anything can hash there */
+    uint16_t tid = PredefinedHashTable::buckets[bucket(mqttsn_hash(name, name_len, seeded(hash_seed)))];
+    if (tid == 0 || strlen(topics[tid - 1].name) != name_len || memcmp(topics[tid - 1].name, name, name_len) != 0)
+        return 0;
+
+    return tid;
+}
+
+uint16_t MQTTSNPredefinedTopics::count(void)
+{
+    return topics_cnt;
+}
@@ -0,0 +1,31 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_PREDEFINED_TOPICS_H_
+#define MQTTSN_PREDEFINED_TOPICS_H_
+
+#include "mqttsn_defines.h"
+#include <stdint.h>
+
+/* an entry of the MQTTSN_PREDEFINED_TOPICS list */
+typedef struct {
+    uint16_t tid;
+    const char * name;
+} MQTTSNPredefinedTopic;
+
+/* The topics in MQTTSN_PREDEFINED_TOPICS, shared by the gateway and client.
+ * The table is built at compile time: IDs index straight into it,
+ * and names find their ID through a perfect hash, so there's no probing or scanning */
+class MQTTSNPredefinedTopics {
+    public:
+    /* get the name of a predefined topic ID, NULL if there's none */
+    static const char * get_name(uint16_t tid);
+
+    /* get the ID of a predefined topic name, 0 if it isn't one */
+    static uint16_t get_id(const char * name, uint8_t name_len);
+
+    /* number of predefined topics, their IDs run from 1 to count() */
+    static uint16_t count(void);
+};
+
+#endif
@@ -0,0 +1,124 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_record_ring.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* marks the rest of the buffer as unused, the next record starts at the front */
+#define MQTTSN_RECORD_WRAP              0xFFFF
+
+MQTTSNRecordRing::MQTTSNRecordRing(uint8_t * buf, uint16_t len) :
+    buf(buf), len(len), head(0), tail(0), reserved_at(0), reserved_wraps(false)
+{
+
+}
+
+MQTTSNRecordRing::MQTTSNRecordRing(void) : buf(NULL), len(0), head(0), tail(0), reserved_at(0), reserved_wraps(false)
+{
+
+}
+
+void MQTTSNRecordRing::begin(uint8_t * buf, uint16_t len)
+{
+    this->buf = buf;
+    this->len = len;
+    head = 0;
+    tail = 0;
+}
+
+uint8_t * MQTTSNRecordRing::reserve(uint16_t max_len)
+{
+    uint32_t need = 2 + (uint32_t)max_len;
+    uint16_t h = head, t = tail;
+
+    if (t >= h) {
+        /* the free space runs to the end of the buffer, then from the front up to the head.
+           A record can't end right at the end if the head's at the front, they'd meet */
+        if ((uint32_t)(len - t) >= need && !(t + need == len && h == 0)) {
+            reserved_at = t;
+            reserved_wraps = false;
+        }
+        else if (h > need) {
+            reserved_at = 0;
+            reserved_wraps = true;
+        }
+        else {
+            return NULL;
+        }
+    }
+    else {
+        if ((uint32_t)(h - t) <= need)
+            return NULL;
+
+        reserved_at = t;
+        reserved_wraps = false;
+    }
+
+    return buf + reserved_at + 2;
+}
+
+void MQTTSNRecordRing::commit(uint16_t len)
+{
+    /* the consumer skips to the front on a marker, or when there's no room left for one */
+    uint16_t t = tail;
+    if (reserved_wraps && this->len - t >= 2) {
+        buf[t] = MQTTSN_RECORD_WRAP & 0xFF;
+        buf[t + 1] = MQTTSN_RECORD_WRAP >> 8;
+    }
+
+    buf[reserved_at] = len & 0xFF;
+    buf[reserved_at + 1] = len >> 8;
+
+    uint32_t end = (uint32_t)reserved_at + 2 + len;
+    tail = (end == this->len) ? 0 : end;
+}
+
+bool MQTTSNRecordRing::push(const void * data, uint16_t len)
+{
+    uint8_t * record = reserve(len);
+    if (record == NULL)
+        return false;
+
+    if (len != 0)
+        memcpy(record, data, len);
+
+    commit(len);
+    return true;
+}
+
+uint16_t MQTTSNRecordRing::read_pos(void) const
+{
+    uint16_t h = head;
+    if (len - h < 2 || (buf[h] | (buf[h + 1] << 8)) == MQTTSN_RECORD_WRAP)
+        return 0;
+
+    return h;
+}
+
+uint8_t * MQTTSNRecordRing::front(uint16_t * len)
+{
+    if (empty())
+        return NULL;
+
+    uint16_t h = read_pos();
+    *len = buf[h] | (buf[h + 1] << 8);
+    return buf + h + 2;
+}
+
+void MQTTSNRecordRing::pop(void)
+{
+    if (empty())
+        return;
+
+    uint16_t h = read_pos();
+    uint32_t end = (uint32_t)h + 2 + (buf[h] | (buf[h + 1] << 8));
+    head = (end == len) ? 0 : end;
+}
+
+bool MQTTSNRecordRing::empty(void) const
+{
+    return head == tail;
+}
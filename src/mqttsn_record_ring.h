@@ -0,0 +1,65 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_RECORD_RING_H_
+#define MQTTSN_RECORD_RING_H_
+
+#include "mqttsn_excludes.h"
+#include <stdint.h>
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+#include <atomic>
+
+/* with threads around, a ring can be shared by one producer thread and one consumer thread */
+typedef std::atomic<uint16_t> MQTTSNRecordRingPos;
+#else
+typedef uint16_t MQTTSNRecordRingPos;
+#endif
+
+/* Ring of variable-length records, each stored whole behind a 2-byte length,
+ * so queued records take up only the bytes they need plus 2.
+ * Records are written and read in place: the producer reserves room for the longest record it may write,
+ * fills in what it needs and commits that much; the consumer reads the front record then pops it.
+ * A record that doesn't fit before the end of the buffer starts over at the front,
+ * so one of up to (buffer length - 5) / 2 bytes always fits once the ring's empty.
+ * Buffers can be up to 65535 bytes */
+class MQTTSNRecordRing {
+    public:
+    MQTTSNRecordRing(uint8_t * buf, uint16_t len);
+
+    /* for rings kept in arrays, which get their buffers with begin() before use */
+    MQTTSNRecordRing(void);
+    void begin(uint8_t * buf, uint16_t len);
+
+    /* producer side: room for a record of up to max_len bytes, NULL if the ring's too full.
+       commit() hands over the first 'len' bytes of it, nothing's queued until then */
+    uint8_t * reserve(uint16_t max_len);
+    void commit(uint16_t len);
+
+    /* copy a whole record in, returns false if there's no room */
+    bool push(const void * data, uint16_t len);
+
+    /* consumer side: the oldest record and its length, NULL if the ring is empty; pop() frees it */
+    uint8_t * front(uint16_t * len);
+    void pop(void);
+
+    bool empty(void) const;
+
+    private:
+    /* where the consumer's next record starts, past any wrap */
+    uint16_t read_pos(void) const;
+
+    uint8_t * buf;
+    uint16_t len;
+
+    /* offsets of the oldest record and of the end of the newest, each only ever written by its own side;
+       they're equal when the ring is empty, the producer never lets them meet otherwise */
+    MQTTSNRecordRingPos head;
+    MQTTSNRecordRingPos tail;
+
+    /* producer side: where the reserved record goes, and whether it starts over at the front */
+    uint16_t reserved_at;
+    bool reserved_wraps;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_retained_cache.h"
+#include "mqttsn_topic_registry.h"
+#include "mqttsn_defines.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+MQTTSNRetainedCache::MQTTSNRetainedCache(MQTTSNTopicRegistry * topics, MQTTSNMessagePool * pool) :
+    topics(topics), pool(pool), head(0), tail(0)
+{
+    for (uint8_t i = 0; i < MQTTSN_MAX_RETAINED_MSGS; i++) {
+        msgs[i].tid = MQTTSN_TOPICID_NOTASSIGNED;
+        msgs[i].msg = MQTTSN_POOL_NONE;
+        msgs[i].prev = msgs[i].next = 0;
+    }
+}
+
+void MQTTSNRetainedCache::put(uint16_t tid, MQTTSNPoolHandle msg)
+{
+    MQTTSNTopicMapping * mapping = topics->get_topic_mapping(tid);
+    if (mapping == NULL)
+        return;
+
+    /* replace the old msg */
+    if (mapping->retained != 0) {
+        uint8_t slot = mapping->retained - 1;
+        pool->release(msgs[slot].msg);
+        pool->retain(msg);
+        msgs[slot].msg = msg;
+
+        unlink(slot);
+        link(slot);
+        return;
+    }
+
+    /* else find a free slot, making one if we have to */
+    uint8_t slot = 0;
+    while (slot < MQTTSN_MAX_RETAINED_MSGS && msgs[slot].tid != MQTTSN_TOPICID_NOTASSIGNED)
+        slot++;
+
+    if (slot == MQTTSN_MAX_RETAINED_MSGS) {
+        slot = tail - 1;
+        evict();
+    }
+
+    pool->retain(msg);
+    msgs[slot].tid = tid;
+    msgs[slot].msg = msg;
+    mapping->retained = slot + 1;
+    link(slot);
+}
+
+void MQTTSNRetainedCache::remove(uint16_t tid)
+{
+    MQTTSNTopicMapping * mapping = topics->get_topic_mapping(tid);
+    if (mapping == NULL || mapping->retained == 0)
+        return;
+
+    uint8_t slot = mapping->retained - 1;
+    unlink(slot);
+    pool->release(msgs[slot].msg);
+
+    msgs[slot].tid = MQTTSN_TOPICID_NOTASSIGNED;
+    msgs[slot].msg = MQTTSN_POOL_NONE;
+    mapping->retained = 0;
+}
+
+MQTTSNPoolHandle MQTTSNRetainedCache::get(uint16_t tid)
+{
+    MQTTSNTopicMapping * mapping = topics->get_topic_mapping(tid);
+    if (mapping == NULL || mapping->retained == 0)
+        return MQTTSN_POOL_NONE;
+
+    uint8_t slot = mapping->retained - 1;
+    unlink(slot);
+    link(slot);
+    return msgs[slot].msg;
+}
+
+bool MQTTSNRetainedCache::evict(void)
+{
+    if (tail == 0)
+        return false;
+
+    remove(msgs[tail - 1].tid);
+    return true;
+}
+
+bool MQTTSNRetainedCache::evict_unshared(void)
+{
+    /* a msg still queued for some client keeps its slot whether we drop it or not */
+    for (uint8_t slot = tail; slot != 0; slot = msgs[slot - 1].prev) {
+        if (pool->ref_count(msgs[slot - 1].msg) == 1) {
+            remove(msgs[slot - 1].tid);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint16_t MQTTSNRetainedCache::get_tid(uint8_t slot) const
+{
+    return msgs[slot].tid;
+}
+
+void MQTTSNRetainedCache::link(uint8_t slot)
+{
+    /* push it onto the head */
+    msgs[slot].prev = 0;
+    msgs[slot].next = head;
+    if (head != 0)
+        msgs[head - 1].prev = slot + 1;
+    else
+        tail = slot + 1;
+
+    head = slot + 1;
+}
+
+void MQTTSNRetainedCache::unlink(uint8_t slot)
+{
+    MQTTSNRetainedMsg * entry = &msgs[slot];
+    if (entry->prev != 0)
+        msgs[entry->prev - 1].next = entry->next;
+    else
+        head = entry->next;
+
+    if (entry->next != 0)
+        msgs[entry->next - 1].prev = entry->prev;
+    else
+        tail = entry->prev;
+
+    entry->prev = entry->next = 0;
+}
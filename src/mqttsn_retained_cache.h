@@ -0,0 +1,67 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_RETAINED_CACHE_H_
+#define MQTTSN_RETAINED_CACHE_H_
+
+#include "mqttsn_defines.h"
+#include "mqttsn_message_pool.h"
+#include <stdint.h>
+
+class MQTTSNTopicRegistry;
+
+/* topic mappings hold their cache slot + 1, so we can't go beyond this */
+static_assert(MQTTSN_MAX_RETAINED_MSGS < 0xFF, "Too many retained messages");
+
+/* the last retained PUBLISH seen on a topic */
+typedef struct {
+    /* 0 if the slot is free */
+    uint16_t tid;
+    MQTTSNPoolHandle msg;
+
+    /* neighbours in the LRU list, as slot + 1, or 0 if there's none */
+    uint8_t prev, next;
+} MQTTSNRetainedMsg;
+
+/* Cache of retained PUBLISHes by topic ID, for delivery to new subscribers.
+ * The msgs themselves live in the gateway's msg pool, so one still buffered for a sleeping client isn't held twice.
+ * It holds up to MQTTSN_MAX_RETAINED_MSGS of them, and gives up the least recently used
+ * when it's full, or when the pool needs the room */
+class MQTTSNRetainedCache {
+    public:
+    MQTTSNRetainedCache(MQTTSNTopicRegistry * topics, MQTTSNMessagePool * pool);
+
+    /* make a pooled msg the retained one for a topic, in place of any older one.
+       The cache takes its own reference to it */
+    void put(uint16_t tid, MQTTSNPoolHandle msg);
+
+    /* drop the retained msg of a topic, if there's one */
+    void remove(uint16_t tid);
+
+    /* get the retained msg of a topic and mark it as just used, MQTTSN_POOL_NONE if there's none */
+    MQTTSNPoolHandle get(uint16_t tid);
+
+    /* drop the least recently used msg, returns false if the cache is empty */
+    bool evict(void);
+
+    /* drop the least recently used msg that nothing else holds a reference to, so its pool slot is freed.
+       Returns false if there's none */
+    bool evict_unshared(void);
+
+    /* for going through every retained msg: the topic ID in a slot, 0 if the slot is free */
+    uint16_t get_tid(uint8_t slot) const;
+
+    private:
+    void link(uint8_t slot);
+    void unlink(uint8_t slot);
+
+    MQTTSNTopicRegistry * topics;
+    MQTTSNMessagePool * pool;
+
+    MQTTSNRetainedMsg msgs[MQTTSN_MAX_RETAINED_MSGS];
+
+    /* ends of the LRU list, most recently used at the head, as slot + 1 */
+    uint8_t head, tail;
+};
+
+#endif
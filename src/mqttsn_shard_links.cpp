@@ -0,0 +1,33 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+
+#include "mqttsn_shard_links.h"
+
+#include <stdint.h>
+
+MQTTSNShardLinks::MQTTSNShardLinks(uint8_t num_shards)
+{
+    this->num_shards = (num_shards < MQTTSN_MAX_SHARDS) ? num_shards : MQTTSN_MAX_SHARDS;
+
+    for (uint8_t from = 0; from < MQTTSN_MAX_SHARDS; from++) {
+        for (uint8_t to = 0; to < MQTTSN_MAX_SHARDS; to++) {
+            rings[from][to].begin(bufs[from][to], MQTTSN_SHARD_RING_BYTES);
+        }
+    }
+}
+
+uint8_t MQTTSNShardLinks::count(void) const
+{
+    return num_shards;
+}
+
+MQTTSNRecordRing * MQTTSNShardLinks::ring(uint8_t from, uint8_t to)
+{
+    return &rings[from][to];
+}
+
+#endif
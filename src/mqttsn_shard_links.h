@@ -0,0 +1,40 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_SHARD_LINKS_H_
+#define MQTTSN_SHARD_LINKS_H_
+
+#include "mqttsn_defines.h"
+#include "mqttsn_messages.h"
+#include "mqttsn_record_ring.h"
+#include <stdint.h>
+
+/* A publish passed from one shard to another is queued as a record of
+ * {1-byte flags}{1-byte topic name length}{topic name}{payload},
+ * by name since each shard numbers its topics its own way */
+#define MQTTSN_SHARD_MAX_RECORD_LEN     (2 + MQTTSN_MAX_TOPICNAME_LEN + MQTTSN_MAX_PAYLOAD_LEN)
+
+static_assert(MQTTSN_SHARD_RING_BYTES <= 0xFFFF, "Shard ring is too long");
+static_assert(MQTTSN_SHARD_RING_BYTES >= 2 * MQTTSN_SHARD_MAX_RECORD_LEN + 5, "Shard ring can't fit the longest publish");
+
+/* A gateway can be split into shards, each a gateway of its own running on its own thread,
+ * with a disjoint set of clients picked by address (see MQTTSNShardRouter).
+ * Acting as the broker, a shard hands every publish it takes to the others through these links,
+ * one lock-free ring for each ordered pair of shards, so their subscribers get it too */
+class MQTTSNShardLinks {
+    public:
+    MQTTSNShardLinks(uint8_t num_shards);
+
+    uint8_t count(void) const;
+
+    /* the ring carrying publishes from one shard to another */
+    MQTTSNRecordRing * ring(uint8_t from, uint8_t to);
+
+    private:
+    uint8_t num_shards;
+
+    MQTTSNRecordRing rings[MQTTSN_MAX_SHARDS][MQTTSN_MAX_SHARDS];
+    uint8_t bufs[MQTTSN_MAX_SHARDS][MQTTSN_MAX_SHARDS][MQTTSN_SHARD_RING_BYTES];
+};
+
+#endif
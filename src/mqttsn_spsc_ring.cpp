@@ -0,0 +1,68 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+
+#include "mqttsn_spsc_ring.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+MQTTSNSpscRing::MQTTSNSpscRing(uint8_t * buf, uint16_t capacity, uint16_t item_size) :
+    buf(buf), capacity(capacity), item_size(item_size), head(0), tail(0)
+{
+
+}
+
+MQTTSNSpscRing::MQTTSNSpscRing(void) : buf(NULL), capacity(0), item_size(0), head(0), tail(0)
+{
+
+}
+
+void MQTTSNSpscRing::begin(uint8_t * buf, uint16_t capacity, uint16_t item_size)
+{
+    this->buf = buf;
+    this->capacity = capacity;
+    this->item_size = item_size;
+    head = 0;
+    tail = 0;
+}
+
+uint8_t * MQTTSNSpscRing::reserve(void)
+{
+    /* only we move the tail, the consumer's pops must be seen before we reuse their slots */
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    if ((uint16_t)(t - head.load(std::memory_order_acquire)) == capacity)
+        return NULL;
+
+    return &buf[(t & (capacity - 1)) * item_size];
+}
+
+void MQTTSNSpscRing::commit(void)
+{
+    /* publishes the slot's contents along with it */
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+uint8_t * MQTTSNSpscRing::front(void)
+{
+    uint16_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+        return NULL;
+
+    return &buf[(h & (capacity - 1)) * item_size];
+}
+
+void MQTTSNSpscRing::pop(void)
+{
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool MQTTSNSpscRing::empty(void) const
+{
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,42 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_SPSC_RING_H_
+#define MQTTSN_SPSC_RING_H_
+
+#include <stdint.h>
+#include <atomic>
+
+/* Lock-free ring of fixed-size items, for handing items from exactly one producer thread
+ * to exactly one consumer thread. Items are written and read in place, the producer fills the slot
+ * it reserves then commits it, the consumer reads the front slot then pops it.
+ * The capacity must be a power of 2 */
+class MQTTSNSpscRing {
+    public:
+    MQTTSNSpscRing(uint8_t * buf, uint16_t capacity, uint16_t item_size);
+
+    /* for rings kept in arrays, which get their buffers with begin() before use */
+    MQTTSNSpscRing(void);
+    void begin(uint8_t * buf, uint16_t capacity, uint16_t item_size);
+
+    /* producer side: a free slot to fill, NULL if the ring is full; commit() hands it over */
+    uint8_t * reserve(void);
+    void commit(void);
+
+    /* consumer side: the oldest item, NULL if the ring is empty; pop() frees its slot */
+    uint8_t * front(void);
+    void pop(void);
+
+    bool empty(void) const;
+
+    private:
+    uint8_t * buf;
+    uint16_t capacity;
+    uint16_t item_size;
+
+    /* free-running counts of items popped and committed, each only ever written by its own side */
+    std::atomic<uint16_t> head;
+    std::atomic<uint16_t> tail;
+};
+
+#endif
@@ -0,0 +1,180 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_timer_wheel.h"
+#include "mqttsn_defines.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+MQTTSNTimerWheel::MQTTSNTimerWheel(void) : 
+    slot_base(0), expired(0), deferred(0), next(NULL), prev(NULL), expiry(NULL), curr_tick(0), tick_start(0)
+{
+
+}
+
+void MQTTSNTimerWheel::set_storage(void * storage, uint16_t num_timers)
+{
+    slot_base = num_timers;
+    expired = slot_base + MQTTSN_TIMER_WHEEL_SLOTS;
+    deferred = expired + 1;
+    
+    /* the 32-bit array goes first, so they all stay aligned */
+    expiry = (uint32_t *)storage;
+    next = (uint16_t *)(expiry + num_timers);
+    prev = next + deferred + 1;
+    
+    /* timers start out unlinked, list heads start out empty */
+    for (uint16_t i = 0; i <= deferred; i++) {
+        if (i < slot_base) {
+            next[i] = prev[i] = MQTTSN_TIMER_NONE;
+            expiry[i] = 0;
+        }
+        else {
+            next[i] = prev[i] = i;
+        }
+    }
+}
+
+void MQTTSNTimerWheel::begin(uint32_t now)
+{
+    tick_start = now;
+}
+
+void MQTTSNTimerWheel::schedule(uint16_t id, uint32_t deadline)
+{
+    unlink(id);
+
+    /* deadlines are relative to the start of the current tick */
+    int32_t delta = (int32_t)(deadline - tick_start);
+    if (delta <= 0) {
+        /* due already, but let the caller finish its current pass first */
+        defer(id);
+        return;
+    }
+
+    /* round up, so we never fire early */
+    expiry[id] = curr_tick + (delta + MQTTSN_TIMER_WHEEL_TICK_MS - 1) / MQTTSN_TIMER_WHEEL_TICK_MS;
+    link(id, slot_base + (expiry[id] & (MQTTSN_TIMER_WHEEL_SLOTS - 1)));
+}
+
+void MQTTSNTimerWheel::defer(uint16_t id)
+{
+    unlink(id);
+    expiry[id] = curr_tick;
+    link(id, deferred);
+}
+
+void MQTTSNTimerWheel::cancel(uint16_t id)
+{
+    unlink(id);
+}
+
+bool MQTTSNTimerWheel::is_scheduled(uint16_t id) const
+{
+    return next[id] != MQTTSN_TIMER_NONE;
+}
+
+void MQTTSNTimerWheel::advance(uint32_t now)
+{
+    /* anything deferred is now fair game */
+    splice(deferred, expired);
+
+    uint32_t ticks = (now - tick_start) / MQTTSN_TIMER_WHEEL_TICK_MS;
+    if (ticks == 0)
+        return;
+
+    uint32_t last_tick = curr_tick + ticks;
+
+    /* no need to go round more than once */
+    uint32_t steps = (ticks < MQTTSN_TIMER_WHEEL_SLOTS) ? ticks : MQTTSN_TIMER_WHEEL_SLOTS;
+
+    for (uint32_t i = 1; i <= steps; i++) {
+        uint16_t slot = slot_base + ((curr_tick + i) & (MQTTSN_TIMER_WHEEL_SLOTS - 1));
+
+        /* take out whatever's due, leave timers meant for a later turn */
+        uint16_t id = next[slot];
+        while (id != slot) {
+            uint16_t following = next[id];
+            if ((int32_t)(expiry[id] - last_tick) <= 0) {
+                unlink(id);
+                link(id, expired);
+            }
+            id = following;
+        }
+    }
+
+    curr_tick = last_tick;
+    tick_start += ticks * MQTTSN_TIMER_WHEEL_TICK_MS;
+}
+
+uint16_t MQTTSNTimerWheel::pop_expired(void)
+{
+    uint16_t id = next[expired];
+    if (id == expired)
+        return MQTTSN_TIMER_NONE;
+
+    unlink(id);
+    return id;
+}
+
+uint32_t MQTTSNTimerWheel::next_expiry(uint32_t now) const
+{
+    if (next[expired] != expired || next[deferred] != deferred)
+        return 0;
+
+    /* go round once, the first slot holding a timer due on this turn has the earliest one.
+       Failing that, the earliest of the timers meant for later turns */
+    uint32_t ticks = MQTTSN_NO_DEADLINE;
+    for (uint32_t i = 1; i <= MQTTSN_TIMER_WHEEL_SLOTS && ticks > i; i++) {
+        uint16_t slot = slot_base + ((curr_tick + i) & (MQTTSN_TIMER_WHEEL_SLOTS - 1));
+
+        for (uint16_t id = next[slot]; id != slot; id = next[id]) {
+            uint32_t due = expiry[id] - curr_tick;
+            if (due < ticks)
+                ticks = due;
+        }
+    }
+
+    if (ticks == MQTTSN_NO_DEADLINE)
+        return MQTTSN_NO_DEADLINE;
+
+    /* the tick is done once that much time has passed since the current one started */
+    uint32_t elapsed = now - tick_start;
+    uint32_t wait = ticks * MQTTSN_TIMER_WHEEL_TICK_MS;
+    return (elapsed < wait) ? wait - elapsed : 0;
+}
+
+void MQTTSNTimerWheel::link(uint16_t id, uint16_t list)
+{
+    /* add to the tail */
+    next[id] = list;
+    prev[id] = prev[list];
+    next[prev[list]] = id;
+    prev[list] = id;
+}
+
+void MQTTSNTimerWheel::unlink(uint16_t id)
+{
+    if (next[id] == MQTTSN_TIMER_NONE)
+        return;
+
+    next[prev[id]] = next[id];
+    prev[next[id]] = prev[id];
+    next[id] = prev[id] = MQTTSN_TIMER_NONE;
+}
+
+void MQTTSNTimerWheel::splice(uint16_t from, uint16_t to)
+{
+    if (next[from] == from)
+        return;
+
+    /* append the whole of one list onto the tail of the other */
+    uint16_t first = next[from], last = prev[from];
+    prev[first] = prev[to];
+    next[prev[to]] = first;
+    next[last] = to;
+    prev[to] = last;
+
+    next[from] = prev[from] = from;
+}
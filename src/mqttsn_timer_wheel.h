@@ -0,0 +1,80 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TIMER_WHEEL_H_
+#define MQTTSN_TIMER_WHEEL_H_
+
+#include "mqttsn_defines.h"
+#include <stdint.h>
+
+/* returned when no timer has expired */
+#define MQTTSN_TIMER_NONE               0xFFFF
+
+/* list nodes are the timers themselves, then one sentinel per slot,
+   then the sentinels for the expired and deferred lists */
+static_assert((MQTTSN_TIMER_WHEEL_SLOTS & (MQTTSN_TIMER_WHEEL_SLOTS - 1)) == 0, "Timer wheel slots must be a power of 2");
+static_assert(MQTTSN_MAX_ARENA_CLIENTS + MQTTSN_TIMER_WHEEL_SLOTS + 2 < MQTTSN_TIMER_NONE, "Too many timers");
+
+/* Hashed timer wheel with one timer per gateway client slot.
+ * Each slot covers MQTTSN_TIMER_WHEEL_TICK_MS, deadlines further out than a whole turn
+ * just stay in their slot until the wheel comes round to the right turn.
+ * Timers may fire up to one tick late, never early. */
+class MQTTSNTimerWheel {
+    public:
+    MQTTSNTimerWheel(void);
+
+    /* hand the wheel storage_size(num_timers) bytes for its timers and lists, before anything else.
+       The storage must be aligned for uint32_t */
+    void set_storage(void * storage, uint16_t num_timers);
+    static constexpr uint32_t storage_size(uint16_t num_timers)
+    {
+        return (uint32_t)num_timers * sizeof(uint32_t) + 2 * sizeof(uint16_t) * ((uint32_t)num_timers + MQTTSN_TIMER_WHEEL_SLOTS + 2);
+    }
+
+    /* set the wheel's notion of the current time, before scheduling anything */
+    void begin(uint32_t now);
+
+    /* arm or re-arm a timer, timers already due are deferred to the next advance() */
+    void schedule(uint16_t id, uint32_t deadline);
+
+    /* arm a timer to go off on the next advance() */
+    void defer(uint16_t id);
+
+    /* disarm a timer, does nothing if it isn't armed */
+    void cancel(uint16_t id);
+
+    bool is_scheduled(uint16_t id) const;
+
+    /* move every timer that's due by 'now' onto the expired list */
+    void advance(uint32_t now);
+
+    /* take the next timer off the expired list, MQTTSN_TIMER_NONE if it's empty */
+    uint16_t pop_expired(void);
+
+    /* millisecs from 'now' till an advance() would expire another timer, 0 if one's waiting already,
+       MQTTSN_NO_DEADLINE if none are armed */
+    uint32_t next_expiry(uint32_t now) const;
+
+    private:
+    void link(uint16_t id, uint16_t list);
+    void unlink(uint16_t id);
+    void splice(uint16_t from, uint16_t to);
+
+    /* the first slot's sentinel comes right after the timers, the expired and deferred ones after the last slot's */
+    uint16_t slot_base;
+    uint16_t expired;
+    uint16_t deferred;
+
+    /* circular doubly linked lists, unlinked timers point nowhere */
+    uint16_t * next;
+    uint16_t * prev;
+
+    /* tick on which each timer is due */
+    uint32_t * expiry;
+
+    /* current tick, and the time at which it started */
+    uint32_t curr_tick;
+    uint32_t tick_start;
+};
+
+#endif
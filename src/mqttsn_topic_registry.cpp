@@ -0,0 +1,144 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_topic_registry.h"
+#include "mqttsn_defines.h"
+#include "mqttsn_hash.h"
+#include "mqttsn_predefined_topics.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+MQTTSNTopicRegistry::MQTTSNTopicRegistry(void) : mappings(NULL), mappings_cnt(0), capacity(0), free_head(0), name_index(NULL), index_mask(0)
+{
+
+}
+
+bool MQTTSNTopicRegistry::set_storage(void * storage, uint16_t capacity)
+{
+    if (capacity > MQTTSN_MAX_ARENA_TOPICS || capacity <= MQTTSNPredefinedTopics::count())
+        return false;
+    
+    uint32_t index_len = MQTTSNArena::index_len(capacity);
+    mappings = (MQTTSNTopicMapping *)storage;
+    name_index = (uint16_t *)(mappings + capacity);
+    index_mask = index_len - 1;
+    mappings_cnt = 0;
+    free_head = 0;
+    this->capacity = capacity;
+    
+    memset(mappings, 0, capacity * sizeof(MQTTSNTopicMapping));
+    memset(name_index, 0, index_len * sizeof(uint16_t));
+    
+    /* predefined topics take the first mappings, so they keep their IDs */
+    for (uint16_t tid = 1; tid <= MQTTSNPredefinedTopics::count(); tid++) {
+        const char * name = MQTTSNPredefinedTopics::get_name(tid);
+        get_topic_id((const uint8_t *)name, strlen(name));
+    }
+    
+    return true;
+}
+
+uint16_t MQTTSNTopicRegistry::get_topic_id(const uint8_t * name, uint8_t name_len)
+{
+    if (name_len > MQTTSN_MAX_TOPICNAME_LEN)
+        return 0;
+
+    uint16_t pos = probe(name, name_len);
+    if (name_index[pos] != 0)
+        return mappings[name_index[pos] - 1].tid;
+
+    /* else add it, in a removed mapping's slot if there's one */
+    uint16_t slot;
+    if (free_head != 0) {
+        slot = free_head - 1;
+        free_head = mappings[slot].sub_count;
+    }
+    else if (mappings_cnt < capacity) {
+        slot = mappings_cnt++;
+    }
+    else {
+        return 0;
+    }
+
+    MQTTSNTopicMapping * mapping = &mappings[slot];
+    memset(mapping, 0, sizeof(MQTTSNTopicMapping));
+    memcpy(mapping->name, name, name_len);
+    mapping->name[name_len] = 0;
+    mapping->name_len = name_len;
+    mapping->tid = slot + 1;
+    mapping->sub_head = MQTTSN_SUBHANDLE_NONE;
+
+    name_index[pos] = slot + 1;
+    return mapping->tid;
+}
+
+uint16_t MQTTSNTopicRegistry::find_topic_id(const uint8_t * name, uint8_t name_len)
+{
+    if (name_len > MQTTSN_MAX_TOPICNAME_LEN)
+        return 0;
+
+    uint16_t pos = probe(name, name_len);
+    return (name_index[pos] != 0) ? mappings[name_index[pos] - 1].tid : 0;
+}
+
+MQTTSNTopicMapping * MQTTSNTopicRegistry::get_topic_mapping(uint16_t tid)
+{
+    /* IDs map directly to slots, a removed one has no ID */
+    if (tid == MQTTSN_TOPICID_NOTASSIGNED || tid > mappings_cnt || mappings[tid - 1].tid == 0)
+        return NULL;
+
+    return &mappings[tid - 1];
+}
+
+void MQTTSNTopicRegistry::remove(uint16_t tid)
+{
+    MQTTSNTopicMapping * mapping = get_topic_mapping(tid);
+    if (mapping == NULL || tid <= MQTTSNPredefinedTopics::count())
+        return;
+
+    /* empty its bucket, then move back any name after it that would no longer be found,
+       so lookups still stop at the first empty bucket */
+    uint16_t pos = probe((const uint8_t *)mapping->name, mapping->name_len);
+    name_index[pos] = 0;
+    for (uint16_t next = (pos + 1) & index_mask; name_index[next] != 0; next = (next + 1) & index_mask) {
+        const MQTTSNTopicMapping * moved = &mappings[name_index[next] - 1];
+        uint16_t home = mqttsn_hash((const uint8_t *)moved->name, moved->name_len) & index_mask;
+
+        /* it's fine where it is if its home is after the hole, going round from the hole to it */
+        if ((pos <= next) ? (pos < home && home <= next) : (pos < home || home <= next))
+            continue;
+
+        name_index[pos] = name_index[next];
+        name_index[next] = 0;
+        pos = next;
+    }
+
+    mapping->tid = 0;
+    mapping->name_len = 0;
+    mapping->name[0] = 0;
+    mapping->sub_count = free_head;
+    free_head = tid;
+}
+
+uint16_t MQTTSNTopicRegistry::probe(const uint8_t * name, uint8_t name_len) const
+{
+    /* probe until we find the topic or an empty bucket */
+    uint16_t pos = mqttsn_hash(name, name_len) & index_mask;
+    while (name_index[pos] != 0) {
+        const MQTTSNTopicMapping * mapping = &mappings[name_index[pos] - 1];
+
+        if (mapping->name_len == name_len && memcmp(mapping->name, name, name_len) == 0)
+            break;
+
+        pos = (pos + 1) & index_mask;
+    }
+
+    return pos;
+}
+
+uint16_t MQTTSNTopicRegistry::count(void) const
+{
+    return mappings_cnt;
+}
@@ -0,0 +1,94 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TOPIC_REGISTRY_H_
+#define MQTTSN_TOPIC_REGISTRY_H_
+
+#include "mqttsn_defines.h"
+#include "mqttsn_arena.h"
+#include <stdint.h>
+
+/* the name index takes twice as many buckets as there are mappings, rounded up to a power of 2,
+   and buckets hold a slot number, so we can't go beyond this */
+#define MQTTSN_MAX_ARENA_TOPICS         0x7FFF
+
+static_assert(MQTTSN_MAX_TOPIC_MAPPINGS <= MQTTSN_MAX_ARENA_TOPICS, "Too many topic mappings");
+
+/* Identifies one subscription slot of one gateway client:
+   (client slot * MQTTSN_MAX_INSTANCE_TOPICS) + subscription slot */
+#if (MQTTSN_MAX_ARENA_CLIENTS * MQTTSN_MAX_INSTANCE_TOPICS) < 0xFFFF
+    typedef uint16_t MQTTSNSubHandle;
+    #define MQTTSN_SUBHANDLE_NONE       0xFFFF
+#else
+    typedef uint32_t MQTTSNSubHandle;
+    #define MQTTSN_SUBHANDLE_NONE       0xFFFFFFFFUL
+#endif
+
+/* for gateway mapping of topic name to topic ID and type */
+typedef struct {
+    char name[MQTTSN_MAX_TOPICNAME_LEN + 1];
+    uint8_t name_len;
+    uint8_t ttype;
+    bool subbed;
+    uint8_t sub_qos;
+    uint16_t tid;
+    
+    /* head of the linked list of client subscriptions to this topic,
+       a free mapping's sub_count holds the slot + 1 of the next free one instead */
+    MQTTSNSubHandle sub_head;
+    uint16_t sub_count;
+
+    /* slot + 1 of the topic's retained msg in the gateway's cache, or 0 if there's none */
+    uint8_t retained;
+} MQTTSNTopicMapping;
+
+/* Table of topic mappings, indexed both by name and by ID.
+ * Slot i always holds topic ID i + 1, a removed mapping's slot and ID go to the next new topic.
+ * The predefined topics are added first, so their mappings share their predefined IDs */
+class MQTTSNTopicRegistry {
+    public:
+    MQTTSNTopicRegistry(void);
+
+    /* hand the registry storage_size(capacity) bytes to hold 'capacity' mappings in, before anything else,
+       and add the predefined topics. Returns false if they don't fit, or there are too many mappings.
+       The storage must be aligned for MQTTSNTopicMapping */
+    bool set_storage(void * storage, uint16_t capacity);
+    static constexpr uint32_t storage_size(uint16_t capacity)
+    {
+        return (uint32_t)capacity * sizeof(MQTTSNTopicMapping) + MQTTSNArena::index_len(capacity) * sizeof(uint16_t);
+    }
+
+    /* get the ID of a topic, creating a new mapping if needed,
+     * returns 0 if the name is too long or the table is full */
+    uint16_t get_topic_id(const uint8_t * name, uint8_t name_len);
+    
+    /* get the ID of a topic only if it already has a mapping, 0 otherwise */
+    uint16_t find_topic_id(const uint8_t * name, uint8_t name_len);
+
+    /* get the mapping for a topic ID, NULL if there's none */
+    MQTTSNTopicMapping * get_topic_mapping(uint16_t tid);
+
+    /* drop a mapping nothing refers to anymore, the predefined topics are never removed */
+    void remove(uint16_t tid);
+
+    /* highest ID handed out, the IDs in use run from 1 to count() with gaps where mappings were removed */
+    uint16_t count(void) const;
+
+    private:
+    /* get the index bucket holding a name, or the empty bucket where it would go */
+    uint16_t probe(const uint8_t * name, uint8_t name_len) const;
+    
+    MQTTSNTopicMapping * mappings;
+    uint16_t mappings_cnt;
+    uint16_t capacity;
+
+    /* slot + 1 of the first removed mapping, 0 if there's none */
+    uint16_t free_head;
+
+    /* open-addressed (linear probing) index of names,
+       each bucket holds a mapping's slot + 1, or 0 if it's empty */
+    uint16_t * name_index;
+    uint16_t index_mask;
+};
+
+#endif
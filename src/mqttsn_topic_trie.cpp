@@ -0,0 +1,228 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "mqttsn_topic_trie.h"
+#include "mqttsn_topic_registry.h"
+#include "mqttsn_defines.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+MQTTSNTopicTrie::MQTTSNTopicTrie(MQTTSNTopicRegistry * topics) : topics(topics), nodes_cnt(1), free_head(MQTTSN_TRIE_NONE)
+{
+    memset(nodes, 0, sizeof(nodes));
+    nodes[0].child = nodes[0].sibling = MQTTSN_TRIE_NONE;
+}
+
+bool MQTTSNTopicTrie::is_filter(const uint8_t * name, uint8_t name_len)
+{
+    return memchr(name, '+', name_len) != NULL || memchr(name, '#', name_len) != NULL;
+}
+
+bool MQTTSNTopicTrie::insert(uint16_t tid)
+{
+    MQTTSNTopicMapping * mapping = topics->get_topic_mapping(tid);
+    if (mapping == NULL)
+        return false;
+
+    const char * name = mapping->name;
+    uint8_t name_len = mapping->name_len;
+
+    /* check it first, so we don't leave a half-added filter behind:
+       '+' must take up a whole level, and '#' the whole of the last one */
+    for (uint8_t i = 0; i < name_len; i++) {
+        if (name[i] != '+' && name[i] != '#')
+            continue;
+
+        if ((i > 0 && name[i - 1] != '/') || (i + 1 < name_len && name[i + 1] != '/'))
+            return false;
+
+        if (name[i] == '#' && i + 1 != name_len)
+            return false;
+    }
+
+    uint16_t node = 0;
+    uint8_t start = 0;
+    while (true) {
+        uint8_t end = start;
+        while (end < name_len && name[end] != '/')
+            end++;
+
+        /* a '#' belongs to the level before it */
+        if (end - start == 1 && name[start] == '#') {
+            nodes[node].multi_tid = tid;
+            return true;
+        }
+
+        node = get_child(node, tid, start, end - start);
+        if (node == MQTTSN_TRIE_NONE)
+            return false;
+
+        if (end == name_len) {
+            nodes[node].filter_tid = tid;
+            return true;
+        }
+
+        start = end + 1;
+    }
+}
+
+void MQTTSNTopicTrie::remove(uint16_t tid)
+{
+    if (topics->get_topic_mapping(tid) != NULL)
+        remove_level(0, tid, 0);
+}
+
+void MQTTSNTopicTrie::remove_level(uint16_t node, uint16_t tid, uint8_t start)
+{
+    const MQTTSNTopicMapping * mapping = topics->get_topic_mapping(tid);
+    const char * name = mapping->name;
+    uint8_t name_len = mapping->name_len;
+
+    uint8_t end = start;
+    while (end < name_len && name[end] != '/')
+        end++;
+
+    /* the levels are walked the same way insert() did */
+    if (end - start == 1 && name[start] == '#') {
+        if (nodes[node].multi_tid == tid)
+            nodes[node].multi_tid = 0;
+        return;
+    }
+
+    uint16_t prev = MQTTSN_TRIE_NONE;
+    uint16_t child = nodes[node].child;
+    while (child != MQTTSN_TRIE_NONE) {
+        if (nodes[child].level_len == end - start && memcmp(level_text(child), &name[start], end - start) == 0)
+            break;
+
+        prev = child;
+        child = nodes[child].sibling;
+    }
+
+    /* not there, or only part of it if it didn't fit */
+    if (child == MQTTSN_TRIE_NONE)
+        return;
+
+    if (end == name_len) {
+        if (nodes[child].filter_tid == tid)
+            nodes[child].filter_tid = 0;
+    }
+    else {
+        remove_level(child, tid, end + 1);
+    }
+
+    /* still used by other filters, which may have been borrowing this one's text */
+    if (nodes[child].child != MQTTSN_TRIE_NONE || nodes[child].filter_tid != 0 || nodes[child].multi_tid != 0) {
+        if (nodes[child].name_tid == tid)
+            nodes[child].name_tid = any_tid(child);
+        return;
+    }
+
+    /* else unlink it and give it back */
+    if (prev == MQTTSN_TRIE_NONE)
+        nodes[node].child = nodes[child].sibling;
+    else
+        nodes[prev].sibling = nodes[child].sibling;
+
+    nodes[child].sibling = free_head;
+    free_head = child;
+}
+
+uint16_t MQTTSNTopicTrie::any_tid(uint16_t node)
+{
+    /* a node with no filter of its own has children, and every node leads to a filter */
+    while (nodes[node].filter_tid == 0 && nodes[node].multi_tid == 0)
+        node = nodes[node].child;
+
+    return (nodes[node].filter_tid != 0) ? nodes[node].filter_tid : nodes[node].multi_tid;
+}
+
+uint8_t MQTTSNTopicTrie::match(const char * name, uint8_t name_len, uint16_t * tids, uint8_t max_tids)
+{
+    match_name = name;
+    match_name_len = name_len;
+    match_tids = tids;
+    match_max = max_tids;
+    match_cnt = 0;
+
+    match_level(0, 0);
+    return match_cnt;
+}
+
+void MQTTSNTopicTrie::match_level(uint16_t node, uint16_t pos)
+{
+    /* topics starting with '$' don't match wildcards at the first level */
+    bool special = (node == 0 && match_name_len != 0 && match_name[0] == '$');
+
+    /* a '#' after this level matches whatever's left, even nothing */
+    uint16_t multi_tid = nodes[node].multi_tid;
+    if (multi_tid != 0 && !special && match_cnt < match_max)
+        match_tids[match_cnt++] = multi_tid;
+
+    /* we're past the last level, pos can be one more than the longest name */
+    if (pos > match_name_len) {
+        uint16_t filter_tid = nodes[node].filter_tid;
+        if (filter_tid != 0 && match_cnt < match_max)
+            match_tids[match_cnt++] = filter_tid;
+        return;
+    }
+
+    uint16_t end = pos;
+    while (end < match_name_len && match_name[end] != '/')
+        end++;
+
+    /* follow both the '+' and the exact match, if there are both */
+    for (uint16_t child = nodes[node].child; child != MQTTSN_TRIE_NONE; child = nodes[child].sibling) {
+        const char * text = level_text(child);
+        uint8_t text_len = nodes[child].level_len;
+
+        if ((text_len == 1 && text[0] == '+' && !special)
+            || (text_len == end - pos && memcmp(text, &match_name[pos], text_len) == 0))
+        {
+            match_level(child, end + 1);
+        }
+    }
+}
+
+uint16_t MQTTSNTopicTrie::get_child(uint16_t parent, uint16_t name_tid, uint8_t level_start, uint8_t level_len)
+{
+    const char * text = topics->get_topic_mapping(name_tid)->name + level_start;
+
+    for (uint16_t child = nodes[parent].child; child != MQTTSN_TRIE_NONE; child = nodes[child].sibling) {
+        if (nodes[child].level_len == level_len && memcmp(level_text(child), text, level_len) == 0)
+            return child;
+    }
+
+    /* else add it, in a node a removed filter gave back if there's one */
+    uint16_t child;
+    if (free_head != MQTTSN_TRIE_NONE) {
+        child = free_head;
+        free_head = nodes[child].sibling;
+    }
+    else if (nodes_cnt < MQTTSN_MAX_FILTER_LEVELS + 1) {
+        child = nodes_cnt++;
+    }
+    else {
+        return MQTTSN_TRIE_NONE;
+    }
+
+    MQTTSNTrieNode * new_node = &nodes[child];
+    new_node->name_tid = name_tid;
+    new_node->level_start = level_start;
+    new_node->level_len = level_len;
+    new_node->child = MQTTSN_TRIE_NONE;
+    new_node->filter_tid = 0;
+    new_node->multi_tid = 0;
+
+    /* push it onto the front of the parent's children */
+    new_node->sibling = nodes[parent].child;
+    nodes[parent].child = child;
+    return child;
+}
+
+const char * MQTTSNTopicTrie::level_text(uint16_t node)
+{
+    return topics->get_topic_mapping(nodes[node].name_tid)->name + nodes[node].level_start;
+}
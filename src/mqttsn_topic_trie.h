@@ -0,0 +1,83 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TOPIC_TRIE_H_
+#define MQTTSN_TOPIC_TRIE_H_
+
+#include "mqttsn_defines.h"
+#include <stdint.h>
+
+class MQTTSNTopicRegistry;
+
+/* returned when a node has no child or sibling */
+#define MQTTSN_TRIE_NONE                0xFFFF
+
+static_assert(MQTTSN_MAX_FILTER_LEVELS < MQTTSN_TRIE_NONE, "Too many filter levels");
+
+/* one level of one or more wildcard topic filters */
+typedef struct {
+    /* the level's text, held in the name of the topic mapping of the filter that added it */
+    uint16_t name_tid;
+    uint8_t level_start;
+    uint8_t level_len;
+
+    uint16_t child;
+    uint16_t sibling;
+
+    /* IDs of the filters that end at this level, and that end with a '#' after it; 0 if none */
+    uint16_t filter_tid;
+    uint16_t multi_tid;
+} MQTTSNTrieNode;
+
+/* Trie of the wildcard topic filters clients have subscribed to, one node per filter level.
+ * Each filter is a topic mapping in the registry, and is removed once nobody's subscribed to it,
+ * giving back the nodes no other filter shares.
+ * Matching a topic visits one branch per level, so it takes time proportional to the topic's depth */
+class MQTTSNTopicTrie {
+    public:
+    MQTTSNTopicTrie(MQTTSNTopicRegistry * topics);
+
+    /* check if a topic name has wildcards in it */
+    static bool is_filter(const uint8_t * name, uint8_t name_len);
+
+    /* add the filter with the given mapping ID, does nothing if it's there already.
+     * Returns false if the filter isn't valid or there are no free nodes */
+    bool insert(uint16_t tid);
+
+    /* take out the filter with the given mapping ID, before its mapping is removed */
+    void remove(uint16_t tid);
+
+    /* get the IDs of up to max_tids filters that match a topic name, returns the number found */
+    uint8_t match(const char * name, uint8_t name_len, uint16_t * tids, uint8_t max_tids);
+
+    private:
+    void match_level(uint16_t node, uint16_t pos);
+
+    /* take a filter out from under a node, giving back the nodes it leaves empty */
+    void remove_level(uint16_t node, uint16_t tid, uint8_t start);
+
+    /* ID of any filter at or under a node, to hold the text of a level it shares */
+    uint16_t any_tid(uint16_t node);
+
+    /* get or add a node for a level under a parent */
+    uint16_t get_child(uint16_t parent, uint16_t name_tid, uint8_t level_start, uint8_t level_len);
+    const char * level_text(uint16_t node);
+
+    MQTTSNTopicRegistry * topics;
+
+    /* node 0 is the root, which has no level of its own */
+    MQTTSNTrieNode nodes[MQTTSN_MAX_FILTER_LEVELS + 1];
+    uint16_t nodes_cnt;
+
+    /* nodes given back by removed filters, linked by their siblings */
+    uint16_t free_head;
+
+    /* the topic being matched, and the results so far */
+    const char * match_name;
+    uint8_t match_name_len;
+    uint16_t * match_tids;
+    uint8_t match_max;
+    uint8_t match_cnt;
+};
+
+#endif
@@ -6,14 +6,12 @@
 #if !defined(MQTTSN_EXCLUDE_TRANSPORT_DUMMY)
 
 #include "mqttsn_transport_dummy.h"
-#include <lite_fifo.h>
 #include <string.h>
 
 MQTTSNTransportDummy * MQTTSNTransportDummy::dummies[MQTTSN_MAX_DUMMY_TRANSPORTS] = {NULL};
-uint8_t MQTTSNTransportDummy::tempbuf[MQTTSN_MAX_MSG_LEN + 1] = {0};
 
-MQTTSNTransportDummy::MQTTSNTransportDummy(uint8_t addr) : 
-    address(addr), read_fifo(read_buf, MQTTSN_TRANSPORT_DUMMY_QUEUED_MSGS, MQTTSN_MAX_MSG_LEN)
+MQTTSNTransportDummy::MQTTSNTransportDummy(uint16_t addr, uint16_t nodes) : 
+    address(addr), nodes(nodes), read_ring(read_buf, sizeof(read_buf))
 {
     for (int i = 0; i < MQTTSN_MAX_DUMMY_TRANSPORTS; i++) {
         /* save the instance for later */
@@ -24,70 +22,97 @@ MQTTSNTransportDummy::MQTTSNTransportDummy(uint8_t addr) :
     }
 }
 
-/* Format is: {1-byte address}{MQTTSN message payload} 
- * First byte of an MQTTSN message is always the length, so we use that */
+void MQTTSNTransportDummy::make_address(uint16_t addr, MQTTSNAddress * out)
+{
+    if (addr <= 0xFF) {
+        out->bytes[0] = addr;
+        out->len = 1;
+    }
+    else {
+        out->bytes[0] = addr >> 8;
+        out->bytes[1] = addr & 0xFF;
+        out->len = 2;
+    }
+}
+
+/* Format is: {2-byte address}{MQTTSN message payload} 
+ * The ring keeps each record's length, so that's the message's length + 2 */
+
+bool MQTTSNTransportDummy::deliver(uint16_t src, const void * data, uint16_t data_len)
+{
+    /* copy src address and data straight into the queue */
+    uint8_t * record = read_ring.reserve(data_len + 2);
+    if (record == NULL)
+        return false;
+    
+    record[0] = src >> 8;
+    record[1] = src & 0xFF;
+    memcpy(record + 2, data, data_len);
+    read_ring.commit(data_len + 2);
+    return true;
+}
  
-uint8_t MQTTSNTransportDummy::write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest)
+uint16_t MQTTSNTransportDummy::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest)
 {
-    /* address should be just one byte in size */
-    if (dest->len != 1 || data_len > MQTTSN_MAX_MSG_LEN) 
+    return write_packet_from(address, data, data_len, dest);
+}
+
+uint16_t MQTTSNTransportDummy::write_packet_from(uint16_t src, const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    /* address should be one or two bytes in size */
+    if (dest->len == 0 || dest->len > 2 || data_len > MQTTSN_MAX_MSG_LEN) 
         return 0;
     
-    /* copy src address and data into buffer */
-    tempbuf[0] = address;
-    memcpy(tempbuf + 1, data, data_len);
+    /* only as one of our own nodes */
+    if ((uint16_t)(src - address) >= nodes)
+        return 0;
     
+    uint16_t addr = (dest->len == 1) ? dest->bytes[0] : ((uint16_t)dest->bytes[0] << 8) | dest->bytes[1];
     for (int i = 0; i < MQTTSN_MAX_DUMMY_TRANSPORTS; i++) {
         MQTTSNTransportDummy * dummy = dummies[i];
         
-        /* check that the message is meant for this dummy */
-        if (dummy != NULL && (dummy->address == dest->bytes[0])) {
-            return dummy->read_fifo.enqueue(tempbuf) ? data_len : 0;
+        /* check that the message is meant for one of this dummy's nodes */
+        if (dummy != NULL && (uint16_t)(addr - dummy->address) < dummy->nodes) {
+            return dummy->deliver(src, data, data_len) ? data_len : 0;
         }
     }
     
     return 0;
 }
 
-int16_t MQTTSNTransportDummy::read_packet(void * data, uint8_t data_len, MQTTSNAddress * src)
+int32_t MQTTSNTransportDummy::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src)
 {
-    /* at least 1 byte capacity */
-    if (MQTTSN_MAX_ADDR_LEN == 0) return 0;
-    
     /* make sure there's something to read */
-    if (read_fifo.available() == 0)
+    uint16_t record_len;
+    uint8_t * record = read_ring.front(&record_len);
+    if (record == NULL)
         return -1;
     
-    /* get the real length of the msg */
-    read_fifo.peek(tempbuf);
-    uint8_t real_len = tempbuf[1];
-    
-    /* not enough space to hold it */
-    if (data_len < real_len)
+    /* not enough space to hold it, drop it */
+    uint16_t real_len = record_len - 2;
+    if (data_len < real_len) {
+        read_ring.pop();
         return 0;
-    
-    read_fifo.dequeue(tempbuf);
+    }
     
     /* copy address and data into user buffer */
-    src->bytes[0] = tempbuf[0];
-    src->len = 1;
-    memcpy(data, tempbuf + 1, real_len);
+    make_address(((uint16_t)record[0] << 8) | record[1], src);
+    memcpy(data, record + 2, real_len);
+    read_ring.pop();
     return real_len;
 }
 
-uint8_t MQTTSNTransportDummy::broadcast(const void * data, uint8_t data_len)
+uint16_t MQTTSNTransportDummy::broadcast(const void * data, uint16_t data_len)
 {
     if (data_len > MQTTSN_MAX_MSG_LEN) 
         return 0;
-        
-    memcpy(tempbuf, data, data_len);
     
     for (int i = 0; i < MQTTSN_MAX_DUMMY_TRANSPORTS; i++) {
         MQTTSNTransportDummy * dummy = dummies[i];
         
         /* (almost) everybody gets this msg */
         if (dummy != NULL && dummy != this) {
-            dummy->read_fifo.enqueue(tempbuf);
+            dummy->deliver(address, data, data_len);
         }
     }
     
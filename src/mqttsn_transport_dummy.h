@@ -6,25 +6,42 @@
 
 #include "mqttsn_defines.h"
 #include "mqttsn_transport.h"
-#include <lite_fifo.h>
+#include "mqttsn_record_ring.h"
 
-/* enough to buffer 8 messages for each dummy */
+/* enough to buffer 8 of the longest messages for each dummy, and more of shorter ones */
 #define MQTTSN_TRANSPORT_DUMMY_QUEUED_MSGS      8
 
-class MQTTSNTransportDummy : public MQTTSNTransport {
+static_assert((MQTTSN_TRANSPORT_DUMMY_QUEUED_MSGS + 1) * (MQTTSN_MAX_MSG_LEN + 4) <= 0xFFFF, "Dummy transport queue is too long");
+
+/* A transport between dummies on the same device, for trying out a gateway and clients without any radios.
+ * A dummy usually sits at one address, but it can stand in for a whole network of 'nodes' at consecutive addresses,
+ * e.g. to load a gateway with thousands of clients on a host; those all share the one queue.
+ * Addresses up to 255 take 1 byte, higher ones take 2 */
+class MQTTSNTransportDummy final : public MQTTSNTransport {
     public:
-        MQTTSNTransportDummy(uint8_t addr);
-        virtual uint8_t write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest);
-        virtual int16_t read_packet(void * data, uint8_t data_len, MQTTSNAddress * src);
-        virtual uint8_t broadcast(const void * data, uint8_t data_len);
+        MQTTSNTransportDummy(uint16_t addr, uint16_t nodes = 1);
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
+        
+        /* send as one of our other nodes, rather than the first */
+        uint16_t write_packet_from(uint16_t src, const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        
+        /* the address of a node, as it's given to and by dummies */
+        static void make_address(uint16_t addr, MQTTSNAddress * out);
     
     private:
-        uint8_t address;
-        LiteFifo read_fifo;
-        uint8_t read_buf[MQTTSN_TRANSPORT_DUMMY_QUEUED_MSGS * (MQTTSN_MAX_MSG_LEN + 1)];
+        uint16_t address;
+        uint16_t nodes;
+        
+        /* queued msgs, each behind its sender's address and its length, they only take up as much as they need.
+           Room for 8 of the longest, plus a spare so the longest always fits once the queue's empty */
+        MQTTSNRecordRing read_ring;
+        uint8_t read_buf[(MQTTSN_TRANSPORT_DUMMY_QUEUED_MSGS + 1) * (MQTTSN_MAX_MSG_LEN + 4)];
+        
+        /* pass a msg from a dummy to this one, returns false if our queue is full */
+        bool deliver(uint16_t src, const void * data, uint16_t data_len);
         
-        /* +1 is for address */
-        static uint8_t tempbuf[MQTTSN_MAX_MSG_LEN + 1];
         /* keep a reference to each dummy client, +1 for the gateway too */
         static MQTTSNTransportDummy * dummies[MQTTSN_MAX_DUMMY_TRANSPORTS];
 };
@@ -0,0 +1,61 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "../mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_TRANSPORT_BATCH)
+
+#include "mqttsn_transport_batch.h"
+
+#include <stdint.h>
+#include <string.h>
+
+MQTTSNTransportBatch::MQTTSNTransportBatch(MQTTSNTransport * transport, uint16_t mtu) :
+    transport(transport), batch_len(0)
+{
+    /* no bigger than our buffer */
+    this->mtu = (mtu < MQTTSN_MAX_MSG_LEN) ? mtu : MQTTSN_MAX_MSG_LEN;
+    batch_dest.len = 0;
+}
+
+uint16_t MQTTSNTransportBatch::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    /* send what we have first if it's going elsewhere, or there's no room left */
+    bool same_dest = (dest->len == batch_dest.len && memcmp(dest->bytes, batch_dest.bytes, dest->len) == 0);
+    if (batch_len != 0 && (!same_dest || batch_len + data_len > mtu))
+        flush();
+
+    /* too big to batch, let the transport deal with it */
+    if (data_len > mtu)
+        return transport->write_packet(data, data_len, dest);
+
+    memcpy(&batch[batch_len], data, data_len);
+    batch_len += data_len;
+    batch_dest = *dest;
+    return data_len;
+}
+
+int32_t MQTTSNTransportBatch::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    return transport->read_packet(data, data_len, src);
+}
+
+uint16_t MQTTSNTransportBatch::broadcast(const void * data, uint16_t data_len)
+{
+    /* broadcasts are rare enough to go straight out, but not ahead of what's waiting */
+    flush();
+    return transport->broadcast(data, data_len);
+}
+
+void MQTTSNTransportBatch::flush(void)
+{
+    if (batch_len != 0) {
+        transport->write_packet(batch, batch_len, &batch_dest);
+        batch_len = 0;
+    }
+
+    /* pass it on, in case the transport below holds msgs back too */
+    transport->flush();
+}
+
+#endif
@@ -0,0 +1,35 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TRANSPORT_BATCH_H_
+#define MQTTSN_TRANSPORT_BATCH_H_
+
+#include <stdint.h>
+#include "../mqttsn_defines.h"
+#include "../mqttsn_transport.h"
+
+/* Wraps another transport, packing msgs to the same destination back to back into one packet,
+ * so small msgs share the per-packet overhead e.g. a radio's preamble and sync words.
+ * Msgs are held till the packet is full, the destination changes, or the client or gateway loop ends.
+ * Receivers split packets up by the msg headers, so they need nothing special */
+class MQTTSNTransportBatch final : public MQTTSNTransport {
+    public:
+        /* mtu is the longest packet the wrapped transport can carry */
+        MQTTSNTransportBatch(MQTTSNTransport * transport, uint16_t mtu);
+
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
+        virtual void flush(void);
+
+    private:
+        MQTTSNTransport * transport;
+        uint16_t mtu;
+
+        /* the packet being filled, and where it's going */
+        uint8_t batch[MQTTSN_MAX_MSG_LEN];
+        uint16_t batch_len;
+        MQTTSNAddress batch_dest;
+};
+
+#endif
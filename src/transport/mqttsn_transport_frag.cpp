@@ -0,0 +1,260 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "../mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_TRANSPORT_FRAG)
+
+#include "mqttsn_transport_frag.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+MQTTSNTransportFrag::MQTTSNTransportFrag(MQTTSNTransport * transport, uint16_t mtu, MQTTSNDevice * device) :
+    transport(transport), device(device), mtu(mtu), tx_next(0), curr_seq(0)
+{
+    /* fragments are no longer than our frame buffer, and their chunk length has to fit a byte */
+    uint16_t frame_len = (mtu < MQTTSN_MAX_MSG_LEN) ? mtu : MQTTSN_MAX_MSG_LEN;
+    uint16_t chunk = (frame_len > MQTTSN_FRAG_DATA_HEADER_LEN) ? frame_len - MQTTSN_FRAG_DATA_HEADER_LEN : 1;
+    chunk_len = (chunk > 0xFF) ? 0xFF : chunk;
+
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+}
+
+uint16_t MQTTSNTransportFrag::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    return send_msg(data, data_len, dest);
+}
+
+uint16_t MQTTSNTransportFrag::broadcast(const void * data, uint16_t data_len)
+{
+    return send_msg(data, data_len, NULL);
+}
+
+void MQTTSNTransportFrag::flush(void)
+{
+    transport->flush();
+}
+
+int32_t MQTTSNTransportFrag::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    uint8_t * buf = (uint8_t *)data;
+
+    while (true) {
+        int32_t rlen = transport->read_packet(buf, data_len, src);
+
+        /* a quiet moment, to catch up on stalled msgs */
+        if (rlen < 0) {
+            check_stalled();
+            return -1;
+        }
+
+        /* whole msgs (and errors) go straight up */
+        if (rlen == 0 || buf[0] != MQTTSN_FRAG_MARKER)
+            return rlen;
+
+        if (rlen < 2)
+            continue;
+
+        if (buf[1] == MQTTSN_FRAG_NACK) {
+            handle_nack(buf, rlen, src);
+            continue;
+        }
+
+        if (buf[1] != MQTTSN_FRAG_DATA)
+            continue;
+
+        MQTTSNFragRxMsg * rx = handle_data(buf, rlen, src);
+        if (rx == NULL)
+            continue;
+
+        if (rx->len > data_len)
+            return 0;
+
+        memcpy(buf, rx->msg, rx->len);
+        return rx->len;
+    }
+}
+
+uint16_t MQTTSNTransportFrag::send_msg(const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    /* fits as it is */
+    if (data_len <= mtu)
+        return (dest != NULL) ? transport->write_packet(data, data_len, dest) : transport->broadcast(data, data_len);
+
+    uint16_t count = (data_len + chunk_len - 1) / chunk_len;
+    if (data_len > MQTTSN_MAX_MSG_LEN || count > MQTTSN_FRAG_MAX_FRAGS)
+        return 0;
+
+    /* hold on to it in case some fragments get lost */
+    MQTTSNFragTxMsg * tx = &tx_msgs[tx_next];
+    tx_next = (tx_next + 1) % MQTTSN_FRAG_MAX_TX_MSGS;
+
+    tx->seq = curr_seq++;
+    tx->len = data_len;
+    memcpy(tx->msg, data, data_len);
+
+    /* a 0-length address stands for a broadcast */
+    if (dest != NULL)
+        tx->dest = *dest;
+    else
+        tx->dest.len = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+        send_fragment(tx, i, dest);
+
+    return data_len;
+}
+
+void MQTTSNTransportFrag::send_fragment(MQTTSNFragTxMsg * tx, uint8_t index, MQTTSNAddress * dest)
+{
+    uint16_t offset = index * chunk_len;
+    uint16_t piece_len = tx->len - offset;
+    if (piece_len > chunk_len)
+        piece_len = chunk_len;
+
+    frame[0] = MQTTSN_FRAG_MARKER;
+    frame[1] = MQTTSN_FRAG_DATA;
+    frame[2] = tx->seq;
+    frame[3] = index;
+    frame[4] = (tx->len + chunk_len - 1) / chunk_len;
+    frame[5] = chunk_len;
+    memcpy(&frame[MQTTSN_FRAG_DATA_HEADER_LEN], &tx->msg[offset], piece_len);
+
+    if (dest != NULL)
+        transport->write_packet(frame, MQTTSN_FRAG_DATA_HEADER_LEN + piece_len, dest);
+    else
+        transport->broadcast(frame, MQTTSN_FRAG_DATA_HEADER_LEN + piece_len);
+}
+
+MQTTSNFragRxMsg * MQTTSNTransportFrag::handle_data(uint8_t * frame, uint16_t frame_len, MQTTSNAddress * src)
+{
+    if (frame_len <= MQTTSN_FRAG_DATA_HEADER_LEN)
+        return NULL;
+
+    uint8_t seq = frame[2];
+    uint8_t index = frame[3];
+    uint8_t count = frame[4];
+    uint8_t chunk = frame[5];
+    uint16_t piece_len = frame_len - MQTTSN_FRAG_DATA_HEADER_LEN;
+    uint16_t offset = index * chunk;
+
+    /* only the last fragment can be short */
+    if (count == 0 || count > MQTTSN_FRAG_MAX_FRAGS || index >= count || piece_len > chunk
+        || (index + 1 < count && piece_len != chunk) || offset + piece_len > MQTTSN_MAX_MSG_LEN)
+    {
+        return NULL;
+    }
+
+    uint32_t now = device->get_millis();
+    MQTTSNFragRxMsg * rx = NULL;
+    MQTTSNFragRxMsg * free_rx = NULL;
+    for (uint8_t i = 0; i < MQTTSN_FRAG_MAX_RX_MSGS; i++) {
+        MQTTSNFragRxMsg * curr = &rx_msgs[i];
+
+        /* a whole msg that's been quiet this long is no longer resent, the same seq now means a new msg */
+        bool expired = !curr->active && now - curr->last_at >= MQTTSN_FRAG_T_EXPIRE;
+        if (!expired && curr->seq == seq && curr->count == count && same_addr(&curr->src, src)) {
+            rx = curr;
+            break;
+        }
+
+        /* else make room in a free slot, or the one that's been quiet longest */
+        if (free_rx == NULL || (free_rx->active && (!curr->active || curr->last_at - free_rx->last_at > 0x7FFFFFFFUL)))
+            free_rx = curr;
+    }
+
+    /* a resent fragment of a msg we already have */
+    if (rx != NULL && !rx->active)
+        return NULL;
+
+    if (rx == NULL) {
+        rx = free_rx;
+        rx->src = *src;
+        rx->seq = seq;
+        rx->count = count;
+        rx->chunk_len = chunk;
+        rx->missing = (count == 32) ? 0xFFFFFFFFUL : ((1UL << count) - 1);
+        rx->len = 0;
+        rx->nacks = 0;
+        rx->active = true;
+    }
+
+    if (rx->chunk_len != chunk)
+        return NULL;
+
+    memcpy(&rx->msg[offset], &frame[MQTTSN_FRAG_DATA_HEADER_LEN], piece_len);
+    rx->missing &= ~(1UL << index);
+    if (index + 1 == count)
+        rx->len = offset + piece_len;
+
+    rx->last_at = now;
+    if (rx->missing != 0)
+        return NULL;
+
+    /* it's whole, but we keep its seq around to spot any stray copies */
+    rx->active = false;
+    return rx;
+}
+
+void MQTTSNTransportFrag::handle_nack(uint8_t * frame, uint16_t frame_len, MQTTSNAddress * src)
+{
+    if (frame_len != MQTTSN_FRAG_NACK_LEN)
+        return;
+
+    uint8_t seq = frame[2];
+    uint32_t missing = ((uint32_t)frame[3] << 24) | ((uint32_t)frame[4] << 16) | ((uint32_t)frame[5] << 8) | frame[6];
+
+    for (uint8_t i = 0; i < MQTTSN_FRAG_MAX_TX_MSGS; i++) {
+        MQTTSNFragTxMsg * tx = &tx_msgs[i];
+        if (tx->len == 0 || tx->seq != seq || (tx->dest.len != 0 && !same_addr(&tx->dest, src)))
+            continue;
+
+        /* just the ones it asked for, and only to whoever asked */
+        uint8_t count = (tx->len + chunk_len - 1) / chunk_len;
+        for (uint8_t index = 0; index < count; index++) {
+            if (missing & (1UL << index))
+                send_fragment(tx, index, src);
+        }
+        return;
+    }
+}
+
+void MQTTSNTransportFrag::check_stalled(void)
+{
+    uint32_t now = device->get_millis();
+
+    for (uint8_t i = 0; i < MQTTSN_FRAG_MAX_RX_MSGS; i++) {
+        MQTTSNFragRxMsg * rx = &rx_msgs[i];
+        if (!rx->active || now - rx->last_at < MQTTSN_FRAG_T_NACK)
+            continue;
+
+        /* the sender's gone quiet, or no longer has it */
+        if (rx->nacks == MQTTSN_FRAG_N_NACK) {
+            rx->active = false;
+            rx->count = 0;
+            continue;
+        }
+
+        frame[0] = MQTTSN_FRAG_MARKER;
+        frame[1] = MQTTSN_FRAG_NACK;
+        frame[2] = rx->seq;
+        frame[3] = rx->missing >> 24;
+        frame[4] = (rx->missing >> 16) & 0xff;
+        frame[5] = (rx->missing >> 8) & 0xff;
+        frame[6] = rx->missing & 0xff;
+        transport->write_packet(frame, MQTTSN_FRAG_NACK_LEN, &rx->src);
+
+        rx->nacks++;
+        rx->last_at = now;
+    }
+}
+
+bool MQTTSNTransportFrag::same_addr(const MQTTSNAddress * a, const MQTTSNAddress * b)
+{
+    return a->len == b->len && memcmp(a->bytes, b->bytes, a->len) == 0;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TRANSPORT_FRAG_H_
+#define MQTTSN_TRANSPORT_FRAG_H_
+
+#include <stdint.h>
+#include "../mqttsn_defines.h"
+#include "../mqttsn_transport.h"
+#include "../mqttsn_device.h"
+
+/* A fragment starts with a 0 byte, which no MQTTSN msg can start with, then its type */
+#define MQTTSN_FRAG_MARKER              0x00
+#define MQTTSN_FRAG_DATA                0x01
+#define MQTTSN_FRAG_NACK                0x02
+
+/* {marker}{DATA}{msg seq}{index}{count}{chunk len}{chunk} */
+#define MQTTSN_FRAG_DATA_HEADER_LEN     6
+/* {marker}{NACK}{msg seq}{4-byte bitmap of missing fragments} */
+#define MQTTSN_FRAG_NACK_LEN            7
+
+#define MQTTSN_FRAG_MAX_FRAGS           32
+
+/* how long a whole msg's seq is kept for spotting stray copies, as long as its sender might still resend */
+#define MQTTSN_FRAG_T_EXPIRE            (MQTTSN_FRAG_T_NACK * (MQTTSN_FRAG_N_NACK + 1))
+
+/* a msg being put back together */
+typedef struct {
+    MQTTSNAddress src;
+    uint8_t seq;
+    uint8_t count;
+    uint8_t chunk_len;
+
+    /* bit i is set while fragment i is missing, 0 once the msg is whole */
+    uint32_t missing;
+    uint16_t len;
+
+    uint32_t last_at;
+    uint8_t nacks;
+    bool active;
+
+    uint8_t msg[MQTTSN_MAX_MSG_LEN];
+} MQTTSNFragRxMsg;
+
+/* a sent msg, held for resending the fragments a receiver asks for */
+typedef struct {
+    MQTTSNAddress dest;
+    uint8_t seq;
+    uint16_t len;
+    uint8_t msg[MQTTSN_MAX_MSG_LEN];
+} MQTTSNFragTxMsg;
+
+/* Wraps another transport whose packets are shorter than MQTTSN_MAX_MSG_LEN.
+ * Msgs that fit in one packet go through as they are, longer ones get split into numbered fragments
+ * and put back together on the other side. A receiver missing fragments asks the sender for just those,
+ * so one lost fragment doesn't cost the whole msg. Both ends must use it */
+class MQTTSNTransportFrag final : public MQTTSNTransport {
+    public:
+        /* mtu is the longest packet the wrapped transport can carry */
+        MQTTSNTransportFrag(MQTTSNTransport * transport, uint16_t mtu, MQTTSNDevice * device);
+
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
+        virtual void flush(void);
+
+    private:
+        /* split a msg up and send it, to dest or to everyone if dest is NULL */
+        uint16_t send_msg(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        void send_fragment(MQTTSNFragTxMsg * tx, uint8_t index, MQTTSNAddress * dest);
+
+        /* returns the msg once it's whole, NULL otherwise */
+        MQTTSNFragRxMsg * handle_data(uint8_t * frame, uint16_t frame_len, MQTTSNAddress * src);
+        void handle_nack(uint8_t * frame, uint16_t frame_len, MQTTSNAddress * src);
+
+        /* ask for the missing fragments of any msgs that have stalled */
+        void check_stalled(void);
+
+        static bool same_addr(const MQTTSNAddress * a, const MQTTSNAddress * b);
+
+        MQTTSNTransport * transport;
+        MQTTSNDevice * device;
+        uint16_t mtu;
+        uint8_t chunk_len;
+
+        MQTTSNFragRxMsg rx_msgs[MQTTSN_FRAG_MAX_RX_MSGS];
+
+        /* sent msgs, the oldest gets overwritten */
+        MQTTSNFragTxMsg tx_msgs[MQTTSN_FRAG_MAX_TX_MSGS];
+        uint8_t tx_next;
+        uint8_t curr_seq;
+
+        /* for outgoing fragments and NACKs, incoming ones are read straight into the caller's buffer */
+        uint8_t frame[MQTTSN_MAX_MSG_LEN];
+};
+
+#endif
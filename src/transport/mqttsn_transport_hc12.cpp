@@ -15,25 +15,27 @@ MQTTSNTransportHC12::MQTTSNTransportHC12(HC12 * port) : port(port)
     
 }
 
-uint8_t MQTTSNTransportHC12::write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest) 
+uint16_t MQTTSNTransportHC12::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest) 
 {
-    /* address should be just one byte in size */
-    if (dest->len != 1) return 0;
+    /* address should be just one byte in size, and the radio's lengths are only a byte long */
+    if (dest->len != 1 || data_len > 0xFF) return 0;
     
     return port->send(data, data_len, dest->bytes[0]);
 }
 
-int16_t MQTTSNTransportHC12::read_packet(void * data, uint8_t data_len, MQTTSNAddress * src) 
+int32_t MQTTSNTransportHC12::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src) 
 {
     /* at least 1 byte capacity */
     if (MQTTSN_MAX_ADDR_LEN == 0) return 0;
     
     src->len = 1;
-    return port->recv(data, data_len, src->bytes);
+    return port->recv(data, (data_len > 0xFF) ? 0xFF : data_len, src->bytes);
 }
 
-uint8_t MQTTSNTransportHC12::broadcast(const void * data, uint8_t data_len) 
+uint16_t MQTTSNTransportHC12::broadcast(const void * data, uint16_t data_len) 
 {
+    if (data_len > 0xFF) return 0;
+    
     return port->broadcast(data, data_len);
 }
 
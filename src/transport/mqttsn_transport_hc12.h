@@ -8,13 +8,13 @@
 class HC12;
 
 
-class MQTTSNTransportHC12 : public MQTTSNTransport {
+class MQTTSNTransportHC12 final : public MQTTSNTransport {
     public:
         MQTTSNTransportHC12(HC12 * port);
         
-        virtual uint8_t write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest);
-        virtual int16_t read_packet(void * data, uint8_t data_len, MQTTSNAddress * src);
-        virtual uint8_t broadcast(const void * data, uint8_t data_len);
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
     
     protected:
         HC12 * port;
@@ -15,17 +15,17 @@ MQTTSNTransportRFM69X::MQTTSNTransportRFM69X(RFM69X * radio) : radio(radio)
     
 }
 
-uint8_t MQTTSNTransportRFM69X::write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest) 
+uint16_t MQTTSNTransportRFM69X::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest) 
 {
-    /* dest address should be just one byte in size */
-    if (dest->len != 1) return 0;
+    /* dest address should be just one byte in size, and the msg must fit in one radio packet */
+    if (dest->len != 1 || data_len > RF69_MAX_DATA_LEN) return 0;
     
     /* don't request for ack */
     radio->send(dest->bytes[0], data, data_len, false);
     return data_len;
 }
 
-int16_t MQTTSNTransportRFM69X::read_packet(void * data, uint8_t data_len, MQTTSNAddress * src) 
+int32_t MQTTSNTransportRFM69X::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src) 
 {
     /* at least 1 byte capacity */
     if (MQTTSN_MAX_ADDR_LEN == 0) return 0;
@@ -42,8 +42,10 @@ int16_t MQTTSNTransportRFM69X::read_packet(void * data, uint8_t data_len, MQTTSN
     return radio->DATALEN;
 }
 
-uint8_t MQTTSNTransportRFM69X::broadcast(const void * data, uint8_t data_len) 
+uint16_t MQTTSNTransportRFM69X::broadcast(const void * data, uint16_t data_len) 
 {
+    if (data_len > RF69_MAX_DATA_LEN) return 0;
+    
     /* don't request for ack */
     radio->send(RF69_BROADCAST_ADDR, data, data_len, false);
     return data_len;
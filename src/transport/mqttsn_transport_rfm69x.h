@@ -8,13 +8,13 @@
 class RFM69X;
 
 
-class MQTTSNTransportRFM69X : public MQTTSNTransport {
+class MQTTSNTransportRFM69X final : public MQTTSNTransport {
     public:
         MQTTSNTransportRFM69X(RFM69X * radio);
         
-        virtual uint8_t write_packet(const void * data, uint8_t data_len, MQTTSNAddress * dest);
-        virtual int16_t read_packet(void * data, uint8_t data_len, MQTTSNAddress * src);
-        virtual uint8_t broadcast(const void * data, uint8_t data_len);
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
     
     protected:
         RFM69X * radio;
@@ -0,0 +1,148 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "../mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+
+#include "mqttsn_transport_shard.h"
+#include "../mqttsn_hash.h"
+#include "../mqttsn_messages.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+/********************** MQTTSNShardTransport ************************/
+
+MQTTSNShardTransport::MQTTSNShardTransport(void) :
+    rx_ring(rx_buf, MQTTSN_THREADED_RING_BYTES), tx_ring(tx_buf, MQTTSN_THREADED_RING_BYTES), flush_pending(false)
+{
+
+}
+
+uint16_t MQTTSNShardTransport::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    return MQTTSNTransportThreaded::queue_packet(&tx_ring, data, data_len, dest);
+}
+
+uint16_t MQTTSNShardTransport::broadcast(const void * data, uint16_t data_len)
+{
+    return MQTTSNTransportThreaded::queue_packet(&tx_ring, data, data_len, NULL);
+}
+
+void MQTTSNShardTransport::flush(void)
+{
+    flush_pending = true;
+}
+
+int32_t MQTTSNShardTransport::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    return MQTTSNTransportThreaded::unqueue_packet(&rx_ring, data, data_len, src);
+}
+
+/********************** MQTTSNShardRouter ************************/
+
+MQTTSNShardRouter::MQTTSNShardRouter(MQTTSNTransport * transport, uint8_t num_shards) :
+    transport(transport), running(false)
+{
+    if (num_shards == 0)
+        num_shards = 1;
+
+    this->num_shards = (num_shards < MQTTSN_MAX_SHARDS) ? num_shards : MQTTSN_MAX_SHARDS;
+}
+
+MQTTSNShardRouter::~MQTTSNShardRouter(void)
+{
+    stop();
+}
+
+MQTTSNTransport * MQTTSNShardRouter::get_transport(uint8_t shard)
+{
+    return (shard < num_shards) ? &shards[shard] : NULL;
+}
+
+uint8_t MQTTSNShardRouter::get_shard(const MQTTSNAddress * addr) const
+{
+    return mqttsn_hash(addr->bytes, addr->len) % num_shards;
+}
+
+bool MQTTSNShardRouter::start(void)
+{
+    if (running)
+        return false;
+
+    running = true;
+    thread = std::thread(&MQTTSNShardRouter::run, this);
+    return true;
+}
+
+void MQTTSNShardRouter::stop(void)
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+bool MQTTSNShardRouter::poll(void)
+{
+    bool busy = false;
+
+    /* send what the shards have for their clients */
+    bool flush = false;
+    for (uint8_t i = 0; i < num_shards; i++) {
+        MQTTSNShardTransport * shard = &shards[i];
+        bool shard_flush = shard->flush_pending.exchange(false);
+
+        uint8_t * out;
+        uint16_t out_len;
+        MQTTSNAddress dest;
+        while ((out = MQTTSNTransportThreaded::front_packet(&shard->tx_ring, &out_len, &dest)) != NULL) {
+            if (dest.len != 0)
+                transport->write_packet(out, out_len, &dest);
+            else if (i == 0 || !is_advertise(out, out_len))
+                transport->broadcast(out, out_len);
+
+            shard->tx_ring.pop();
+            busy = true;
+        }
+
+        flush = flush || shard_flush;
+    }
+
+    if (flush)
+        transport->flush();
+
+    /* then hand each new packet to its sender's shard, a full shard loses it like a busy radio would.
+       No more than the shards read in a loop each, so a flood can't hold up what's going out */
+    for (uint16_t n = 0; n < MQTTSN_GW_RX_BUDGET * num_shards; n++) {
+        MQTTSNAddress src;
+        int32_t rlen = transport->read_packet(packet, MQTTSN_MAX_MSG_LEN, &src);
+        if (rlen < 0)
+            break;
+
+        busy = true;
+        if (rlen == 0)
+            continue;
+
+        MQTTSNTransportThreaded::queue_packet(&shards[get_shard(&src)].rx_ring, packet, rlen, &src);
+    }
+
+    return busy;
+}
+
+bool MQTTSNShardRouter::is_advertise(uint8_t * data, uint16_t data_len)
+{
+    MQTTSNHeader hdr;
+    return hdr.unpack(data, data_len) != 0 && hdr.msg_type == MQTTSN_ADVERTISE;
+}
+
+void MQTTSNShardRouter::run(void)
+{
+    while (running) {
+        if (!poll())
+            std::this_thread::sleep_for(std::chrono::microseconds(MQTTSN_THREADED_IDLE_US));
+    }
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TRANSPORT_SHARD_H_
+#define MQTTSN_TRANSPORT_SHARD_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "../mqttsn_defines.h"
+#include "../mqttsn_transport.h"
+#include "../mqttsn_record_ring.h"
+#include "mqttsn_transport_threaded.h"
+
+/* one shard's view of the router's transport, packets come and go through a pair of rings */
+class MQTTSNShardTransport final : public MQTTSNTransport {
+    public:
+        MQTTSNShardTransport(void);
+
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
+        virtual void flush(void);
+
+    private:
+        friend class MQTTSNShardRouter;
+
+        /* packets from the router to the shard, and from the shard to the router, queued like the threaded transport's */
+        MQTTSNRecordRing rx_ring;
+        MQTTSNRecordRing tx_ring;
+        uint8_t rx_buf[MQTTSN_THREADED_RING_BYTES];
+        uint8_t tx_buf[MQTTSN_THREADED_RING_BYTES];
+
+        std::atomic<bool> flush_pending;
+};
+
+/* Splits the clients of one transport between the shards of a gateway, by a hash of their address,
+ * so each client only ever talks to one shard. Each shard's gateway registers its own get_transport(),
+ * and runs its loop() on a thread of its own. The router moves the packets on another.
+ * ADVERTISEs from all but the first shard are dropped, they'd only repeat its own.
+ * Other broadcasts, like the GWINFO a shard sends back for a SEARCHGW, all go out */
+class MQTTSNShardRouter {
+    public:
+        MQTTSNShardRouter(MQTTSNTransport * transport, uint8_t num_shards);
+        ~MQTTSNShardRouter(void);
+
+        MQTTSNTransport * get_transport(uint8_t shard);
+
+        /* the shard a client's packets go to */
+        uint8_t get_shard(const MQTTSNAddress * addr) const;
+
+        /* start and stop the router's thread, the wrapped transport belongs to it in between */
+        bool start(void);
+        void stop(void);
+
+        /* move packets between the transport and the shards, returns true if there were any */
+        bool poll(void);
+
+    private:
+        void run(void);
+        static bool is_advertise(uint8_t * data, uint16_t data_len);
+
+        MQTTSNTransport * transport;
+        uint8_t num_shards;
+        MQTTSNShardTransport shards[MQTTSN_MAX_SHARDS];
+
+        /* for packets on their way in */
+        uint8_t packet[MQTTSN_MAX_MSG_LEN];
+
+        std::thread thread;
+        std::atomic<bool> running;
+};
+
+#endif
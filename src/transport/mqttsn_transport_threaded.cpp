@@ -0,0 +1,181 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#include "../mqttsn_excludes.h"
+
+#if !defined(MQTTSN_EXCLUDE_THREADS)
+
+#include "mqttsn_transport_threaded.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+MQTTSNTransportThreaded::MQTTSNTransportThreaded(MQTTSNTransport * transport) :
+    transport(transport),
+    rx_ring(rx_buf, MQTTSN_THREADED_RING_BYTES),
+    tx_ring(tx_buf, MQTTSN_THREADED_RING_BYTES),
+    running(false), flush_pending(false)
+{
+
+}
+
+MQTTSNTransportThreaded::~MQTTSNTransportThreaded(void)
+{
+    stop();
+}
+
+bool MQTTSNTransportThreaded::start(void)
+{
+    if (running)
+        return false;
+
+    running = true;
+    thread = std::thread(&MQTTSNTransportThreaded::run, this);
+    return true;
+}
+
+void MQTTSNTransportThreaded::stop(void)
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+uint16_t MQTTSNTransportThreaded::write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest)
+{
+    return queue_packet(&tx_ring, data, data_len, dest);
+}
+
+uint16_t MQTTSNTransportThreaded::broadcast(const void * data, uint16_t data_len)
+{
+    return queue_packet(&tx_ring, data, data_len, NULL);
+}
+
+void MQTTSNTransportThreaded::flush(void)
+{
+    flush_pending = true;
+}
+
+int32_t MQTTSNTransportThreaded::read_packet(void * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    return unqueue_packet(&rx_ring, data, data_len, src);
+}
+
+uint16_t MQTTSNTransportThreaded::queue_packet(MQTTSNRecordRing * ring, const void * data, uint16_t data_len, const MQTTSNAddress * dest)
+{
+    uint8_t addr_len = (dest != NULL) ? dest->len : 0;
+    if (data_len > MQTTSN_MAX_MSG_LEN || addr_len > MQTTSN_MAX_ADDR_LEN)
+        return 0;
+
+    uint8_t * record = ring->reserve(1 + addr_len + data_len);
+    if (record == NULL)
+        return 0;
+
+    record[0] = addr_len;
+    if (addr_len != 0)
+        memcpy(record + 1, dest->bytes, addr_len);
+
+    memcpy(record + 1 + addr_len, data, data_len);
+    ring->commit(1 + addr_len + data_len);
+    return data_len;
+}
+
+int32_t MQTTSNTransportThreaded::unqueue_packet(MQTTSNRecordRing * ring, void * data, uint16_t data_len, MQTTSNAddress * src)
+{
+    uint16_t len;
+    uint8_t * packet = front_packet(ring, &len, src);
+    if (packet == NULL)
+        return -1;
+
+    /* too long for the caller, it's dropped all the same */
+    int32_t rlen = 0;
+    if (len <= data_len) {
+        memcpy(data, packet, len);
+        rlen = len;
+    }
+
+    ring->pop();
+    return rlen;
+}
+
+uint8_t * MQTTSNTransportThreaded::front_packet(MQTTSNRecordRing * ring, uint16_t * data_len, MQTTSNAddress * dest)
+{
+    uint16_t record_len;
+    uint8_t * record = ring->front(&record_len);
+    if (record == NULL)
+        return NULL;
+
+    dest->len = record[0];
+    memcpy(dest->bytes, record + 1, dest->len);
+    *data_len = record_len - 1 - dest->len;
+    return record + 1 + dest->len;
+}
+
+void MQTTSNTransportThreaded::run(void)
+{
+    while (running) {
+        bool busy = send_packets();
+        busy = read_packets() || busy;
+
+        /* nap till there might be something new */
+        if (!busy)
+            std::this_thread::sleep_for(std::chrono::microseconds(MQTTSN_THREADED_IDLE_US));
+    }
+}
+
+bool MQTTSNTransportThreaded::send_packets(void)
+{
+    /* taken first, so everything queued before the flush goes out with it */
+    bool flush = flush_pending.exchange(false);
+
+    /* straight from the ring */
+    bool sent = false;
+    uint8_t * packet;
+    uint16_t len;
+    MQTTSNAddress dest;
+    while ((packet = front_packet(&tx_ring, &len, &dest)) != NULL) {
+        if (dest.len != 0)
+            transport->write_packet(packet, len, &dest);
+        else
+            transport->broadcast(packet, len);
+
+        tx_ring.pop();
+        sent = true;
+    }
+
+    if (flush)
+        transport->flush();
+
+    return sent;
+}
+
+bool MQTTSNTransportThreaded::read_packets(void)
+{
+    /* read straight into the ring, leaving whatever doesn't fit in the wrapped transport
+       till the caller catches up */
+    bool got = false;
+    uint8_t * record;
+    while ((record = rx_ring.reserve(MQTTSN_THREADED_MAX_RECORD_LEN)) != NULL) {
+        MQTTSNAddress src;
+        int32_t rlen = transport->read_packet(record + 1 + MQTTSN_MAX_ADDR_LEN, MQTTSN_MAX_MSG_LEN, &src);
+        if (rlen < 0)
+            break;
+
+        got = true;
+        if (rlen == 0)
+            continue;
+
+        /* it was read in past room for the longest address, close the gap now we know the real one */
+        record[0] = src.len;
+        memcpy(record + 1, src.bytes, src.len);
+        if (src.len != MQTTSN_MAX_ADDR_LEN)
+            memmove(record + 1 + src.len, record + 1 + MQTTSN_MAX_ADDR_LEN, rlen);
+
+        rx_ring.commit(1 + src.len + rlen);
+    }
+
+    return got;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/* Written by Brian Ejike (2019)
+ * DIstributed under the MIT License */
+
+#ifndef MQTTSN_TRANSPORT_THREADED_H_
+#define MQTTSN_TRANSPORT_THREADED_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "../mqttsn_defines.h"
+#include "../mqttsn_transport.h"
+#include "../mqttsn_record_ring.h"
+
+/* Packets on their way to or from the wrapped transport are queued as records of
+ * {1-byte address length}{address}{packet}, a 0-length address stands for a broadcast */
+#define MQTTSN_THREADED_MAX_RECORD_LEN  (1 + MQTTSN_MAX_ADDR_LEN + MQTTSN_MAX_MSG_LEN)
+
+static_assert(MQTTSN_THREADED_RING_BYTES <= 0xFFFF, "Threaded ring is too long");
+static_assert(MQTTSN_THREADED_RING_BYTES >= 2 * MQTTSN_THREADED_MAX_RECORD_LEN + 5, "Threaded ring can't fit the longest packet");
+
+/* Wraps another transport, giving it a thread of its own to do all its reading and writing,
+ * so a slow radio only holds up its own msgs. The gateway or client talks to it through a pair of
+ * lock-free rings, one each way, and must stick to a single thread of its own.
+ * Writes return once the packet's queued, and fail if the ring's full */
+class MQTTSNTransportThreaded final : public MQTTSNTransport {
+    public:
+        MQTTSNTransportThreaded(MQTTSNTransport * transport);
+        ~MQTTSNTransportThreaded(void);
+
+        /* start and stop the I/O thread, the wrapped transport belongs to it in between */
+        bool start(void);
+        void stop(void);
+
+        virtual uint16_t write_packet(const void * data, uint16_t data_len, MQTTSNAddress * dest);
+        virtual int32_t read_packet(void * data, uint16_t data_len, MQTTSNAddress * src);
+        virtual uint16_t broadcast(const void * data, uint16_t data_len);
+        virtual void flush(void);
+
+        /* queue a packet for an address, or a broadcast if it's NULL; returns its length, 0 if there's no room */
+        static uint16_t queue_packet(MQTTSNRecordRing * ring, const void * data, uint16_t data_len, const MQTTSNAddress * dest);
+
+        /* take the oldest packet off a ring, like a transport's read_packet() */
+        static int32_t unqueue_packet(MQTTSNRecordRing * ring, void * data, uint16_t data_len, MQTTSNAddress * src);
+
+        /* the oldest packet on a ring, in place, NULL if there's none. Its address has a 0 length for a broadcast */
+        static uint8_t * front_packet(MQTTSNRecordRing * ring, uint16_t * data_len, MQTTSNAddress * dest);
+
+    private:
+        /* the I/O thread, returns true if there was anything to do */
+        void run(void);
+        bool send_packets(void);
+        bool read_packets(void);
+
+        MQTTSNTransport * transport;
+
+        /* packets from the wrapped transport to the caller, and from the caller to it */
+        MQTTSNRecordRing rx_ring;
+        MQTTSNRecordRing tx_ring;
+        uint8_t rx_buf[MQTTSN_THREADED_RING_BYTES];
+        uint8_t tx_buf[MQTTSN_THREADED_RING_BYTES];
+
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<bool> flush_pending;
+};
+
+#endif